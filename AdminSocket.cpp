@@ -0,0 +1,143 @@
+#include "AdminSocket.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+
+// Room for the JSON of a full snapshot, even with the longest coordinates (a float printed with %.4f takes up to 47 characters)
+#define ADMIN_BUFFER_SIZE			(128 + SNAPSHOT_PLAYER_LIMIT * 384)
+
+
+AdminSocket::AdminSocket()
+{
+	path = NULL;
+	listenfd = -1;
+	snapshot = NULL;
+}
+
+
+AdminSocket::~AdminSocket()
+{
+	if (listenfd == -1) return;
+
+	// Wake the thread from accept(), it stops once accepting fails
+	shutdown(listenfd, SHUT_RDWR);
+
+	if (thread.joinable()) thread.join();
+
+	close(listenfd);
+	unlink(path);
+}
+
+
+int AdminSocket::start(const char* path, const WorldSnapshot* snapshot)
+{
+	this->path = path;
+	this->snapshot = snapshot;
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "Admin socket path %s is too long\n", path);
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if (sockfd == -1)
+	{
+		fprintf(stderr, "Error creating admin socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	// A socket file left behind by a previous run would make bind() fail
+	unlink(path);
+
+	if (bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(sockfd, SOMAXCONN) == -1)
+	{
+		fprintf(stderr, "Failed to listen on %s: %s\n", path, strerror(errno));
+		close(sockfd);
+		return -1;
+	}
+
+	listenfd = sockfd;
+
+	thread = std::thread(&AdminSocket::serve, this);
+
+	return 0;
+}
+
+
+void AdminSocket::serve()
+{
+	char* text = new char[ADMIN_BUFFER_SIZE];
+	WorldView* view = new WorldView;
+
+	while (true)
+	{
+		int sockfd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC);
+
+		if (sockfd == -1)
+		{
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+
+			// The listening socket was shut down (or the process is out of descriptors, which does not get better here)
+			break;
+		}
+
+		struct timeval timeout;
+		timeout.tv_sec = ADMIN_SEND_TIMEOUT_SEC;
+		timeout.tv_usec = 0;
+		setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		snapshot->read(view);
+
+		int length = formatView(view, text, ADMIN_BUFFER_SIZE);
+		int offset = 0;
+
+		while (offset < length)
+		{
+			ssize_t bytes = send(sockfd, text + offset, length - offset, MSG_NOSIGNAL);
+
+			if (bytes == -1)
+			{
+				if (errno == EINTR) continue;
+				break;
+			}
+
+			offset += bytes;
+		}
+
+		close(sockfd);
+	}
+
+	delete view;
+	delete[] text;
+}
+
+
+int AdminSocket::formatView(const WorldView* view, char* buffer, int capacity)
+{
+	int length = snprintf(buffer, capacity, "{\"tick\":%u,\"time_ms\":%.1f,\"players\":[", view->tick, view->timeMillisec);
+
+	for (int i = 0; i < view->numPlayers; i++)
+	{
+		const PlayerView* player = &view->players[i];
+
+		length += snprintf(buffer + length, capacity - length, "%s{\"id\":%d,\"x\":%.4f,\"y\":%.4f,\"z\":%.4f,\"score\":%d,\"alive\":%s,\"near\":%d,\"moves\":%u,\"coalesced\":%u,\"limited_ticks\":%u}", (i > 0) ? "," : "", player->id, player->x, player->y, player->z, player->score, player->isAlive ? "true" : "false", player->numNeighbours, player->movesReceived, player->movesCoalesced, player->ticksAtMoveLimit);
+	}
+
+	length += snprintf(buffer + length, capacity - length, "]}\n");
+
+	return length;
+}
@@ -0,0 +1,53 @@
+#ifndef ADMIN_SOCKET_H
+#define ADMIN_SOCKET_H
+
+
+/********************************************************************************************************************************************
+ *
+ * The admin socket lets tools on the same host (administration, matchmaking, anti-cheat) look at the game without joining it.
+ * It is an AF_UNIX stream socket, so access is controlled by the permissions of its path.
+ *
+ * A tool connects, and gets the latest world snapshot (see WorldSnapshot.h) as one line of JSON, after which the connection is closed:
+ *
+ * {"tick":120,"time_ms":6001.2,"players":[{"id":0,"x":0.5,"y":0.5,"z":0.5,"score":2,"alive":true,"near":1,"moves":40,"coalesced":31,"limited_ticks":0}, ...]}
+ *
+ * Connections are served by a thread of their own, which only reads snapshots, so a slow tool never holds up the game loop.
+ *
+ *********************************************************************************************************************************************/
+
+
+#include <thread>
+
+#include "WorldSnapshot.h"
+
+
+#define ADMIN_SEND_TIMEOUT_SEC		1		// A tool that does not read its snapshot within this time is dropped
+
+
+class AdminSocket
+{
+	private:
+
+		const char* path;
+		int listenfd;
+		const WorldSnapshot* snapshot;
+		std::thread thread;
+
+		// Accept tools and send each one the latest snapshot, until the listening socket is shut down
+		void serve();
+
+		// Write the view as a line of JSON into buffer
+		// Return the length of the text
+		int formatView(const WorldView* view, char* buffer, int capacity);
+
+	public:
+
+		AdminSocket();
+		~AdminSocket();
+
+		// Listen at the path and start serving snapshots on a new thread
+		// Return -1 if the socket cannot be created
+		int start(const char* path, const WorldSnapshot* snapshot);
+};
+
+#endif
@@ -0,0 +1,227 @@
+#include "AsyncScheduler.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+
+AsyncOperation::AsyncOperation(AsyncScheduler* scheduler, int sockfd, bool forWrite)
+{
+	this->scheduler = scheduler;
+	this->sockfd = sockfd;
+	this->forWrite = forWrite;
+}
+
+
+void AsyncOperation::await_suspend(std::coroutine_handle<> handle)
+{
+	scheduler->wait(this, handle);
+}
+
+
+AsyncAccept::AsyncAccept(AsyncScheduler* scheduler, int sockfd, struct sockaddr* addr, socklen_t* addrlen) : AsyncOperation(scheduler, sockfd, false)
+{
+	this->addr = addr;
+	this->addrlen = addrlen;
+	addrCapacity = *addrlen;
+	result = -1;
+	isBackingOff = false;
+}
+
+
+bool AsyncAccept::attempt()
+{
+	while (true)
+	{
+		*addrlen = addrCapacity;
+		result = accept4(sockfd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		
+		if (result != -1)
+		{
+			if (isBackingOff) fprintf(stderr, "Accepting new connections again\n");
+			isBackingOff = false;
+			return true;
+		}
+		
+		// The client gave up before it was accepted, try the next one
+		if (errno == ECONNABORTED || errno == EINTR) continue;
+		
+		// Out of file descriptors (or socket memory): the connection stays in the backlog and the socket stays readable
+		// Pause before trying again, and only report the first failure of a streak
+		if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+		{
+			if (!isBackingOff) fprintf(stderr, "Failed to accept new connection: %s, pausing accepts\n", strerror(errno));
+			
+			isBackingOff = true;
+			clock_gettime(CLOCK_MONOTONIC, &retryTime);
+			retryTime.tv_nsec += ACCEPT_BACKOFF_MILLISEC * 1000000L;
+			retryTime.tv_sec += retryTime.tv_nsec / 1000000000L;
+			retryTime.tv_nsec %= 1000000000L;
+			
+			return false;
+		}
+		
+		// The backlog is empty, or accepting failed otherwise
+		// Either way, wait until select() reports the socket again
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+		{
+			fprintf(stderr, "Failed to accept new connection: %s\n", strerror(errno));
+		}
+		
+		return false;
+	}
+}
+
+
+bool AsyncAccept::isParked()
+{
+	if (!isBackingOff) return false;
+	
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return now.tv_sec < retryTime.tv_sec || (now.tv_sec == retryTime.tv_sec && now.tv_nsec < retryTime.tv_nsec);
+}
+
+
+AsyncScheduler::AsyncScheduler()
+{
+	numWaiters = 0;
+	nextID = 0;
+}
+
+
+int AsyncScheduler::findWaiter(uint32_t id)
+{
+	for (int i = 0; i < numWaiters; i++)
+	{
+		if (waiters[i].id == id) return i;
+	}
+	
+	return -1;
+}
+
+
+void AsyncScheduler::removeWaiter(int index)
+{
+	// Move the last waiter into the freed entry
+	numWaiters--;
+	waiters[index] = waiters[numWaiters];
+}
+
+
+void AsyncScheduler::wait(AsyncOperation* operation, std::coroutine_handle<> handle)
+{
+	// Every connection has at most one coroutine, so this only happens if ASYNC_WAITER_LIMIT is set too low
+	if (numWaiters == ASYNC_WAITER_LIMIT)
+	{
+		fprintf(stderr, "Too many suspended coroutines\n");
+		abort();
+	}
+	
+	waiters[numWaiters].operation = operation;
+	waiters[numWaiters].handle = handle;
+	waiters[numWaiters].id = nextID;
+	
+	numWaiters++;
+	nextID++;
+}
+
+
+void AsyncScheduler::cancel(int sockfd)
+{
+	int i = 0;
+	while (i < numWaiters)
+	{
+		if (waiters[i].operation->getSocket() == sockfd)
+		{
+			// Destroying the coroutine also destroys the operation, which lives in the coroutine frame
+			std::coroutine_handle<> handle = waiters[i].handle;
+			removeWaiter(i);
+			handle.destroy();
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
+
+
+int AsyncScheduler::addToSets(fd_set* readSet, fd_set* writeSet)
+{
+	int maxfd = -1;
+	
+	for (int i = 0; i < numWaiters; i++)
+	{
+		if (waiters[i].operation->isParked()) continue;
+		
+		int sockfd = waiters[i].operation->getSocket();
+		
+		if (waiters[i].operation->isForWrite())
+		{
+			FD_SET(sockfd, writeSet);
+		}
+		else
+		{
+			FD_SET(sockfd, readSet);
+		}
+		
+		if (sockfd > maxfd) maxfd = sockfd;
+	}
+	
+	return maxfd;
+}
+
+
+void AsyncScheduler::resumeReady(const fd_set* readSet, const fd_set* writeSet)
+{
+	// Take the ready waiters first, since resumed coroutines register new ones
+	uint32_t readyIDs[ASYNC_WAITER_LIMIT];
+	int numReady = 0;
+	
+	for (int i = 0; i < numWaiters; i++)
+	{
+		if (waiters[i].operation->isParked()) continue;
+		
+		int sockfd = waiters[i].operation->getSocket();
+		const fd_set* set = waiters[i].operation->isForWrite() ? writeSet : readSet;
+		
+		if (FD_ISSET(sockfd, set) || waiters[i].operation->isRunnable())
+		{
+			readyIDs[numReady] = waiters[i].id;
+			numReady++;
+		}
+	}
+	
+	for (int k = 0; k < numReady; k++)
+	{
+		// A coroutine resumed earlier may have cancelled this one
+		int index = findWaiter(readyIDs[k]);
+		
+		if (index == -1) continue;
+		
+		if (!waiters[index].operation->attempt()) continue;
+		
+		std::coroutine_handle<> handle = waiters[index].handle;
+		removeWaiter(index);
+		handle.resume();
+	}
+}
+
+
+bool AsyncScheduler::hasRunnable()
+{
+	for (int i = 0; i < numWaiters; i++)
+	{
+		if (waiters[i].operation->isRunnable() && !waiters[i].operation->isParked()) return true;
+	}
+	
+	return false;
+}
+
+
+int AsyncScheduler::getNumWaiting()
+{
+	return numWaiters;
+}
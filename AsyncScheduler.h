@@ -0,0 +1,164 @@
+#ifndef ASYNC_SCHEDULER_H
+#define ASYNC_SCHEDULER_H
+
+
+/********************************************************************************************************************************************
+ * 
+ * A small coroutine layer on top of the select() loop, so the protocol flow of a connection can be written sequentially.
+ * 
+ * A coroutine waits for a socket by awaiting an AsyncOperation (accept a connection, read a frame, write a message).
+ * The operation first tries to complete without blocking. If the socket is not ready, the coroutine is suspended
+ * and the operation is registered with the scheduler, which adds its socket to the select() sets.
+ * When select() reports the socket ready, the scheduler makes one non-blocking attempt and resumes the coroutine once it succeeds.
+ * A suspended coroutine costs nothing, and one attempt per wakeup keeps a single client from holding the loop.
+ * An operation that stopped because it used up its share of a loop iteration, with work left, is runnable:
+ * it is attempted again at the next iteration whether or not its socket is reported ready, and the loop does not block meanwhile.
+ * An operation that must not make progress for now (e.g. a client that used up its input for the tick) is parked:
+ * its socket is left out of the select() sets and it is not attempted until it is no longer parked.
+ * 
+ * Coroutines are started with AsyncTask: they run until their first suspension and free themselves when they return.
+ * A coroutine whose socket is closed is destroyed with cancel().
+ * 
+ *********************************************************************************************************************************************/
+
+
+#include <coroutine>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+#define ASYNC_WAITER_LIMIT			64		// Max coroutines suspended at the same time
+#define ACCEPT_BACKOFF_MILLISEC		50		// How long accepting pauses after running out of file descriptors
+
+
+class AsyncScheduler;
+
+
+// Return type of a coroutine started by the game loop
+// The coroutine starts right away and frees itself when it returns
+struct AsyncTask
+{
+	struct promise_type
+	{
+		AsyncTask get_return_object() { return AsyncTask(); }
+		std::suspend_never initial_suspend() noexcept { return std::suspend_never(); }
+		std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+		void return_void() {}
+		void unhandled_exception() { abort(); }
+	};
+};
+
+
+// Base of the awaitable socket operations
+// Subclasses provide await_ready() (try without blocking), await_resume() (the result) and attempt()
+class AsyncOperation
+{
+	protected:
+		
+		AsyncScheduler* scheduler;
+		int sockfd;
+		bool forWrite;
+		
+	public:
+		
+		AsyncOperation(AsyncScheduler* scheduler, int sockfd, bool forWrite);
+		virtual ~AsyncOperation() {}
+		
+		// Make one non-blocking attempt once the socket is ready
+		// Return true when the operation is complete and the coroutine can be resumed
+		virtual bool attempt() = 0;
+		
+		// True if the operation can make progress without waiting for its socket
+		virtual bool isRunnable() { return false; }
+		
+		// True if the operation must not be attempted for now, even if its socket is ready
+		virtual bool isParked() { return false; }
+		
+		// Suspend the coroutine until the operation completes
+		void await_suspend(std::coroutine_handle<> handle);
+		
+		int getSocket() { return sockfd; }
+		bool isForWrite() { return forWrite; }
+};
+
+
+// Accept the next connection on a non-blocking listening socket
+// Result: the new socket (non-blocking), with the peer address in addr
+class AsyncAccept : public AsyncOperation
+{
+	private:
+		
+		struct sockaddr* addr;
+		socklen_t* addrlen;
+		socklen_t addrCapacity;
+		int result;
+		
+		// Set when the process or the system ran out of file descriptors
+		// The listening socket stays readable then, so accepting pauses until the time (CLOCK_MONOTONIC) instead of spinning
+		bool isBackingOff;
+		struct timespec retryTime;
+		
+	public:
+		
+		AsyncAccept(AsyncScheduler* scheduler, int sockfd, struct sockaddr* addr, socklen_t* addrlen);
+		
+		// Connections already in the backlog are accepted without suspending
+		bool await_ready() { return attempt(); }
+		int await_resume() { return result; }
+		
+		bool attempt();
+		
+		bool isParked();
+};
+
+
+class AsyncScheduler
+{
+	private:
+		
+		typedef struct
+		{
+			AsyncOperation* operation;
+			std::coroutine_handle<> handle;
+			uint32_t id;
+			
+		} Waiter;
+		
+		Waiter waiters[ASYNC_WAITER_LIMIT];
+		int numWaiters;
+		uint32_t nextID;
+		
+		// Index of the waiter with the id, or -1 if it has been removed
+		int findWaiter(uint32_t id);
+		
+		void removeWaiter(int index);
+		
+	public:
+		
+		AsyncScheduler();
+		
+		// Register a suspended coroutine waiting for the operation's socket
+		void wait(AsyncOperation* operation, std::coroutine_handle<> handle);
+		
+		// Destroy the coroutines waiting on the socket (it is being closed)
+		void cancel(int sockfd);
+		
+		// Add the sockets the coroutines wait for to the select() sets
+		// Return the highest socket added, or -1 if none
+		int addToSets(fd_set* readSet, fd_set* writeSet);
+		
+		// Attempt the runnable operations and those whose sockets select() reported ready, and resume the coroutines of those that completed
+		// Operations registered while this runs wait for the next call
+		void resumeReady(const fd_set* readSet, const fd_set* writeSet);
+		
+		// True if a suspended operation is runnable, select() must then not block
+		bool hasRunnable();
+		
+		// Number of suspended coroutines
+		int getNumWaiting();
+};
+
+#endif
@@ -0,0 +1,84 @@
+#include "BroadcastBufferPool.h"
+
+
+BroadcastBufferPool::BroadcastBufferPool()
+{
+	for (int i = 0; i < BROADCAST_POOL_SIZE; i++)
+	{
+		data[i] = NULL;
+		capacity[i] = 0;
+		refCount[i] = 0;
+	}
+	
+	numInUse = 0;
+}
+
+
+BroadcastBufferPool::~BroadcastBufferPool()
+{
+	for (int i = 0; i < BROADCAST_POOL_SIZE; i++)
+	{
+		free(data[i]);
+	}
+}
+
+
+int BroadcastBufferPool::acquire(uint32_t numBytes)
+{
+	int spare = -1;
+	
+	// Prefer a free buffer that is already large enough, so the steady state does not allocate
+	for (int i = 0; i < BROADCAST_POOL_SIZE; i++)
+	{
+		if (refCount[i] != 0) continue;
+		
+		if (capacity[i] >= numBytes)
+		{
+			refCount[i] = 1;
+			numInUse++;
+			return i;
+		}
+		
+		if (spare == -1) spare = i;
+	}
+	
+	if (spare == -1) return -1;
+	
+	// Grow the free buffer
+	uint8_t* grown = (uint8_t*)realloc(data[spare], numBytes);
+	
+	if (grown == NULL) return -1;
+	
+	data[spare] = grown;
+	capacity[spare] = numBytes;
+	refCount[spare] = 1;
+	numInUse++;
+	
+	return spare;
+}
+
+
+uint8_t* BroadcastBufferPool::getData(int buffer)
+{
+	return data[buffer];
+}
+
+
+void BroadcastBufferPool::addReference(int buffer)
+{
+	refCount[buffer]++;
+}
+
+
+void BroadcastBufferPool::release(int buffer)
+{
+	refCount[buffer]--;
+	
+	if (refCount[buffer] == 0) numInUse--;
+}
+
+
+int BroadcastBufferPool::getNumInUse()
+{
+	return numInUse;
+}
@@ -0,0 +1,56 @@
+#ifndef BROADCAST_BUFFER_POOL_H
+#define BROADCAST_BUFFER_POOL_H
+
+
+/********************************************************************************************************************************************
+ * 
+ * The broadcast buffer pool holds the frames that are sent to many players in the same tick (map updates and their variants).
+ * A buffer is built once and handed to every player's socket.
+ * With MSG_ZEROCOPY, the kernel keeps reading from the buffer after send() has returned,
+ * so each zerocopy send takes a reference and gives it back only when the socket reports that the send completed.
+ * A buffer returns to the pool once its last reference is released, and is then reused by a later tick.
+ * 
+ * Buffers keep their memory when they are released, so a steady state allocates nothing.
+ * 
+ *********************************************************************************************************************************************/
+
+
+#include <stdint.h>
+#include <stdlib.h>
+
+
+#define BROADCAST_POOL_SIZE			256		// Number of buffers in the pool (only the ones used are allocated)
+
+
+class BroadcastBufferPool
+{
+	private:
+		
+		uint8_t* data[BROADCAST_POOL_SIZE];
+		uint32_t capacity[BROADCAST_POOL_SIZE];
+		int refCount[BROADCAST_POOL_SIZE];
+		int numInUse;
+		
+	public:
+		
+		BroadcastBufferPool();
+		~BroadcastBufferPool();
+		
+		// Take a free buffer that holds at least numBytes, with a single reference
+		// Return the buffer index, or -1 if every buffer is in use or the memory cannot be allocated
+		int acquire(uint32_t numBytes);
+		
+		// Memory of a buffer returned by acquire
+		uint8_t* getData(int buffer);
+		
+		// Take another reference to the buffer
+		void addReference(int buffer);
+		
+		// Give back a reference, the buffer returns to the pool when the last one is released
+		void release(int buffer);
+		
+		// Number of buffers that are not in the pool
+		int getNumInUse();
+};
+
+#endif
@@ -0,0 +1,114 @@
+#include "BroadcastWorker.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+
+BroadcastWorker::BroadcastWorker()
+{
+	work = NULL;
+	context = NULL;
+	isStopping = false;
+	doneEvent = -1;
+}
+
+
+BroadcastWorker::~BroadcastWorker()
+{
+	if (doneEvent == -1) return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		isStopping = true;
+	}
+
+	wakeup.notify_all();
+
+	if (thread.joinable()) thread.join();
+
+	close(doneEvent);
+}
+
+
+int BroadcastWorker::start()
+{
+	doneEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (doneEvent == -1)
+	{
+		fprintf(stderr, "Error creating the broadcast worker's event: %s\n", strerror(errno));
+		return -1;
+	}
+
+	thread = std::thread(&BroadcastWorker::serve, this);
+
+	return 0;
+}
+
+
+bool BroadcastWorker::isEnabled()
+{
+	return doneEvent != -1;
+}
+
+
+int BroadcastWorker::getDoneEvent()
+{
+	return doneEvent;
+}
+
+
+void BroadcastWorker::submit(void (*work)(void*), void* context)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->work = work;
+		this->context = context;
+	}
+
+	wakeup.notify_all();
+}
+
+
+void BroadcastWorker::wait()
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		wakeup.wait(lock, [this] { return work == NULL; });
+	}
+
+	// The event was signalled before the job was marked done, so this read consumes it
+	uint64_t count;
+	ssize_t bytes = read(doneEvent, &count, sizeof(count));
+	(void)bytes;
+}
+
+
+void BroadcastWorker::serve()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true)
+	{
+		wakeup.wait(lock, [this] { return work != NULL || isStopping; });
+
+		if (isStopping) break;
+
+		// The job runs without the lock, the loop does not touch its data until it is done
+		lock.unlock();
+		work(context);
+
+		uint64_t one = 1;
+		ssize_t bytes = write(doneEvent, &one, sizeof(one));
+		(void)bytes;
+
+		lock.lock();
+		work = NULL;
+		context = NULL;
+		wakeup.notify_all();
+	}
+}
@@ -0,0 +1,65 @@
+#ifndef BROADCAST_WORKER_H
+#define BROADCAST_WORKER_H
+
+
+/********************************************************************************************************************************************
+ *
+ * The broadcast worker is a second thread that finishes a tick's map update while the game loop goes on with the next tick.
+ * The loop builds the map update from the world as it is at the tick, into buffers that nothing changes afterwards
+ * (the world keeps changing in the server, the buffers are a frozen copy), and submits the rest of the work:
+ * building the variants of the frame, compressing them and sending the datagrams.
+ * Meanwhile, the loop waits for sockets and reads and applies the input of the next tick.
+ *
+ * The worker takes one job at a time. When the job is done, it signals an eventfd that the loop waits on in select(),
+ * so the loop picks up the result (and sends it over TCP, which only the loop does) as soon as it is ready.
+ * wait() blocks until the job is done, for a loop that needs the result right away (the next tick's job).
+ *
+ *********************************************************************************************************************************************/
+
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+
+class BroadcastWorker
+{
+	private:
+
+		std::thread thread;
+		std::mutex mutex;
+		std::condition_variable wakeup;
+
+		// Job submitted and not done yet, NULL while the worker is idle
+		void (*work)(void*);
+		void* context;
+		bool isStopping;
+
+		// Signalled when a job is done, -1 until the worker is started
+		int doneEvent;
+
+		// Run the submitted jobs until the worker is stopped
+		void serve();
+
+	public:
+
+		BroadcastWorker();
+		~BroadcastWorker();
+
+		// Start the thread
+		// Return -1 if the thread or its event cannot be created
+		int start();
+
+		bool isEnabled();
+
+		// Eventfd that becomes readable when a job is done
+		int getDoneEvent();
+
+		// Run work(context) on the worker, which must be idle
+		void submit(void (*work)(void*), void* context);
+
+		// Block until the submitted job (if any) is done, and reset the done event
+		void wait();
+};
+
+#endif
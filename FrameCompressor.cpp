@@ -0,0 +1,279 @@
+#include "FrameCompressor.h"
+
+#include <string.h>
+
+
+// Read 4 bytes without alignment requirements
+static uint32_t read32(const uint8_t* bytes)
+{
+	uint32_t value;
+	memcpy(&value, bytes, sizeof(value));
+	return value;
+}
+
+
+// Write the part of a literal count or match length that does not fit in the token
+// Return false if the output is full
+static bool writeExtraLength(uint8_t* output, uint32_t outputCapacity, uint32_t* op, uint32_t length)
+{
+	while (length >= 255)
+	{
+		if (*op >= outputCapacity) return false;
+		output[(*op)++] = 255;
+		length -= 255;
+	}
+	
+	if (*op >= outputCapacity) return false;
+	output[(*op)++] = (uint8_t)length;
+	
+	return true;
+}
+
+
+// Read the part of a literal count or match length that does not fit in the token
+// Return false if the input ends first
+static bool readExtraLength(const uint8_t* input, uint32_t inputSize, uint32_t* ip, uint32_t* length)
+{
+	uint8_t byte;
+	
+	do
+	{
+		if (*ip >= inputSize) return false;
+		byte = input[(*ip)++];
+		*length += byte;
+	}
+	while (byte == 255);
+	
+	return true;
+}
+
+
+// Write a sequence of literals, followed by a match unless matchLength is 0
+// Return false if the output is full
+static bool writeSequence(uint8_t* output, uint32_t outputCapacity, uint32_t* op, const uint8_t* literals, uint32_t numLiterals, uint32_t offset, uint32_t matchLength)
+{
+	if (*op >= outputCapacity) return false;
+	
+	uint32_t tokenLiterals = (numLiterals < 15) ? numLiterals : 15;
+	uint32_t tokenMatch = 0;
+	
+	if (matchLength > 0)
+	{
+		tokenMatch = matchLength - LZ_MIN_MATCH;
+		if (tokenMatch > 15) tokenMatch = 15;
+	}
+	
+	output[(*op)++] = (uint8_t)((tokenLiterals << 4) | tokenMatch);
+	
+	if (numLiterals >= 15 && !writeExtraLength(output, outputCapacity, op, numLiterals - 15)) return false;
+	
+	if (numLiterals > outputCapacity - *op) return false;
+	memcpy(output + *op, literals, numLiterals);
+	*op += numLiterals;
+	
+	if (matchLength == 0) return true;
+	
+	if (*op + 2 > outputCapacity) return false;
+	output[(*op)++] = (uint8_t)(offset & 0xFF);
+	output[(*op)++] = (uint8_t)(offset >> 8);
+	
+	if (matchLength - LZ_MIN_MATCH >= 15 && !writeExtraLength(output, outputCapacity, op, matchLength - LZ_MIN_MATCH - 15)) return false;
+	
+	return true;
+}
+
+
+FrameCompressor::FrameCompressor()
+{
+	planeBuffer = NULL;
+	planeCapacity = 0;
+}
+
+
+FrameCompressor::~FrameCompressor()
+{
+	delete[] planeBuffer;
+}
+
+
+uint32_t FrameCompressor::compress(int codec, const uint8_t* input, uint32_t inputSize, uint8_t* output, uint32_t outputCapacity)
+{
+	if (codec == CODEC_LZ)
+	{
+		return lzCompress(input, inputSize, output, outputCapacity);
+	}
+	
+	if (codec == CODEC_LZ_BYTE_PLANES)
+	{
+		// The scratch buffer only grows, so it's allocated a handful of times at most
+		if (planeCapacity < inputSize)
+		{
+			delete[] planeBuffer;
+			planeBuffer = new uint8_t[inputSize];
+			planeCapacity = inputSize;
+		}
+		
+		splitBytePlanes(input, inputSize, BYTE_PLANE_STRIDE, planeBuffer);
+		
+		return lzCompress(planeBuffer, inputSize, output, outputCapacity);
+	}
+	
+	return 0;
+}
+
+
+int32_t FrameCompressor::decompress(int codec, const uint8_t* input, uint32_t inputSize, uint8_t* output, uint32_t outputCapacity)
+{
+	if (codec == CODEC_LZ)
+	{
+		return lzDecompress(input, inputSize, output, outputCapacity);
+	}
+	
+	if (codec == CODEC_LZ_BYTE_PLANES)
+	{
+		uint8_t* planes = new uint8_t[outputCapacity];
+		
+		int32_t size = lzDecompress(input, inputSize, planes, outputCapacity);
+		
+		if (size > 0)
+		{
+			joinBytePlanes(planes, size, BYTE_PLANE_STRIDE, output);
+		}
+		
+		delete[] planes;
+		
+		return size;
+	}
+	
+	return -1;
+}
+
+
+uint32_t FrameCompressor::lzCompress(const uint8_t* input, uint32_t inputSize, uint8_t* output, uint32_t outputCapacity)
+{
+	// Positions are stored plus one so that zero means "never seen"
+	memset(hashTable, 0, sizeof(hashTable));
+	
+	uint32_t ip = 0;
+	uint32_t anchor = 0;
+	uint32_t op = 0;
+	
+	while (ip + LZ_MIN_MATCH <= inputSize)
+	{
+		uint32_t sequence = read32(input + ip);
+		uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+		uint32_t candidate = hashTable[hash];
+		
+		hashTable[hash] = ip + 1;
+		
+		// If the same 4 bytes were not seen recently, move on
+		if (candidate == 0 || ip - (candidate - 1) > LZ_MAX_OFFSET || read32(input + candidate - 1) != sequence)
+		{
+			ip++;
+			continue;
+		}
+		
+		uint32_t ref = candidate - 1;
+		uint32_t matchLength = LZ_MIN_MATCH;
+		
+		// Extend the match as far as it goes
+		// It may overlap the bytes being encoded, the decoder copies byte by byte
+		while (ip + matchLength < inputSize && input[ref + matchLength] == input[ip + matchLength])
+		{
+			matchLength++;
+		}
+		
+		if (!writeSequence(output, outputCapacity, &op, input + anchor, ip - anchor, ip - ref, matchLength)) return 0;
+		
+		ip += matchLength;
+		anchor = ip;
+	}
+	
+	// The last sequence holds the remaining literals
+	if (!writeSequence(output, outputCapacity, &op, input + anchor, inputSize - anchor, 0, 0)) return 0;
+	
+	if (op >= inputSize) return 0;
+	
+	return op;
+}
+
+
+int32_t FrameCompressor::lzDecompress(const uint8_t* input, uint32_t inputSize, uint8_t* output, uint32_t outputCapacity)
+{
+	uint32_t ip = 0;
+	uint32_t op = 0;
+	
+	while (ip < inputSize)
+	{
+		uint8_t token = input[ip++];
+		
+		uint32_t numLiterals = token >> 4;
+		
+		if (numLiterals == 15 && !readExtraLength(input, inputSize, &ip, &numLiterals)) return -1;
+		
+		if (numLiterals > inputSize - ip || numLiterals > outputCapacity - op) return -1;
+		
+		memcpy(output + op, input + ip, numLiterals);
+		ip += numLiterals;
+		op += numLiterals;
+		
+		// The last sequence has no match
+		if (ip == inputSize) break;
+		
+		if (ip + 2 > inputSize) return -1;
+		
+		uint32_t offset = input[ip] | (input[ip + 1] << 8);
+		ip += 2;
+		
+		if (offset == 0 || offset > op) return -1;
+		
+		uint32_t matchLength = token & 0x0F;
+		
+		if (matchLength == 15 && !readExtraLength(input, inputSize, &ip, &matchLength)) return -1;
+		
+		matchLength += LZ_MIN_MATCH;
+		
+		if (matchLength > outputCapacity - op) return -1;
+		
+		// Byte by byte, since the match may overlap the bytes being written
+		for (uint32_t i = 0; i < matchLength; i++)
+		{
+			output[op] = output[op - offset];
+			op++;
+		}
+	}
+	
+	return op;
+}
+
+
+void FrameCompressor::splitBytePlanes(const uint8_t* input, uint32_t size, uint32_t stride, uint8_t* output)
+{
+	uint32_t numBlocks = size / stride;
+	
+	for (uint32_t k = 0; k < stride; k++)
+	{
+		for (uint32_t b = 0; b < numBlocks; b++)
+		{
+			output[k * numBlocks + b] = input[b * stride + k];
+		}
+	}
+	
+	memcpy(output + numBlocks * stride, input + numBlocks * stride, size - numBlocks * stride);
+}
+
+
+void FrameCompressor::joinBytePlanes(const uint8_t* input, uint32_t size, uint32_t stride, uint8_t* output)
+{
+	uint32_t numBlocks = size / stride;
+	
+	for (uint32_t k = 0; k < stride; k++)
+	{
+		for (uint32_t b = 0; b < numBlocks; b++)
+		{
+			output[b * stride + k] = input[k * numBlocks + b];
+		}
+	}
+	
+	memcpy(output + numBlocks * stride, input + numBlocks * stride, size - numBlocks * stride);
+}
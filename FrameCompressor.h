@@ -0,0 +1,80 @@
+#ifndef FRAME_COMPRESSOR_H
+#define FRAME_COMPRESSOR_H
+
+
+/********************************************************************************************************************************************
+ * 
+ * A small LZ77 codec for large frames (map updates with many robots).
+ * It needs no external library and is fast enough to run once per tick.
+ * 
+ * The compressed data is a list of sequences, each made of:
+ * 
+ * token 				|	1 byte: literal count in the high 4 bits, match length - 4 in the low 4 bits
+ * extra literal count 	|	only if the literal count is 15: bytes of 255 ended by a byte below 255, all added to the count
+ * literals 			|	bytes copied as is
+ * match offset 		|	2 bytes (low byte first), distance back to the start of the match
+ * extra match length 	|	only if the match length - 4 is 15: same encoding as the extra literal count
+ * 
+ * The last sequence only has literals and ends the data.
+ * 
+ * Map update records are 16 bytes of ID and coordinates. Neighbouring records are similar, but not byte for byte.
+ * The byte-plane transform groups byte 0 of every 16-byte block, then byte 1, and so on.
+ * Blocks do not need to line up with records: only the 16-byte period matters.
+ * The slowly changing high bytes then form long runs that LZ77 compresses well.
+ * 
+ *********************************************************************************************************************************************/
+
+
+#include <stdint.h>
+
+
+// Codecs
+#define CODEC_LZ					1	// LZ77 on the frame as is
+#define CODEC_LZ_BYTE_PLANES		2	// Byte-plane transform with a 16-byte stride, then LZ77
+
+#define LZ_HASH_BITS				12
+#define LZ_MIN_MATCH				4
+#define LZ_MAX_OFFSET				65535
+#define BYTE_PLANE_STRIDE			16	// Bytes per map update record
+
+
+class FrameCompressor
+{
+	private:
+		
+		// Last position at which each 4-byte hash was seen
+		uint32_t hashTable[1 << LZ_HASH_BITS];
+		
+		// Scratch space for the byte-plane transform
+		uint8_t* planeBuffer;
+		uint32_t planeCapacity;
+		
+	public:
+		
+		FrameCompressor();
+		
+		~FrameCompressor();
+		
+		// Compress input into output with the specified codec
+		// Return the compressed size, or 0 if it would not be smaller than the input
+		uint32_t compress(int codec, const uint8_t* input, uint32_t inputSize, uint8_t* output, uint32_t outputCapacity);
+		
+		// Decompress input into output with the specified codec
+		// Return the decompressed size, or -1 if the input is malformed or does not fit
+		static int32_t decompress(int codec, const uint8_t* input, uint32_t inputSize, uint8_t* output, uint32_t outputCapacity);
+		
+		// Plain LZ77 compression, return 0 if the output would not be smaller than the input
+		uint32_t lzCompress(const uint8_t* input, uint32_t inputSize, uint8_t* output, uint32_t outputCapacity);
+		
+		// Plain LZ77 decompression, return -1 if the input is malformed or does not fit
+		static int32_t lzDecompress(const uint8_t* input, uint32_t inputSize, uint8_t* output, uint32_t outputCapacity);
+		
+		// Group byte k of every record of the specified stride together, for k = 0 to stride - 1
+		// Trailing bytes that do not fill a whole record are copied as is
+		static void splitBytePlanes(const uint8_t* input, uint32_t size, uint32_t stride, uint8_t* output);
+		
+		// Undo splitBytePlanes
+		static void joinBytePlanes(const uint8_t* input, uint32_t size, uint32_t stride, uint8_t* output);
+};
+
+#endif
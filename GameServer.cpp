@@ -1,7 +1,16 @@
 #include "GameServer.h"
 
 
-addrinfo* GameServer::getTCPServerAddrInfo(const char* portNum)
+// Set by SIGUSR1, the loop dumps the tick trace when it sees it
+static volatile sig_atomic_t isTraceRequested = 0;
+
+static void requestTrace(int signum)
+{
+	isTraceRequested = 1;
+}
+
+
+addrinfo* GameServer::getServerAddrInfo(const char* portNum, int socktype)
 {
 	// Written based on "socket-tutorial" by GauthierDickey
 	
@@ -9,7 +18,7 @@ addrinfo* GameServer::getTCPServerAddrInfo(const char* portNum)
 	struct addrinfo hints;
 	memset(&hints, 0, sizeof(hints));
 	hints.ai_family = AF_UNSPEC;
-	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_socktype = socktype;
 	hints.ai_flags = AI_PASSIVE;
 	hints.ai_protocol = 0;
 	
@@ -47,6 +56,13 @@ int GameServer::createSocketFD(struct addrinfo* hostAddr)
 			continue;
 		}
 		
+		// Allow a restarted server to bind while connections of the previous run are in TIME_WAIT
+		if (p->ai_socktype == SOCK_STREAM)
+		{
+			int flag = 1;
+			setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+		}
+		
 		if (bind(sockfd, p->ai_addr, p->ai_addrlen) == -1)
 		{
 			perror("Unable to bind socket ");
@@ -109,7 +125,7 @@ int GameServer::setSocketListen(int sockfd, int backlog)
 
 TCPHost* GameServer::createTCPServer(const char* portNum, int backlog)
 {
-	struct addrinfo* serverAddr = getTCPServerAddrInfo(portNum);
+	struct addrinfo* serverAddr = getServerAddrInfo(portNum, SOCK_STREAM);
 	
 	if (serverAddr == NULL) return NULL;
 	
@@ -147,9 +163,77 @@ TCPHost* GameServer::createTCPServer(const char* portNum, int backlog)
 }
 
 
-GameServer::GameServer(const char* portNum)
+int GameServer::createUDPServer(const char* portNum)
+{
+	struct addrinfo* serverAddr = getServerAddrInfo(portNum, SOCK_DGRAM);
+	
+	if (serverAddr == NULL) return -1;
+	
+	int sockfd = createSocketFD(serverAddr);
+	
+	freeaddrinfo(serverAddr);
+	
+	if (sockfd == -1) return -1;
+	
+	if (setSocketNonBlocking(sockfd) == -1)
+	{
+		close(sockfd);
+		return -1;
+	}
+	
+	return sockfd;
+}
+
+
+int GameServer::createLocalServer(const char* path, int backlog)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "Local socket path %s is too long\n", path);
+		return -1;
+	}
+	
+	strcpy(addr.sun_path, path);
+	
+	int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	
+	if (sockfd == -1)
+	{
+		fprintf(stderr, "Error creating local socket: %s\n", strerror(errno));
+		return -1;
+	}
+	
+	// A socket file left behind by a previous run would make bind() fail
+	unlink(path);
+	
+	if (bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+	{
+		fprintf(stderr, "Error binding local socket to %s: %s\n", path, strerror(errno));
+		close(sockfd);
+		return -1;
+	}
+	
+	if (setSocketListen(sockfd, backlog) == -1)
+	{
+		close(sockfd);
+		unlink(path);
+		return -1;
+	}
+	
+	return sockfd;
+}
+
+
+GameServer::GameServer(const ServerConfig& config) : proximity(EXPLOSION_RADIUS, PROXIMITY_SKIN), overload(config.minTickMillisec, config.maxTickMillisec)
 {
-	server = createTCPServer(portNum, 5);
+	this->config = config;
+	const char* portNum = config.portNum;
+	
+	server = createTCPServer(portNum, config.backlog);
 	
 	if (server == NULL)
 	{
@@ -161,8 +245,98 @@ GameServer::GameServer(const char* portNum)
 	// It is also the maximum socket fd
 	maxfd = server->sockfd;
 	
-	numActiveSockets = 0;
-	numAlivePlayers = 0;
+	// The UDP channel uses the same port number as the TCP server
+	// The server still works without it, map updates are then sent over TCP only
+	udpSockfd = createUDPServer(portNum);
+	
+	if (udpSockfd == -1)
+	{
+		fprintf(stderr, "UDP channel not available, map updates will use TCP only\n");
+	}
+	else
+	{
+		maxfd = (udpSockfd > maxfd) ? udpSockfd : maxfd;
+	}
+	
+	// Clients on the same host can also connect to the local socket
+	localSockfd = -1;
+	
+	if (config.localPath != NULL)
+	{
+		localSockfd = createLocalServer(config.localPath, config.backlog);
+		
+		if (localSockfd == -1)
+		{
+			fprintf(stderr, "ERROR: local socket not created\n");
+			exit(EXIT_FAILURE);
+		}
+		
+		maxfd = (localSockfd > maxfd) ? localSockfd : maxfd;
+		
+		fprintf(stdout, "Local clients can connect to %s\n", config.localPath);
+	}
+	
+	// Tools read the world snapshots from the admin socket, on a thread of their own
+	if (config.adminPath != NULL)
+	{
+		if (adminSocket.start(config.adminPath, &worldSnapshot) == -1)
+		{
+			fprintf(stderr, "ERROR: admin socket not created\n");
+			exit(EXIT_FAILURE);
+		}
+		
+		fprintf(stdout, "World snapshots are served at %s\n", config.adminPath);
+	}
+	
+	numParkedSockets = 0;
+	
+	// Map updates are finished on the broadcast worker while the loop goes on with the next tick
+	isMapUpdatePending = false;
+	
+	if (config.pipelineMapUpdates)
+	{
+		if (broadcastWorker.start() == -1)
+		{
+			fprintf(stderr, "ERROR: broadcast worker not started\n");
+			exit(EXIT_FAILURE);
+		}
+		
+		maxfd = (broadcastWorker.getDoneEvent() > maxfd) ? broadcastWorker.getDoneEvent() : maxfd;
+		
+		fprintf(stdout, "Map updates are pipelined on the broadcast worker\n");
+	}
+	
+	numMapRecords = 0;
+	tickNumber = 0;
+	nextJoinSerial = 0;
+	numGhostNodes = 0;
+	
+	for (int i = 0; i < CLUSTER_REGION_LIMIT; i++)
+	{
+		boundaries[i].numRobots = 0;
+		boundaries[i].freeSlots = 0;
+	}
+	
+	// In cluster mode, this server only owns its region of the map
+	if (config.regionCount > 1)
+	{
+		if (cluster.start(config.clusterDirectory, config.regionIndex, config.regionCount) == -1)
+		{
+			fprintf(stderr, "ERROR: cluster region %d not created\n", config.regionIndex);
+			exit(EXIT_FAILURE);
+		}
+		
+		fprintf(stdout, "Game server owns region %d of %d (x from %.3f to %.3f)\n", config.regionIndex, config.regionCount, (double)config.regionIndex / config.regionCount, (double)(config.regionIndex + 1) / config.regionCount);
+	}
+	
+	// Mark every history slot as empty (tick 0 is never recorded)
+	memset(positionHistory, 0, sizeof(positionHistory));
+
+	keyframeCountdown = 0;
+	isMapShrunk = false;
+	lastMapUpdateTick = 0;
+	numTraceDumps = 0;
+	lastTraceDump = 0;
 
 	timeout.tv_sec = 0;
 	timeout.tv_usec = 500;
@@ -171,7 +345,13 @@ GameServer::GameServer(const char* portNum)
 	// Initialize the players' sockets to zero (empty)
 	for (int i = 0; i < PLAYER_LIMIT; i++)
 	{
-		players[0].sockfd = 0;
+		players[i].sockfd = 0;
+		players[i].isClosing = false;
+		players[i].recvBuffer = NULL;
+		players[i].sendBuffer = NULL;
+		players[i].recvLength = 0;
+		players[i].recvOffset = 0;
+		players[i].sendLength = 0;
 	}
 	
 	fprintf(stdout, "Game server created at port %s\n", portNum);
@@ -180,18 +360,37 @@ GameServer::GameServer(const char* portNum)
 
 GameServer::~GameServer()
 {
+	// A map update still being finished uses the UDP socket and the broadcast buffers
+	if (isMapUpdatePending)
+	{
+		broadcastWorker.wait();
+	}
+	
 	if (server != NULL)
 	{
 		close(server->sockfd);
 		delete server;
 	} 
 	
-	for (int32_t i = 0; i < PLAYER_LIMIT; i++)
+	if (udpSockfd != -1)
 	{
-		if (players[i].sockfd != 0)
-		{
-			shutdown(players[i].sockfd, SHUT_RDWR);
-		}
+		close(udpSockfd);
+	}
+	
+	if (localSockfd != -1)
+	{
+		close(localSockfd);
+		unlink(config.localPath);
+	}
+	
+	for (int32_t i = activePlayers.first(); i != -1; i = activePlayers.next(i))
+	{
+		shutdown(players[i].sockfd, SHUT_RDWR);
+	}
+	
+	for (int k = 0; k < numParkedSockets; k++)
+	{
+		close(parkedSockets[k].sockfd);
 	}
 }
 
@@ -200,7 +399,31 @@ void GameServer::run()
 {
 	fprintf(stdout, "Game server started\n");
 	
-	double start = clock();
+	if (config.lowLatency)
+	{
+		setupLowLatencyMode();
+	}
+	
+	// "kill -USR1 <pid>" dumps the tick trace
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = requestTrace;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGUSR1, &action, NULL);
+	
+	// Start accepting players, the coroutines suspend until the first connection arrives
+	acceptPlayers(server->sockfd, false);
+	
+	if (localSockfd != -1)
+	{
+		acceptPlayers(localSockfd, true);
+	}
+	
+	// Time at which the next tick is due
+	double nextTick = getMonotonicMillisec() + overload.getTickInterval();
+	
+	// Time spent working (not waiting in select) since the last tick
+	double busyMillisec = 0;
 	
 	while (true)
 	{
@@ -212,65 +435,98 @@ void GameServer::run()
 		
 		// Add all active sockets (server and active players) to the master set
 		FD_SET(server->sockfd, &masterSet);
-		for (int32_t i = 0; i < PLAYER_LIMIT; i++)
+		if (udpSockfd != -1)
 		{
-			// If a player is active
-			if (players[i].sockfd != 0)
-			{
-				FD_SET(players[i].sockfd, &masterSet);
-			}
+			FD_SET(udpSockfd, &masterSet);
+		}
+		for (int32_t i = activePlayers.first(); i != -1; i = activePlayers.next(i))
+		{
+			FD_SET(players[i].sockfd, &masterSet);
 		}
 		
 		// Copy the master set to other fd sets
-		readSet = masterSet;
-		writeSet = masterSet;
+		// Only sockets with pending output are waited on for writing
+		// The server and player sockets are waited on for reading when their coroutines wait for them
 		exceptSet = masterSet;
 		
-		// Use select to wait for socket activity
-		int res = select(maxfd + 1, &readSet, &writeSet, &exceptSet, &timeout);
-		
-		// If there's an error
-		if (res == -1)
+		FD_ZERO(&readSet);
+		if (udpSockfd != -1)
 		{
-			fprintf(stderr, "Error waiting for socket activity: %s\n", strerror(errno));
-			continue;
+			FD_SET(udpSockfd, &readSet);
 		}
 		
-		// If a client attempts to connect
-		if (FD_ISSET(server->sockfd, &readSet))
+		FD_ZERO(&writeSet);
+		for (int32_t i = writingPlayers.first(); i != -1; i = writingPlayers.next(i))
 		{
-			int id = acceptNewPlayer();
-			
-			// if there's an error accepting the player, retry 3 times
-			int count = 3;
-			while (id == -1 && count > 0)
+			// A channel has room again when the client signals the server's event
+			if (players[i].hasChannel)
 			{
-				id = acceptNewPlayer();
-				count--;
+				FD_SET(channels[i].getServerEvent(), &readSet);
 			}
-
-			// If the player has been accepted
-			if (id >= 0)
+			else
 			{
-				numAlivePlayers++;
-				numActiveSockets++;
-				
-				int res = sendJoinResponse(id);
-				
-				// If there's an error sending join response, retry 3 times
-				count = 3;
-				while (res == -1 && count > 0)
-				{
-					res = sendJoinResponse(id);
-					count--;
-				}
-				
-				// For a real project, there should be more sophisticated error-handling
-				// if the join response does not go through, or if there's problem
-				// establish the connection between server and client
-				// of if the socket's not ready to be written to
+				FD_SET(players[i].sockfd, &writeSet);
 			}
-		}	
+		}
+		
+		// The socket of a channel is only read to notice that the client closed it
+		for (int32_t i = activePlayers.first(); i != -1; i = activePlayers.next(i))
+		{
+			if (players[i].hasChannel) FD_SET(players[i].sockfd, &readSet);
+		}
+		
+		scheduler.addToSets(&readSet, &writeSet);
+		
+		// The broadcast worker signals when the map update it was given is ready to be sent over TCP
+		if (isMapUpdatePending)
+		{
+			FD_SET(broadcastWorker.getDoneEvent(), &readSet);
+		}
+		
+		// The links to the other regions of the cluster
+		int highestfd = maxfd;
+		if (cluster.isEnabled())
+		{
+			int clusterfd = cluster.addToSet(&readSet);
+			if (clusterfd > highestfd) highestfd = clusterfd;
+		}
+		
+		// Wait for socket activity, but no longer than until the next tick is due
+		// In low-latency mode, the last moments before the tick are spent polling, so the tick does not wait for a wakeup
+		double waitMillisec = nextTick - getMonotonicMillisec();
+		if (config.lowLatency) waitMillisec -= SPIN_WAIT_MILLISEC;
+		if (waitMillisec < 0) waitMillisec = 0;
+		
+		// Players that used up their read budget with data left are served again right away, after everyone else had a turn
+		if (scheduler.hasRunnable()) waitMillisec = 0;
+		
+		timeout.tv_sec = (time_t)(waitMillisec / 1000);
+		timeout.tv_usec = (suseconds_t)((waitMillisec - timeout.tv_sec * 1000) * 1000);
+		
+		// Use select to wait for socket activity
+		uint64_t selectStart = TickTracer::now();
+		int res = select(highestfd + 1, &readSet, &writeSet, &exceptSet, &timeout);
+		uint64_t phaseStart = TickTracer::now();
+		tracer.record("select", selectStart, phaseStart);
+		
+		// Dump a requested trace before the work of this iteration is timed
+		// Writing the file is not tick work, and must not make the overload controller shed load
+		if (isTraceRequested)
+		{
+			isTraceRequested = 0;
+			dumpTrace("requested");
+		}
+		
+		double busyStart = getMonotonicMillisec();
+		
+		// If there's an error
+		// (a signal such as the trace request interrupts select, which is not an error)
+		if (res == -1)
+		{
+			if (errno != EINTR) fprintf(stderr, "Error waiting for socket activity: %s\n", strerror(errno));
+			continue;
+		}
+		
 		if (FD_ISSET(server->sockfd, &writeSet))
 		{
 			// No game logic for now
@@ -282,25 +538,66 @@ void GameServer::run()
 			// No error handling for now
 		}
 		
-		// Check for socket activities in each player sockets
-		for (int32_t i = 0; i < PLAYER_LIMIT; i++)
+		// If datagrams arrived on the UDP channel
+		if (udpSockfd != -1 && FD_ISSET(udpSockfd, &readSet))
 		{
-			// Do nothing if the player socket is inactive
-			if (players[i].sockfd == 0) continue;
+			processUDPMessages();
+		}
+		
+		// Messages from the other regions of the cluster
+		if (cluster.isEnabled())
+		{
+			cluster.acceptPeers(&readSet);
 			
-			// If a message is received from a player
-			if (FD_ISSET(players[i].sockfd, &readSet))
+			for (int region = 0; region < cluster.getRegionCount(); region++)
 			{
-				int code = processPlayerMessage(i);
+				int linkfd = cluster.getLinkSocket(region);
 				
-				if (code == -1)
+				if (linkfd != -1 && FD_ISSET(linkfd, &readSet))
 				{
-					fprintf(stderr, "Error processing message from player %d\n", i);
-				}	
-			}	
+					processRegionMessages(region);
+				}
+			}
+		}
+		
+		// Send the map update that the broadcast worker finished
+		if (isMapUpdatePending && FD_ISSET(broadcastWorker.getDoneEvent(), &readSet))
+		{
+			collectMapUpdate();
+		}
+		
+		// Check for socket activities in each player sockets
+		phaseStart = TickTracer::now();
+		
+		for (int32_t i = activePlayers.first(); i != -1; i = activePlayers.next(i))
+		{
+			// The client of a channel wrote frames, read the server's, or closed the socket
+			// The event is reset before the coroutine waiting on it is resumed, so anything the client does after is signalled again
+			if (players[i].hasChannel)
+			{
+				if (FD_ISSET(channels[i].getServerEvent(), &readSet))
+				{
+					channels[i].clearEvent();
+					
+					if (players[i].sendLength > 0) flushPlayerOutput(i);
+				}
+				if (FD_ISSET(players[i].sockfd, &readSet))
+				{
+					checkChannelSocket(i);
+				}
+				continue;
+			}
+			
+			// Completions of zerocopy sends arrive on the error queue, which also makes the socket readable and writable
+			if (players[i].zeroCopyPending > 0 && (FD_ISSET(players[i].sockfd, &readSet) || FD_ISSET(players[i].sockfd, &writeSet)))
+			{
+				processZeroCopyCompletions(i);
+			}
+			
+			// If the socket can take more of the pending output
 			if (FD_ISSET(players[i].sockfd, &writeSet))
 			{
-				// No game logic for now
+				flushPlayerOutput(i);
 			}
 			if (FD_ISSET(players[i].sockfd, &exceptSet))
 			{
@@ -309,667 +606,3229 @@ void GameServer::run()
 			}		
 		}
 		
-		float millisec = ((clock() - start)/(double)CLOCKS_PER_SEC) * 1000;
+		tracer.record("player output", phaseStart, TickTracer::now());
+		
+		// Resume the coroutines whose sockets are ready
+		// This accepts new players and processes the frames received from players
+		phaseStart = TickTracer::now();
+		scheduler.resumeReady(&readSet, &writeSet);
+		tracer.record("coroutines", phaseStart, TickTracer::now());
+		
+		// Close the connections that failed during this iteration
+		// This is done here so no player slot is freed while it's being processed
+		for (int32_t i = activePlayers.first(); i != -1; i = activePlayers.next(i))
+		{
+			if (players[i].isClosing)
+			{
+				if (isVerboseLogging()) fprintf(stdout, "Player %d disconnected\n", i);
+				
+				removePlayer(i);
+			}
+		}
+		
+		double now = getMonotonicMillisec();
 			
-		// If it's time to send map update and there are players still alive in map
-		if (millisec >= MAP_UPDATE_MILLISEC && numAlivePlayers > 0)
+		// If it's time for the next tick
+		if (now >= nextTick)
 		{
-			//fprintf(stdout, "Update map\n");
-			broadcastMapUpdate();
+			uint64_t tickStart = TickTracer::now();
+			
+			// The map update of the previous tick goes out before anything of this tick
+			if (isMapUpdatePending)
+			{
+				collectMapUpdate();
+			}
+			
+			// Resolve the annihilations received since the last tick, against the world the players saw
+			resolveAnnihilations();
+			
+			tickNumber++;
+			
+			// Measure how late the tick starts
+			if (jitter.recordTickStart(now - nextTick))
+			{
+				fprintf(stdout, "Tick start jitter over %d ticks: p50 %.3f ms, p99 %.3f ms, p999 %.3f ms, max %.3f ms\n", JITTER_WINDOW_TICKS, jitter.getP50(), jitter.getP99(), jitter.getP999(), jitter.getMax());
+			}
+			
+			// Apply the moves received since the last tick
+			applyPendingMoves();
+			
+			// Robots that moved out of this region go to the region that owns their new position
+			if (cluster.isEnabled())
+			{
+				cluster.connectPeers();
+				handOffPlayers();
+			}
+			
+			// Remember the world as it is sent in this tick, for lag compensation
+			recordPositionHistory();
+			
+			if (tickNumber % HEALTH_CHECK_TICKS == 0)
+			{
+				updatePlayerRateLevels();
+			}
+			
+			// Close the connections of removed players once the kernel is done with their zerocopy sends
+			if (numParkedSockets > 0)
+			{
+				processParkedSockets();
+			}
+			
+			// Tell the neighbouring regions which robots are close enough to their border to take part in their explosions
+			if (cluster.isEnabled())
+			{
+				sendBoundaryRobots();
+			}
+			
+			// Send map update if there are players still alive in map (or robots of neighbouring regions near the border)
+			if (!alivePlayers.isEmpty() || countBoundaryRobots() > 0)
+			{
+				//fprintf(stdout, "Update map\n");
+				broadcastMapUpdate();
+				
+				// broadcastMapUpdate returns the number of messages sent to players
+				// If the number of messages is less than the number of active players
+				// more sophisticated error handling will be needed to handle this error
+			}
+			
+			publishWorldSnapshot();
 				
-			// Reset the timing to send map udate
-			start = clock();
+			tracer.record("tick", tickStart, TickTracer::now());
+			
+			double tickEnd = getMonotonicMillisec();
+			busyMillisec += tickEnd - busyStart;
+			
+			// Keep the trace of a tick that ran over budget, but do not let the dumps themselves slow the server down
+			if (config.traceBudgetMillisec > 0 && busyMillisec > config.traceBudgetMillisec && (numTraceDumps == 0 || tickEnd - lastTraceDump >= TRACE_DUMP_INTERVAL_MILLISEC))
+			{
+				char reason[64];
+				snprintf(reason, sizeof(reason), "tick %u took %.2f ms", tickNumber, busyMillisec);
+				dumpTrace(reason);
 				
-			// broadcastMapUpdate returns the number of messages sent to players
-			// If the number of messages is less than the number of active players
-			// more sophisticated error handling will be needed to handle this error
+				lastTraceDump = getMonotonicMillisec();
+			}
+			
+			// Let the overload controller adjust the tick rate and shed level to the measured cost
+			if (overload.recordTick(busyMillisec))
+			{
+				fprintf(stdout, "Load %.2f: tick interval %.1f ms, shed level %d\n", overload.getLoad(), overload.getTickInterval(), overload.getShedLevel());
+			}
+			
+			busyMillisec = 0;
+			
+			// Schedule the next tick
+			// If the server is already late for it, skip the missed ticks instead of running them back to back
+			nextTick += overload.getTickInterval();
+			if (nextTick < tickEnd) nextTick = tickEnd + overload.getTickInterval();
+		}
+		else
+		{
+			busyMillisec += now - busyStart;
 		}
 	}
 }
 
 
-/*
- * Game server utility functions 
- */
- 
-int GameServer::sendJoinResponse(int32_t playerID)
+double GameServer::getMonotonicMillisec()
 {
-	int32_t convertedID = htonl(playerID);
-	
-	uint32_t numBytes = 10;
-	uint32_t convertedBytes = htonl(numBytes);
-	
-	// Load the message into the buffer
-	players[playerID].sendBuffer[0] = GET_BYTE_3(convertedBytes);
-	players[playerID].sendBuffer[1] = GET_BYTE_2(convertedBytes);
-	players[playerID].sendBuffer[2] = GET_BYTE_1(convertedBytes);
-	players[playerID].sendBuffer[3] = GET_BYTE_0(convertedBytes);
-	players[playerID].sendBuffer[4] = VERSION_NUM; 				// first byte: version num
-	players[playerID].sendBuffer[5] = PLAYER_JOIN_RESPONSE; 	// second byte: message code
-	players[playerID].sendBuffer[6] = GET_BYTE_3(convertedID); 	// third byte: byte 3 of ID
-	players[playerID].sendBuffer[7] = GET_BYTE_2(convertedID); 	// 4th byte: byte 2 of ID
-	players[playerID].sendBuffer[8] = GET_BYTE_1(convertedID); 	// 5th byte: byte 1 of ID
-	players[playerID].sendBuffer[9] = GET_BYTE_0(convertedID);	// 6th byte: byte 0  of ID
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 	
-	ssize_t bytes = -1;
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
 
-	bytes = send(players[playerID].sockfd, players[playerID].sendBuffer, (int)numBytes, 0);
+
+bool GameServer::isVerboseLogging()
+{
+	return overload.getShedLevel() < SHED_LOGGING;
+}
+
+
+void GameServer::dumpTrace(const char* reason)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "tick-trace-%d-%d.json", (int)getpid(), numTraceDumps);
+	numTraceDumps++;
 	
-	if (bytes == -1)
+	int numEvents = tracer.dump(path);
+	
+	if (numEvents != -1)
 	{
-		fprintf(stderr, "Error sending join response: %s\n", strerror(errno));
-		return -1;
-	}
-	if (bytes < numBytes)
-	{
-		fprintf(stderr, "Wrong number of bytes sent in join response: %ld bytes\n", bytes);
-		return -1;
-	}
-	
-	return 0;
-}
- 
- 
-int32_t GameServer::acceptNewPlayer()
-{
-	int32_t i;
-				
-	// Find the first available player slot
-	for (i = 0; i < PLAYER_LIMIT; i++)
-	{
-		// If the player slot is available
-		if (players[i].sockfd == 0)
-		{
-			break;
-		}
-	}		
-	
-	// If no available slot is found
-	if (players[i].sockfd != 0)
-	{
-		fprintf(stdout, "No available player slot. Cannot accept new player.\n");
-		return -2;
-	}
-				
-	// Complete the TCP connection
-	int sockfd = accept(server->sockfd, &players[i].addr, &players[i].addrlen);
-						
-	if (sockfd == -1)
-	{
-		fprintf(stderr, "Failed to accept new player: %s\n", strerror(errno));
-		return -1;
+		fprintf(stdout, "Tick trace (%s): %d events written to %s\n", reason, numEvents, path);
 	}
-	else
-	{			
-		fprintf(stdout, "New player with ID %d created\n", i);
-		// Initialize the player
-		players[i].sockfd = sockfd;
-		players[i].score = 0;	
-		players[i].isAlive = false;	
-
-		// Update the max file descriptor
-		maxfd = (sockfd > maxfd) ? sockfd : maxfd;	
-	}
-	
-	return i;
 }
 
 
-int GameServer::processPlayerMessage(int32_t playerID)
+void GameServer::setupLowLatencyMode()
 {
-	ssize_t bytes = recv(players[playerID].sockfd, players[playerID].recvBuffer, BUFFER_SIZE, 0); 
+	// Keep the loop thread on one core, so its cache stays warm and it is never migrated
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(config.cpuCore, &cpus);
 	
-	if (bytes == -1)
+	if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1)
 	{
-		fprintf(stderr, "Error receiving player message: %s\n", strerror(errno));
-		return -1;
+		fprintf(stderr, "Failed to pin the game loop to core %d: %s\n", config.cpuCore, strerror(errno));
 	}
-	if (bytes == 0)
+	else
 	{
-		return 0;
+		fprintf(stdout, "Game loop pinned to core %d\n", config.cpuCore);
 	}
 	
-	// Read the number of bytes in the packet
-	uint32_t rawBytes = 0;
-	rawBytes |= ((uint32_t)players[playerID].recvBuffer[0]) << 24;
-	rawBytes |= ((uint32_t)players[playerID].recvBuffer[1]) << 16;
-	rawBytes |= ((uint32_t)players[playerID].recvBuffer[2]) << 8;
-	rawBytes |= ((uint32_t)players[playerID].recvBuffer[3]);
-	
-	uint32_t numBytes = ntohl(rawBytes);
-	
-	// If the number of bytes actually received is less than the expected number of bytes
-	if (bytes < numBytes)
+	// A real-time priority keeps other processes from delaying a tick
+	// The core should be kept free of other work, since the loop preempts everything else on it
+	if (config.fifoPriority > 0)
 	{
-		fprintf(stderr, "Number of bytes received from server is less than expected. Received %ld bytes, expected %u bytes\n", bytes, numBytes);
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = config.fifoPriority;
 		
-		for (int i = 0; i < bytes; i++)
+		if (sched_setscheduler(0, SCHED_FIFO, &param) == -1)
 		{
-			fprintf(stdout, "byte %d: %d\n", i, server->recvBuffer[i]);
+			fprintf(stderr, "Failed to set SCHED_FIFO priority %d: %s\n", config.fifoPriority, strerror(errno));
 		}
-		
-		return -1;
 	}
-	// Check the version number
-	if (players[playerID].recvBuffer[4] != VERSION_NUM)
+	
+	// Lock every page of the process, the server state and the heap alike, so no tick takes a page fault or waits for swap
+	// MCL_FUTURE also covers what is allocated later, such as the buffers the broadcast and I/O pools allocate on first use,
+	// which are faulted in when they are allocated instead of when a tick first writes them
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
 	{
-		fprintf(stderr, "Wrong version number in player message\n");
-		return -1;
+		fprintf(stderr, "Failed to lock the server in memory (see RLIMIT_MEMLOCK): %s\n", strerror(errno));
 	}
+}
+
+
+/*
+ * Game server utility functions 
+ */
+ 
+int GameServer::writeJoinResponse(uint8_t* message, int32_t playerID)
+{
+	int32_t convertedID = htonl(playerID);
 	
-	int res = 0;
+	uint32_t numBytes = 10;
+	uint32_t convertedBytes = htonl(numBytes);
 	
-	// Check the message code
-	switch(players[playerID].recvBuffer[5])
-	{
-		case PLAYER_MOVE:
-		{
-			// 18 bytes are expected for player move message
-			if (numBytes != 18)
-			{
-				fprintf(stderr, "Wrong number of bytes received in player move message: %u\n", numBytes);
-				for (int i = 0; i < (int)numBytes; i++)
-				{
-					fprintf(stdout, "Byte %d: %d\n", i, server->recvBuffer[i]);
-				}
-				res = -1;
-			}
-			else
-			{
-				uint32_t temp = 0;
-				
-				// Read the player's x coordinate
-				temp |= players[playerID].recvBuffer[6] << 24; 	// byte 3 of x value
-				temp |= players[playerID].recvBuffer[7] << 16; 	// byte 2 of x value
-				temp |= players[playerID].recvBuffer[8] << 8; 	// byte 1 of x value
-				temp |= players[playerID].recvBuffer[9]; 		// byte 0 of x value
-				uint32_t binaryX = ntohl(temp);
-				memcpy(&players[playerID].x, &binaryX, sizeof(float));
-				
-				temp = 0;
-				
-				// Read the player's y coordinate
-				temp |= players[playerID].recvBuffer[10] << 24; 	// byte 3 of y value
-				temp |= players[playerID].recvBuffer[11] << 16; 	// byte 2 of y value
-				temp |= players[playerID].recvBuffer[12] << 8; 	// byte 1 of y value
-				temp |= players[playerID].recvBuffer[13]; 		// byte 0 of y value
-				uint32_t binaryY = ntohl(temp);
-				memcpy(&players[playerID].y, &binaryY, sizeof(float));
-				
-				temp = 0;
-				
-				// Read the player's y coordinate
-				temp |= players[playerID].recvBuffer[14] << 24; // byte 3 of y value
-				temp |= players[playerID].recvBuffer[15] << 16; // byte 2 of y value
-				temp |= players[playerID].recvBuffer[16] << 8; 	// byte 1 of y value
-				temp |= players[playerID].recvBuffer[17]; 		// byte 0 of y value
-				uint32_t binaryZ = ntohl(temp);
-				memcpy(&players[playerID].z, &binaryZ, sizeof(float));
-				
-				fprintf(stdout, "Player %d moves to {%.2f, %.2f, %.2f}\n", playerID, players[playerID].x, players[playerID].y, players[playerID].z);
-			}	
-			break;
-		}		
-		case PLAYER_SELF_ANNIHILATE:
-		{
-			// 6 bytes are expected for player self annihilate message
-			if (numBytes != 6)
-			{
-				fprintf(stderr, "Wrong number of bytes received in player self annihilate message: %u\n", numBytes);
-				for (int i = 0; i < (int)numBytes; i++)
-				{
-					fprintf(stdout, "Byte %d: %d\n", i, server->recvBuffer[i]);
-				}
-				res = -1;
-			}
-			else
-			{
-				fprintf(stdout, "Player %d self-annihilated\n", playerID);
-						
-				// Set the player to "dead"
-				players[playerID].isAlive = false;
-				numAlivePlayers--;
-				
-				int32_t* killedPlayers = new int32_t[PLAYER_LIMIT - 1];
-				
-				// Simulate the result of the player's self destruction
-				int numKills = simRecursiveExplosion(playerID, killedPlayers, 0);
-				
-				fprintf(stdout, "%d player(s) killed\n", numKills);
-				
-				for (int j = 0; j < numKills; j++)
-				{
-					fprintf(stdout, "Player %d killed\n", killedPlayers[j]);
-				}
-				
-				// Update the player's score
-				players[playerID].score += numKills;
-				
-				// Broadcast the self destruction to all players
-				broadcastSelfDestruct(playerID, numKills, killedPlayers);
-
-				delete[] killedPlayers;
-						
-				// broadcastSelfDestruct returns the number of messages sent to players
-				// If the number of messages is less than the number of active players
-				// more sophisticated error handling will be needed to handle this error
-			}	
-			break;
-		}		
-		case PLAYER_SPAWN:
-		{
-			// 18 bytes are expected for player spawn message
-			if (numBytes != 18)
-			{
-				fprintf(stderr, "Wrong number of bytes received in player spawn message: %u\n", numBytes);
-				for (int i = 0; i < (int)numBytes; i++)
-				{
-					fprintf(stdout, "Byte %d: %d\n", i, server->recvBuffer[i]);
-				}
-				res = -1;
-			}
-			else
-			{
-				uint32_t temp = 0;
-				
-				// Read the player's x coordinate
-				temp |= players[playerID].recvBuffer[6] << 24; 	// byte 3 of x value
-				temp |= players[playerID].recvBuffer[7] << 16; 	// byte 2 of x value
-				temp |= players[playerID].recvBuffer[8] << 8; 	// byte 1 of x value
-				temp |= players[playerID].recvBuffer[9]; 		// byte 0 of x value
-				uint32_t binaryX = ntohl(temp);
-				memcpy(&players[playerID].x, &binaryX, sizeof(float));
-				
-				temp = 0;
-				
-				// Read the player's y coordinate
-				temp |= players[playerID].recvBuffer[10] << 24; 	// byte 3 of y value
-				temp |= players[playerID].recvBuffer[11] << 16; 	// byte 2 of y value
-				temp |= players[playerID].recvBuffer[12] << 8; 	// byte 1 of y value
-				temp |= players[playerID].recvBuffer[13]; 		// byte 0 of y value
-				uint32_t binaryY = ntohl(temp);
-				memcpy(&players[playerID].y, &binaryY, sizeof(float));
-				
-				temp = 0;
-				
-				// Read the player's y coordinate
-				temp |= players[playerID].recvBuffer[14] << 24; // byte 3 of y value
-				temp |= players[playerID].recvBuffer[15] << 16; // byte 2 of y value
-				temp |= players[playerID].recvBuffer[16] << 8; 	// byte 1 of y value
-				temp |= players[playerID].recvBuffer[17]; 		// byte 0 of y value
-				uint32_t binaryZ = ntohl(temp);
-				memcpy(&players[playerID].z, &binaryZ, sizeof(float));
-				
-				// Set the player as alive
-				players[playerID].isAlive = true;
-				
-				fprintf(stdout, "Player %d spawned at {%.2f, %.2f, %.2f}\n", playerID, players[playerID].x, players[playerID].y, players[playerID].z);
-				
-				broadcastNewSpawn(playerID);
-						
-				// broadcastNewSpawn returns the number of messages sent to players
-				// If the number of messages is less than the number of active players
-				// more sophisticated error handling will be needed to handle this error					
-			}			
-			break;		
-		}	
-		default:
-		{
-			fprintf(stderr, "Wrong message code in player message\n");
-			res = -1;
-			break;
-		}		
-	}
+	// Load the message into the buffer
+	message[0] = GET_BYTE_3(convertedBytes);
+	message[1] = GET_BYTE_2(convertedBytes);
+	message[2] = GET_BYTE_1(convertedBytes);
+	message[3] = GET_BYTE_0(convertedBytes);
+	message[4] = VERSION_NUM; 				// first byte: version num
+	message[5] = PLAYER_JOIN_RESPONSE; 	// second byte: message code
+	message[6] = GET_BYTE_3(convertedID); 	// third byte: byte 3 of ID
+	message[7] = GET_BYTE_2(convertedID); 	// 4th byte: byte 2 of ID
+	message[8] = GET_BYTE_1(convertedID); 	// 5th byte: byte 1 of ID
+	message[9] = GET_BYTE_0(convertedID);	// 6th byte: byte 0  of ID
 	
-	return res;
+	return numBytes;
 }
 
 
-int GameServer::simRecursiveExplosion(int32_t playerID, int32_t* killedPlayers, int index)
+int GameServer::sendOptions(int32_t playerID)
 {
-	int numKills = 0;
+	uint32_t numBytes = 11;
+	uint32_t convertedBytes = htonl(numBytes);
+	uint32_t convertedThreshold = htonl(config.compressionThreshold);
 	
-	// Iterate through each player
-	// and check if they are killed by the explosion
-	// Note: the exploding player will not be added to the kill list
-	for (int i = 0; i < PLAYER_LIMIT; i++)
+	uint8_t message[11];
+	
+	message[0] = GET_BYTE_3(convertedBytes);
+	message[1] = GET_BYTE_2(convertedBytes);
+	message[2] = GET_BYTE_1(convertedBytes);
+	message[3] = GET_BYTE_0(convertedBytes);
+	message[4] = VERSION_NUM;
+	message[5] = SERVER_OPTIONS;
+	message[6] = players[playerID].options;
+	message[7] = GET_BYTE_3(convertedThreshold);
+	message[8] = GET_BYTE_2(convertedThreshold);
+	message[9] = GET_BYTE_1(convertedThreshold);
+	message[10] = GET_BYTE_0(convertedThreshold);
+	
+	return sendToPlayer(playerID, message, numBytes);
+}
+
+
+int GameServer::sendUDPToken(int32_t playerID)
+{
+	// Issue a new token every time one is requested
+	// A token of zero means no token has been issued, so it is never used
+	uint32_t token = 0;
+	while (token == 0)
 	{
-		// If player is not the one exploded
-		// Player is valid (sockfd is not zero)
-		// Player is still alive
-		// And player is within explosion radius
-		if (i != playerID && players[i].sockfd != 0 && players[i].isAlive && getDistance(playerID, i) <= EXPLOSION_RADIUS)
+		if (getrandom(&token, sizeof(token), 0) != sizeof(token))
 		{
-			killedPlayers[numKills] = i;
-			players[i].isAlive = false;
-			numKills++;
-			numAlivePlayers--;
-			
-			// simulate the chain reaction caused by the explosion of the killed player
-			numKills += simRecursiveExplosion(i, killedPlayers, numKills + 1);
+			token = (uint32_t)rand() ^ (uint32_t)time(NULL);
 		}
 	}
 	
-	return numKills;
+	players[playerID].udpToken = token;
+	players[playerID].hasUDPEndpoint = false;
+	
+	int32_t convertedID = htonl(players[playerID].globalID);
+	uint32_t convertedToken = htonl(token);
+	
+	uint32_t numBytes = 14;
+	uint32_t convertedBytes = htonl(numBytes);
+	
+	// Load the message into the buffer
+	uint8_t message[14];
+	message[0] = GET_BYTE_3(convertedBytes);
+	message[1] = GET_BYTE_2(convertedBytes);
+	message[2] = GET_BYTE_1(convertedBytes);
+	message[3] = GET_BYTE_0(convertedBytes);
+	message[4] = VERSION_NUM;
+	message[5] = SERVER_UDP_TOKEN;
+	message[6] = GET_BYTE_3(convertedID);
+	message[7] = GET_BYTE_2(convertedID);
+	message[8] = GET_BYTE_1(convertedID);
+	message[9] = GET_BYTE_0(convertedID);
+	message[10] = GET_BYTE_3(convertedToken);
+	message[11] = GET_BYTE_2(convertedToken);
+	message[12] = GET_BYTE_1(convertedToken);
+	message[13] = GET_BYTE_0(convertedToken);
+	
+	return sendToPlayer(playerID, message, numBytes);
 }
 
 
-int GameServer::broadcastSelfDestruct(int32_t playerID, int numKills, int32_t* killedPlayers)
+int GameServer::sendUDPRegistered(int32_t playerID)
 {
-	int numSent = 0;
+	uint32_t numBytes = 6;
+	uint32_t convertedBytes = htonl(numBytes);
 	
-	// Since all sockets get the same message,
-	// A single common message buffer is used instead of individual player's buffer
+	uint8_t message[6];
 	
-	// Preparing the broadcast message
-	// 4 bytes num bytes in message
-	// 1 byte version number
-	// 1 byte message code
-	// 4 bytes ID of player exploded
-	// 2 bytes for number of players killed
-	// 4 bytes ID of each player killed
-	int messageSize = 12 + numKills * 4;
+	message[0] = GET_BYTE_3(convertedBytes);
+	message[1] = GET_BYTE_2(convertedBytes);
+	message[2] = GET_BYTE_1(convertedBytes);
+	message[3] = GET_BYTE_0(convertedBytes);
+	message[4] = VERSION_NUM;
+	message[5] = SERVER_UDP_REGISTERED;
 	
-	uint8_t* message = new uint8_t[messageSize];
+	return sendToPlayer(playerID, message, numBytes);
+}
+
+
+int GameServer::sendRelaySubscribed(int32_t playerID)
+{
+	uint32_t numBytes = 6;
+	uint32_t convertedBytes = htonl(numBytes);
 	
-	uint32_t convertedBytes = htonl(messageSize);
-	int32_t convertedID = htonl(playerID);
-	int16_t convertedNumKills = htons((int16_t)numKills);
+	uint8_t message[6];
 	
 	message[0] = GET_BYTE_3(convertedBytes);
 	message[1] = GET_BYTE_2(convertedBytes);
 	message[2] = GET_BYTE_1(convertedBytes);
 	message[3] = GET_BYTE_0(convertedBytes);
 	message[4] = VERSION_NUM;
-	message[5] = ANNIHILATION_RESULTS;
-	message[6] = GET_BYTE_3(convertedID); 			// third byte: byte 3 of ID
-	message[7] = GET_BYTE_2(convertedID); 			// 4th byte: byte 2 of ID
-	message[8] = GET_BYTE_1(convertedID);			// 5th byte: byte 1 of ID
-	message[9] = GET_BYTE_0(convertedID);			// 6th byte: byte 0  of ID 
-	message[10] = GET_BYTE_1(convertedNumKills);	// 7th byte: byte 1 of numKills
-	message[11] = GET_BYTE_0(convertedNumKills);	// 8th byte: byte 0 of numKills
+	message[5] = SERVER_RELAY_SUBSCRIBED;
 	
-	// Note: although the player's ID is 32 bits,
-	// only 16 bits are used to store the number of players killed
-	// Hence the maximum num of players killed is smaller than maximum number of players
-	// However, since the protocol specifies that 16 bits are used, I'll go with it
+	return sendToPlayer(playerID, message, numBytes);
+}
+
+
+bool GameServer::isRelaySecret(const uint8_t* secret, uint32_t length)
+{
+	if (config.relaySecret == NULL) return false;
 	
-	int index = 12;
+	uint32_t expectedLength = strlen(config.relaySecret);
 	
-	// Load the IDs of players killed
-	for (int i = 0; i < numKills; i++)
+	if (length != expectedLength) return false;
+	
+	// Compare every byte, whatever the first mismatch
+	uint8_t difference = 0;
+	for (uint32_t i = 0; i < length; i++)
 	{
-		convertedID = htonl(killedPlayers[i]);
-		
-		message[index] = GET_BYTE_3(convertedID); 		// Byte 3 of ID
-		message[index + 1] = GET_BYTE_2(convertedID); 	// Byte 2 of ID
-		message[index + 2] = GET_BYTE_1(convertedID); 	// Byte 1 of ID
-		message[index + 3] = GET_BYTE_0(convertedID);	// Byte 0 of ID
-		
-		// Move the index to the next 4 bytes block
-		index += 4;
+		difference |= secret[i] ^ (uint8_t)config.relaySecret[i];
 	}
 	
-	// Iterate through each player and send the message
-	for (int i = 0; i < PLAYER_LIMIT; i++)
+	return difference == 0;
+}
+
+
+int GameServer::grantSharedMemory(int32_t playerID)
+{
+	Player* player = &players[playerID];
+	SharedMemoryChannel* channel = &channels[playerID];
+	
+	uint32_t numBytes = 7;
+	uint32_t convertedBytes = htonl(numBytes);
+	
+	uint8_t message[7];
+	
+	message[0] = GET_BYTE_3(convertedBytes);
+	message[1] = GET_BYTE_2(convertedBytes);
+	message[2] = GET_BYTE_1(convertedBytes);
+	message[3] = GET_BYTE_0(convertedBytes);
+	message[4] = VERSION_NUM;
+	message[5] = SERVER_SHM_GRANTED;
+	message[6] = 0;
+	
+	// Descriptors can only be passed over the local socket, and the grant must be the last thing sent over it
+	// A channel cannot follow the player to another region of a cluster
+	bool canGrant = player->isLocal && !player->hasChannel && player->sendLength == 0 && !cluster.isEnabled();
+	
+	if (canGrant && channel->open() == 0 && channel->getServerEvent() >= FD_SETSIZE)
+	{
+		// select() cannot watch the event
+		channel->close();
+	}
+	
+	if (!canGrant || !channel->isOpen())
+	{
+		if (isVerboseLogging()) fprintf(stdout, "Player %d keeps using its socket\n", playerID);
+		return sendToPlayer(playerID, message, numBytes);
+	}
+	
+	message[6] = 1;
+	
+	struct iovec part;
+	part.iov_base = message;
+	part.iov_len = numBytes;
+	
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &part;
+	msg.msg_iovlen = 1;
+	
+	// The memory and both events travel as ancillary data
+	int fds[3] = { channel->getMemoryFd(), channel->getServerEvent(), channel->getClientEvent() };
+	
+	union
+	{
+		struct cmsghdr align;
+		uint8_t data[CMSG_SPACE(sizeof(fds))];
+		
+	} control;
+	
+	memset(&control, 0, sizeof(control));
+	msg.msg_control = control.data;
+	msg.msg_controllen = sizeof(control.data);
+	
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	
+	// Nothing is queued, so the socket takes the whole grant unless the connection failed
+	if (sendmsg(player->sockfd, &msg, MSG_NOSIGNAL) != (ssize_t)numBytes)
+	{
+		fprintf(stderr, "Error sending the shared memory grant to player %d: %s\n", playerID, strerror(errno));
+		channel->close();
+		player->isClosing = true;
+		return -1;
+	}
+	
+	channel->releaseMemoryFd();
+	player->hasChannel = true;
+	
+	int eventfd = channel->getServerEvent();
+	maxfd = (eventfd > maxfd) ? eventfd : maxfd;
+	
+	if (isVerboseLogging()) fprintf(stdout, "Player %d switched to shared memory\n", playerID);
+	
+	return 0;
+}
+
+
+void GameServer::checkChannelSocket(int32_t playerID)
+{
+	Player* player = &players[playerID];
+	
+	uint8_t data[64];
+	ssize_t bytes = recv(player->sockfd, data, sizeof(data), 0);
+	
+	if (bytes == -1)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return;
+		
+		fprintf(stderr, "Error receiving player message: %s\n", strerror(errno));
+		player->isClosing = true;
+	}
+	else if (bytes == 0)
+	{
+		// The player closed the connection
+		player->isClosing = true;
+	}
+	else
+	{
+		// Frames go through the channel now, anything sent over the socket is not part of the stream
+		if (isVerboseLogging()) fprintf(stderr, "Dropped %d bytes sent by player %d over the socket of its channel\n", (int)bytes, playerID);
+	}
+}
+
+
+void GameServer::processUDPMessages()
+{
+	TRACE_SCOPE(&tracer, "udp");
+	
+	uint8_t datagram[64];
+	
+	// Drain the socket, but bound the work done in a single wakeup
+	for (int count = 0; count < UDP_READ_LIMIT; count++)
+	{
+		struct sockaddr_storage addr;
+		socklen_t addrlen = sizeof(addr);
+		
+		ssize_t bytes = recvfrom(udpSockfd, datagram, sizeof(datagram), 0, (struct sockaddr*)&addr, &addrlen);
+		
+		if (bytes == -1)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				fprintf(stderr, "Error receiving UDP datagram: %s\n", strerror(errno));
+			}
+			return;
+		}
+		
+		// Registration is the only message accepted over UDP
+		// 4 bytes num bytes, 1 byte version, 1 byte code, 4 bytes player ID, 4 bytes token
+		if (bytes != 14 || datagram[4] != VERSION_NUM || datagram[5] != PLAYER_UDP_REGISTER)
+		{
+			continue;
+		}
+		
+		uint32_t temp = 0;
+		temp |= datagram[6] << 24;
+		temp |= datagram[7] << 16;
+		temp |= datagram[8] << 8;
+		temp |= datagram[9];
+		int32_t playerID = findPlayerSlot(ntohl(temp));
+		
+		temp = 0;
+		temp |= datagram[10] << 24;
+		temp |= datagram[11] << 16;
+		temp |= datagram[12] << 8;
+		temp |= datagram[13];
+		uint32_t token = ntohl(temp);
+		
+		// Silently drop datagrams that do not match an issued token
+		if (playerID == -1)
+		{
+			continue;
+		}
+		if (players[playerID].udpToken == 0 || players[playerID].udpToken != token)
+		{
+			continue;
+		}
+		
+		// Clients may register again, e.g. if their address changed
+		memcpy(&players[playerID].udpAddr, &addr, addrlen);
+		players[playerID].udpAddrlen = addrlen;
+		
+		if (!players[playerID].hasUDPEndpoint)
+		{
+			if (isVerboseLogging()) fprintf(stdout, "Player %d registered a UDP endpoint\n", playerID);
+		}
+		
+		players[playerID].hasUDPEndpoint = true;
+		
+		sendUDPRegistered(playerID);
+	}
+}
+
+
+bool GameServer::setPlayerSocketOptions(int sockfd, bool isLocal)
+{
+	// Framing does not rely on it (see the note at the top of GameServer.h)
+	// but it keeps small messages from being delayed
+	if (config.noDelay && !isLocal)
+	{
+		int flag = 1;
+		if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag)) == -1)
+		{
+			fprintf(stderr, "Failed to set TCP_NODELAY: %s\n", strerror(errno));
+		}
+	}
+	
+	if (config.sendBufferSize > 0)
+	{
+		if (setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &config.sendBufferSize, sizeof(config.sendBufferSize)) == -1)
+		{
+			fprintf(stderr, "Failed to set SO_SNDBUF: %s\n", strerror(errno));
+		}
+	}
+	
+	if (config.recvBufferSize > 0)
+	{
+		if (setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &config.recvBufferSize, sizeof(config.recvBufferSize)) == -1)
+		{
+			fprintf(stderr, "Failed to set SO_RCVBUF: %s\n", strerror(errno));
+		}
+	}
+	
+	// The rest only applies to TCP
+	if (isLocal) return false;
+	
+	// In low-latency mode, receives poll the device queue for a while instead of waiting for an interrupt
+	// Raising SO_BUSY_POLL above net.core.busy_read needs CAP_NET_ADMIN
+	if (config.lowLatency)
+	{
+		int usec = BUSY_POLL_USEC;
+		if (setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) == -1)
+		{
+			if (isVerboseLogging()) fprintf(stderr, "Failed to set SO_BUSY_POLL: %s\n", strerror(errno));
+		}
+		
+		int flag = 1;
+		if (setsockopt(sockfd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &flag, sizeof(flag)) == -1)
+		{
+			if (isVerboseLogging()) fprintf(stderr, "Failed to set SO_PREFER_BUSY_POLL: %s\n", strerror(errno));
+		}
+	}
+	
+	// Large map updates are sent with MSG_ZEROCOPY if the kernel supports it
+	if (config.zeroCopyThreshold > 0)
+	{
+		int flag = 1;
+		if (setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, &flag, sizeof(flag)) == -1)
+		{
+			if (isVerboseLogging()) fprintf(stderr, "Failed to set SO_ZEROCOPY: %s\n", strerror(errno));
+			return false;
+		}
+		return true;
+	}
+	
+	return false;
+}
+
+
+AsyncTask GameServer::acceptPlayers(int listenfd, bool isLocal)
+{
+	while (true)
+	{
+		struct sockaddr addr;
+		socklen_t addrlen = sizeof(addr);
+		
+		// Complete the connection, waiting for one if the backlog is empty
+		// The player socket is created non-blocking, so no extra fcntl() calls are needed
+		int sockfd = co_await AsyncAccept(&scheduler, listenfd, &addr, &addrlen);
+		
+		// Until the end of this iteration, the next wait is not part of the accept
+		TRACE_SCOPE(&tracer, "accept");
+		
+		// Find the first available player slot
+		// (after the wait, since players may have left in the meantime)
+		int32_t i = activePlayers.firstFree();
+		
+		// If no available slot is found, or the socket cannot be tracked by select()
+		// Close the connection so the client does not wait in the backlog until it times out
+		if (i == -1 || sockfd >= FD_SETSIZE)
+		{
+			if (isVerboseLogging()) fprintf(stdout, "No available player slot. Cannot accept new player.\n");
+			close(sockfd);
+			continue;
+		}
+		
+		bool zeroCopy = setPlayerSocketOptions(sockfd, isLocal);
+		
+		// A map update still being finished goes to the players it was built for, before this one becomes active,
+		// since the join response must be the first frame the new player gets
+		if (isMapUpdatePending)
+		{
+			collectMapUpdate();
+		}
+		
+		if (isVerboseLogging()) fprintf(stdout, "New %splayer with ID %d created\n", isLocal ? "local " : "", i);
+		
+		// Initialize the player
+		initializePlayer(i, sockfd);
+		players[i].addr = addr;
+		players[i].addrlen = addrlen;
+		players[i].zeroCopy = zeroCopy;
+		players[i].isLocal = isLocal;
+		
+		// In cluster mode, every region numbers its players apart from the others (serial number * regions + region)
+		// so a player keeps its ID when the robot moves to another region
+		if (cluster.isEnabled())
+		{
+			players[i].globalID = nextJoinSerial * cluster.getRegionCount() + cluster.getRegionIndex();
+			nextJoinSerial++;
+		}
+		
+		// The rest of the connection is handled by its own coroutine
+		playerSession(i, true);
+	}
+}
+
+
+void GameServer::initializePlayer(int32_t playerID, int sockfd)
+{
+	Player* player = &players[playerID];
+	
+	player->sockfd = sockfd;
+	player->globalID = playerID;
+	player->isClosing = false;
+	player->sendLength = 0;
+	player->score = 0;	
+	player->mapRecord = -1;
+	player->recvLength = 0;
+	player->recvOffset = 0;
+	player->readBudgetBytes = READ_BUDGET_BYTES;
+	player->readBudgetFrames = READ_BUDGET_FRAMES;
+	player->hasReadBacklog = false;
+	player->hasPendingMove = false;
+	player->movedSinceUpdate = false;
+	player->lastMapUpdateTick = 0;
+	player->movesThisTick = 0;
+	player->movesReceived = 0;
+	player->movesCoalesced = 0;
+	player->ticksAtMoveLimit = 0;
+	player->options = 0;
+	player->isRelay = false;
+	player->isLocal = false;
+	player->hasChannel = false;
+	player->rateLevel = 0;
+	player->healthyChecks = 0;
+	player->lastTotalRetrans = 0;
+	player->udpToken = 0;
+	player->hasUDPEndpoint = false;
+	player->hasPendingAnnihilation = false;
+	player->hasRemoteDetonation = false;
+	player->zeroCopy = false;
+	player->zeroCopyNextID = 0;
+	player->zeroCopyPending = 0;
+	
+	// Update the max file descriptor
+	maxfd = (sockfd > maxfd) ? sockfd : maxfd;	
+	
+	activePlayers.add(playerID);
+}
+
+
+int32_t GameServer::findPlayerSlot(int32_t globalID)
+{
+	for (int32_t i = activePlayers.first(); i != -1; i = activePlayers.next(i))
+	{
+		if (players[i].globalID == globalID) return i;
+	}
+	
+	return -1;
+}
+
+
+void GameServer::placeRobot(int32_t playerID)
+{
+	Player* player = &players[playerID];
+	
+	if (!alivePlayers.contains(playerID))
+	{
+		alivePlayers.add(playerID);
+		
+		player->mapRecord = numMapRecords;
+		mapRecordOwners[numMapRecords] = playerID;
+		numMapRecords++;
+	}
+	
+	writeMapRecord(playerID);
+	
+	// The robot may land anywhere, so its neighbours are found again
+	proximity.add(playerID, player->x, player->y, player->z);
+}
+
+
+void GameServer::removeRobot(int32_t playerID)
+{
+	Player* player = &players[playerID];
+	
+	if (!alivePlayers.contains(playerID)) return;
+	
+	alivePlayers.remove(playerID);
+	proximity.remove(playerID);
+	isMapShrunk = true;
+	
+	// Move the last record into the freed place
+	numMapRecords--;
+	
+	if (player->mapRecord != numMapRecords)
+	{
+		int32_t lastOwner = mapRecordOwners[numMapRecords];
+		
+		memcpy(mapRecords + player->mapRecord * MAP_RECORD_SIZE, mapRecords + numMapRecords * MAP_RECORD_SIZE, MAP_RECORD_SIZE);
+		mapRecordOwners[player->mapRecord] = lastOwner;
+		players[lastOwner].mapRecord = player->mapRecord;
+	}
+	
+	player->mapRecord = -1;
+}
+
+
+void GameServer::writeMapRecord(int32_t playerID)
+{
+	Player* player = &players[playerID];
+	uint8_t* record = mapRecords + player->mapRecord * MAP_RECORD_SIZE;
+	
+	uint32_t binaryX;
+	uint32_t binaryY;
+	uint32_t binaryZ;
+	
+	// Copy the binary bits in the float coordinates into uint32_t variables
+	// This must be done instead of casting because
+	// casting the float values to uint32_t is equivalent to rounding
+	memcpy(&binaryX, &player->x, sizeof(float));
+	memcpy(&binaryY, &player->y, sizeof(float));
+	memcpy(&binaryZ, &player->z, sizeof(float));
+	
+	int32_t convertedID = htonl(player->globalID);
+	uint32_t convertedX = htonl(binaryX);
+	uint32_t convertedY = htonl(binaryY);
+	uint32_t convertedZ = htonl(binaryZ);	
+	
+	record[0] = GET_BYTE_3(convertedID); 	// byte 3 of ID
+	record[1] = GET_BYTE_2(convertedID); 	// byte 2 of ID
+	record[2] = GET_BYTE_1(convertedID); 	// byte 1 of ID
+	record[3] = GET_BYTE_0(convertedID);	// byte 0 of ID 
+	record[4] = GET_BYTE_3(convertedX); 	// byte 3 of x coordinate
+	record[5] = GET_BYTE_2(convertedX); 	// byte 2 of x coordinate
+	record[6] = GET_BYTE_1(convertedX);		// byte 1 of x coordinate
+	record[7] = GET_BYTE_0(convertedX); 	// byte 0 of x coordinate
+	record[8] = GET_BYTE_3(convertedY); 	// byte 3 of y coordinate
+	record[9] = GET_BYTE_2(convertedY); 	// byte 2 of y coordinate
+	record[10] = GET_BYTE_1(convertedY); 	// byte 1 of y coordinate
+	record[11] = GET_BYTE_0(convertedY); 	// byte 0 of y coordinate
+	record[12] = GET_BYTE_3(convertedZ); 	// byte 3 of z coordinate
+	record[13] = GET_BYTE_2(convertedZ); 	// byte 2 of z coordinate
+	record[14] = GET_BYTE_1(convertedZ); 	// byte 1 of z coordinate
+	record[15] = GET_BYTE_0(convertedZ); 	// byte 0 of z coordinate 
+}
+
+
+AsyncTask GameServer::playerSession(int32_t playerID, bool isJoining)
+{
+	// The join response is the first message the player gets
+	// A player handed off by another region already has it, the connection just goes on here
+	if (isJoining)
+	{
+		uint8_t joinResponse[10];
+		int joinResponseSize = writeJoinResponse(joinResponse, players[playerID].globalID);
+		
+		if (co_await PlayerWriteOperation(this, playerID, joinResponse, joinResponseSize) == -1) co_return;
+	}
+	
+	// Process frames until the connection closes
+	// The coroutine is destroyed if the player is removed while it waits
+	while (true)
+	{
+		const uint8_t* frame;
+		int numBytes = co_await FrameReadOperation(this, playerID, &frame);
+		
+		if (numBytes == -1) co_return;
+		
+		if (processPlayerFrame(playerID, frame, numBytes) == -1)
+		{
+			fprintf(stderr, "Error processing message from player %d\n", playerID);
+		}
+	}
+}
+
+
+int GameServer::getPlayerWaitSocket(int32_t playerID)
+{
+	if (players[playerID].hasChannel) return channels[playerID].getServerEvent();
+	
+	return players[playerID].sockfd;
+}
+
+
+ssize_t GameServer::receiveFromPlayer(int32_t playerID, uint8_t* buffer, uint32_t capacity)
+{
+	if (players[playerID].hasChannel) return channels[playerID].receive(buffer, capacity);
+	
+	return recv(players[playerID].sockfd, buffer, capacity, 0);
+}
+
+
+ssize_t GameServer::sendRawToPlayer(int32_t playerID, const uint8_t* message, uint32_t numBytes)
+{
+	if (players[playerID].hasChannel) return channels[playerID].send(message, numBytes);
+	
+	return send(players[playerID].sockfd, message, numBytes, MSG_NOSIGNAL);
+}
+
+
+int GameServer::sendToPlayer(int32_t playerID, const uint8_t* message, uint32_t numBytes)
+{
+	// A map update still being finished goes out first,
+	// so a player never gets a frame of the next tick (a spawn, an annihilation) before the update of the last one
+	if (isMapUpdatePending)
+	{
+		collectMapUpdate();
+	}
+	
+	Player* player = &players[playerID];
+	
+	if (player->isClosing) return -1;
+	
+	uint32_t offset = 0;
+	
+	// If nothing is queued, send straight from the message and only queue what's left
+	if (player->sendLength == 0)
+	{
+		ssize_t bytes = sendRawToPlayer(playerID, message, numBytes);
+		
+		if (bytes == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		{
+			fprintf(stderr, "Error sending to player %d: %s\n", playerID, strerror(errno));
+			player->isClosing = true;
+			return -1;
+		}
+		
+		if (bytes > 0) offset = bytes;
+	}
+	
+	if (offset == numBytes) return 0;
+	
+	// A client that cannot keep up is disconnected
+	// Dropping part of a message would corrupt the stream
+	uint32_t queuedBytes = player->sendLength + numBytes - offset;
+	
+	if (queuedBytes > SEND_QUEUE_LIMIT)
+	{
+		fprintf(stderr, "Send buffer of player %d is full, closing connection\n", playerID);
+		player->isClosing = true;
+		return -1;
+	}
+	
+	// Take a buffer from the pool, or a larger one if the queued output outgrows it
+	if (player->sendBuffer == NULL || queuedBytes > player->sendCapacity)
+	{
+		uint32_t capacity;
+		uint8_t* buffer = ioPool.acquire(queuedBytes, &capacity);
+		
+		if (buffer == NULL)
+		{
+			fprintf(stderr, "No send buffer available for player %d, closing connection\n", playerID);
+			player->isClosing = true;
+			return -1;
+		}
+		
+		if (player->sendLength > 0)
+		{
+			memcpy(buffer, player->sendBuffer, player->sendLength);
+		}
+		
+		ioPool.release(player->sendBuffer, player->sendCapacity);
+		player->sendBuffer = buffer;
+		player->sendCapacity = capacity;
+	}
+	
+	memcpy(player->sendBuffer + player->sendLength, message + offset, numBytes - offset);
+	player->sendLength += numBytes - offset;
+	writingPlayers.add(playerID);
+	
+	return flushPlayerOutput(playerID);
+}
+
+
+int GameServer::sendBroadcastToPlayer(int32_t playerID, int buffer, uint32_t numBytes)
+{
+	Player* player = &players[playerID];
+	
+	const uint8_t* message = broadcastPool.getData(buffer);
+	
+	// Small frames, or frames behind queued output, are copied like any other message
+	// A player with too many sends in flight also falls back to copying until the kernel catches up
+	if (!player->zeroCopy || numBytes < (uint32_t)config.zeroCopyThreshold || player->sendLength > 0 || player->isClosing || player->zeroCopyPending == ZEROCOPY_PENDING_LIMIT)
+	{
+		return sendToPlayer(playerID, message, numBytes);
+	}
+	
+	ssize_t bytes = send(player->sockfd, message, numBytes, MSG_NOSIGNAL | MSG_ZEROCOPY);
+	
+	if (bytes == -1)
+	{
+		// The socket is full, or the kernel cannot pin more pages for this socket (ENOBUFS)
+		// Copy the frame into the send buffer instead
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ENOBUFS)
+		{
+			return sendToPlayer(playerID, message, numBytes);
+		}
+		
+		fprintf(stderr, "Error sending to player %d: %s\n", playerID, strerror(errno));
+		player->isClosing = true;
+		return -1;
+	}
+	
+	// Every successful zerocopy send gets the next number of the socket
+	// The buffer stays referenced until the completion for that number is read
+	broadcastPool.addReference(buffer);
+	player->zeroCopyIDs[player->zeroCopyPending] = player->zeroCopyNextID;
+	player->zeroCopyBuffers[player->zeroCopyPending] = buffer;
+	player->zeroCopyPending++;
+	player->zeroCopyNextID++;
+	
+	// Queue whatever the socket did not take
+	if ((uint32_t)bytes < numBytes)
+	{
+		return sendToPlayer(playerID, message + bytes, numBytes - bytes);
+	}
+	
+	return 0;
+}
+
+
+void GameServer::processZeroCopyCompletions(int32_t playerID)
+{
+	TRACE_SCOPE(&tracer, "zerocopy completions");
+	
+	Player* player = &players[playerID];
+	
+	// The kernel copied the data after all (e.g. loopback, or a device without scatter-gather)
+	// Zerocopy only adds overhead then, so the player goes back to regular sends
+	if (releaseZeroCopyCompletions(player->sockfd, &player->zeroCopyPending, player->zeroCopyIDs, player->zeroCopyBuffers))
+	{
+		if (player->zeroCopy && isVerboseLogging()) fprintf(stdout, "Zerocopy sends to player %d are copied by the kernel, using regular sends\n", playerID);
+		player->zeroCopy = false;
+	}
+}
+
+
+bool GameServer::releaseZeroCopyCompletions(int sockfd, int* numPending, uint32_t* ids, int* buffers)
+{
+	bool isCopied = false;
+	
+	while (*numPending > 0)
+	{
+		uint8_t control[128];
+		
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		
+		// The error queue never blocks, EAGAIN means no completion is left
+		if (recvmsg(sockfd, &msg, MSG_ERRQUEUE) == -1) break;
+		
+		for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			bool isRecvErr = (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) || (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+			
+			if (!isRecvErr) continue;
+			
+			struct sock_extended_err error;
+			memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+			
+			if (error.ee_errno != 0 || error.ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+			
+			// The completion covers the range of send numbers [ee_info, ee_data]
+			uint32_t first = error.ee_info;
+			uint32_t last = error.ee_data;
+			
+			int index = 0;
+			while (index < *numPending)
+			{
+				// Unsigned arithmetic handles the numbers wrapping around
+				if (ids[index] - first <= last - first)
+				{
+					broadcastPool.release(buffers[index]);
+					
+					// Move the last pending send into the freed entry
+					(*numPending)--;
+					ids[index] = ids[*numPending];
+					buffers[index] = buffers[*numPending];
+				}
+				else
+				{
+					index++;
+				}
+			}
+			
+			if (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) isCopied = true;
+		}
+	}
+	
+	return isCopied;
+}
+
+
+void GameServer::parkSocket(int32_t playerID)
+{
+	Player* player = &players[playerID];
+	
+	// Without a free entry, the connection parked the longest makes room
+	if (numParkedSockets == ZEROCOPY_PARK_LIMIT)
+	{
+		int oldest = 0;
+		
+		for (int k = 1; k < numParkedSockets; k++)
+		{
+			if (parkedSockets[k].parkedTick < parkedSockets[oldest].parkedTick) oldest = k;
+		}
+		
+		abortParkedSocket(oldest);
+	}
+	
+	// The connection ends as a close() would end it, but the socket stays open to read the completions
+	// A peer that stops acknowledging is given up on after the timeout, which completes the sends as well
+	shutdown(player->sockfd, SHUT_RDWR);
+	
+	unsigned int timeout = ZEROCOPY_PARK_TIMEOUT_MILLISEC;
+	setsockopt(player->sockfd, IPPROTO_TCP, TCP_USER_TIMEOUT, &timeout, sizeof(timeout));
+	
+	ParkedSocket* parked = &parkedSockets[numParkedSockets];
+	parked->sockfd = player->sockfd;
+	parked->parkedTick = tickNumber;
+	parked->zeroCopyPending = player->zeroCopyPending;
+	memcpy(parked->zeroCopyIDs, player->zeroCopyIDs, sizeof(parked->zeroCopyIDs));
+	memcpy(parked->zeroCopyBuffers, player->zeroCopyBuffers, sizeof(parked->zeroCopyBuffers));
+	numParkedSockets++;
+	
+	player->zeroCopyPending = 0;
+}
+
+
+void GameServer::processParkedSockets()
+{
+	int index = 0;
+	
+	while (index < numParkedSockets)
+	{
+		ParkedSocket* parked = &parkedSockets[index];
+		
+		releaseZeroCopyCompletions(parked->sockfd, &parked->zeroCopyPending, parked->zeroCopyIDs, parked->zeroCopyBuffers);
+		
+		if (parked->zeroCopyPending == 0)
+		{
+			close(parked->sockfd);
+			
+			// Move the last parked connection into the freed entry
+			numParkedSockets--;
+			parkedSockets[index] = parkedSockets[numParkedSockets];
+		}
+		else
+		{
+			index++;
+		}
+	}
+}
+
+
+void GameServer::abortParkedSocket(int index)
+{
+	ParkedSocket* parked = &parkedSockets[index];
+	
+	// A zero linger time makes close() reset the connection and free its send queue, so nothing more is sent from the buffers
+	struct linger abort;
+	abort.l_onoff = 1;
+	abort.l_linger = 0;
+	setsockopt(parked->sockfd, SOL_SOCKET, SO_LINGER, &abort, sizeof(abort));
+	
+	close(parked->sockfd);
+	
+	for (int i = 0; i < parked->zeroCopyPending; i++)
+	{
+		broadcastPool.release(parked->zeroCopyBuffers[i]);
+	}
+	
+	fprintf(stderr, "Too many closed connections waiting for zerocopy sends, reset the oldest\n");
+	
+	numParkedSockets--;
+	parkedSockets[index] = parkedSockets[numParkedSockets];
+}
+
+
+int GameServer::flushPlayerOutput(int32_t playerID)
+{
+	Player* player = &players[playerID];
+	
+	uint32_t offset = 0;
+	
+	while (offset < player->sendLength)
+	{
+		ssize_t bytes = sendRawToPlayer(playerID, player->sendBuffer + offset, player->sendLength - offset);
+		
+		if (bytes == -1)
+		{
+			if (errno == EINTR) continue;
+			
+			// The socket is full, the rest is sent when it becomes writable
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			
+			fprintf(stderr, "Error sending to player %d: %s\n", playerID, strerror(errno));
+			player->isClosing = true;
+			player->sendLength = 0;
+			writingPlayers.remove(playerID);
+			return -1;
+		}
+		
+		offset += bytes;
+	}
+	
+	// Move the unsent bytes to the front of the buffer
+	player->sendLength -= offset;
+	
+	if (offset > 0 && player->sendLength > 0)
+	{
+		memmove(player->sendBuffer, player->sendBuffer + offset, player->sendLength);
+	}
+	
+	// Give the buffer back once everything is sent
+	if (player->sendLength == 0) writingPlayers.remove(playerID);
+	
+	if (player->sendLength == 0 && player->sendBuffer != NULL)
+	{
+		ioPool.release(player->sendBuffer, player->sendCapacity);
+		player->sendBuffer = NULL;
+	}
+	
+	return 0;
+}
+
+
+void GameServer::removePlayer(int32_t playerID)
+{
+	Player* player = &players[playerID];
+	
+	// Destroy the player's coroutine if it is waiting for the socket (or the channel)
+	scheduler.cancel(player->sockfd);
+	
+	if (player->hasChannel)
+	{
+		scheduler.cancel(channels[playerID].getServerEvent());
+		channels[playerID].close();
+		player->hasChannel = false;
+	}
+	
+	// The kernel may still read the broadcast buffers of zerocopy sends in flight,
+	// so the connection stays open until it reports them complete, and the buffers stay referenced until then
+	if (player->zeroCopyPending > 0)
+	{
+		parkSocket(playerID);
+	}
+	else
+	{
+		close(player->sockfd);
+	}
+	
+	removeRobot(playerID);
+	
+	if (isVerboseLogging() && player->movesReceived > 0)
+	{
+		fprintf(stdout, "Player %d sent %u moves: %u coalesced, the per-tick limit was reached in %u ticks\n", playerID, player->movesReceived, player->movesCoalesced, player->ticksAtMoveLimit);
+	}
+	
+	player->sockfd = 0;
+	player->isClosing = false;
+	player->sendLength = 0;
+	player->recvLength = 0;
+	player->recvOffset = 0;
+	player->hasUDPEndpoint = false;
+	
+	ioPool.release(player->sendBuffer, player->sendCapacity);
+	ioPool.release(player->recvBuffer, player->recvCapacity);
+	player->sendBuffer = NULL;
+	player->recvBuffer = NULL;
+	player->udpToken = 0;
+	
+	activePlayers.remove(playerID);
+	writingPlayers.remove(playerID);
+}
+
+
+void GameServer::refillReadBudget(int32_t playerID)
+{
+	Player* player = &players[playerID];
+	
+	player->readBudgetBytes = READ_BUDGET_BYTES;
+	player->readBudgetFrames = READ_BUDGET_FRAMES;
+	player->hasReadBacklog = false;
+}
+
+
+int GameServer::nextPlayerFrame(int32_t playerID, const uint8_t** frame)
+{
+	Player* player = &players[playerID];
+	
+	if (player->isClosing) return -1;
+	
+	// Set once a receive comes back short, the socket is drained until select() reports it again
+	bool isDrained = false;
+	
+	while (true)
+	{
+		// The player sent all the moves it may send this tick, what is left waits for the next tick
+		// It is runnable again once the tick resets its move count (see FrameReadOperation::isParked)
+		if (player->movesThisTick >= MOVE_INPUT_LIMIT)
+		{
+			player->hasReadBacklog = true;
+			
+			if (stashPartialFrame(playerID, 0) == -1) return -1;
+			
+			return 0;
+		}
+		
+		// The player had its share of this iteration, the frames left in its buffer wait for the next one
+		if (player->readBudgetFrames == 0)
+		{
+			player->hasReadBacklog = true;
+			
+			if (stashPartialFrame(playerID, 0) == -1) return -1;
+			
+			return 0;
+		}
+		
+		// Without a partial frame, the received bytes are in the shared read buffer
+		uint8_t* buffer = (player->recvBuffer != NULL) ? player->recvBuffer : readBuffer;
+		uint32_t available = player->recvLength - player->recvOffset;
+		
+		// Size of the next frame, if its length has arrived
+		uint32_t numBytes = 0;
+		
+		// A fast client may have several frames concatenated in the buffer
+		// Return them one at a time and keep the trailing partial frame for the next receive
+		if (available >= 4)
+		{
+			const uint8_t* next = buffer + player->recvOffset;
+			
+			// Read the number of bytes in the packet
+			uint32_t rawBytes = 0;
+			rawBytes |= ((uint32_t)next[0]) << 24;
+			rawBytes |= ((uint32_t)next[1]) << 16;
+			rawBytes |= ((uint32_t)next[2]) << 8;
+			rawBytes |= ((uint32_t)next[3]);
+			
+			numBytes = ntohl(rawBytes);
+			
+			// A frame that can never fit in a buffer means the stream is corrupted
+			// Frame boundaries can no longer be trusted, so the player is disconnected
+			if (numBytes < 6 || numBytes > MAX_FRAME_SIZE)
+			{
+				fprintf(stderr, "Invalid frame length %u in player message\n", numBytes);
+				player->isClosing = true;
+				return -1;
+			}
+			else if (available >= numBytes)
+			{
+				*frame = next;
+				player->recvOffset += numBytes;
+				player->readBudgetFrames--;
+				return numBytes;
+			}
+		}
+		
+		// The shared read buffer is about to be used by other players
+		if (stashPartialFrame(playerID, numBytes) == -1) return -1;
+		
+		if (isDrained) return 0;
+		
+		if (player->readBudgetBytes == 0)
+		{
+			player->hasReadBacklog = true;
+			return 0;
+		}
+		
+		// Append the received bytes after any partial frame left over from the last receive
+		buffer = (player->recvBuffer != NULL) ? player->recvBuffer : readBuffer;
+		uint32_t capacity = (player->recvBuffer != NULL) ? player->recvCapacity : READ_BUFFER_SIZE;
+		
+		uint32_t length = capacity - player->recvLength;
+		if (length > player->readBudgetBytes) length = player->readBudgetBytes;
+		
+		ssize_t bytes = receiveFromPlayer(playerID, buffer + player->recvLength, length);
+		
+		if (bytes == -1)
+		{
+			// Nothing to read after all
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+			
+			fprintf(stderr, "Error receiving player message: %s\n", strerror(errno));
+			player->isClosing = true;
+			return -1;
+		}
+		if (bytes == 0)
+		{
+			// The player closed the connection
+			player->isClosing = true;
+			return -1;
+		}
+		
+		player->recvLength += bytes;
+		player->readBudgetBytes -= bytes;
+		
+		if ((uint32_t)bytes < length) isDrained = true;
+	}
+}
+
+
+int GameServer::stashPartialFrame(int32_t playerID, uint32_t frameBytes)
+{
+	Player* player = &players[playerID];
+	
+	uint32_t available = player->recvLength - player->recvOffset;
+	
+	// The connection is idle again, give the buffer back
+	if (available == 0)
+	{
+		ioPool.release(player->recvBuffer, player->recvCapacity);
+		player->recvBuffer = NULL;
+		player->recvLength = 0;
+		player->recvOffset = 0;
+		return 0;
+	}
+	
+	// The buffer must hold the whole frame
+	// (the frame length is not known yet if fewer than 4 bytes arrived)
+	if (frameBytes < available) frameBytes = available;
+	
+	uint8_t* buffer = (player->recvBuffer != NULL) ? player->recvBuffer : readBuffer;
+	
+	if (player->recvBuffer == NULL || frameBytes > player->recvCapacity)
+	{
+		uint32_t newCapacity;
+		uint8_t* newBuffer = ioPool.acquire(frameBytes, &newCapacity);
+		
+		if (newBuffer == NULL)
+		{
+			fprintf(stderr, "No receive buffer available for player %d, closing connection\n", playerID);
+			player->isClosing = true;
+			return -1;
+		}
+		
+		memcpy(newBuffer, buffer + player->recvOffset, available);
+		
+		ioPool.release(player->recvBuffer, player->recvCapacity);
+		player->recvBuffer = newBuffer;
+		player->recvCapacity = newCapacity;
+	}
+	else if (player->recvOffset > 0)
+	{
+		// Move the partial frame to the front of the buffer
+		memmove(player->recvBuffer, player->recvBuffer + player->recvOffset, available);
+	}
+	
+	player->recvLength = available;
+	player->recvOffset = 0;
+	
+	return 0;
+}
+
+
+int GameServer::processPlayerFrame(int32_t playerID, const uint8_t* frame, uint32_t numBytes)
+{
+	TRACE_SCOPE(&tracer, "frame");
+	
+	// Check the version number
+	if (frame[4] != VERSION_NUM)
+	{
+		fprintf(stderr, "Wrong version number in player message\n");
+		return -1;
+	}
+	
+	int res = 0;
+	
+	// Check the message code
+	switch(frame[5])
+	{
+		case PLAYER_MOVE:
+		{
+			// 18 bytes are expected for player move message
+			if (numBytes != 18)
+			{
+				fprintf(stderr, "Wrong number of bytes received in player move message: %u\n", numBytes);
+				for (int i = 0; i < (int)numBytes && isVerboseLogging(); i++)
+				{
+					fprintf(stdout, "Byte %d: %d\n", i, frame[i]);
+				}
+				res = -1;
+			}
+			else
+			{
+				Player* player = &players[playerID];
+				
+				player->movesReceived++;
+				
+				// A player that reaches the per-tick limit is not read again until the next tick (see nextPlayerFrame),
+				// so a flooding client costs no more than MOVE_INPUT_LIMIT moves a tick, and the rest of its input waits in its socket
+				player->movesThisTick++;
+				if (player->movesThisTick == MOVE_INPUT_LIMIT) player->ticksAtMoveLimit++;
+				
+				// Only the latest move of the tick is applied
+				if (player->hasPendingMove) player->movesCoalesced++;
+				
+				uint32_t temp = 0;
+				
+				// Read the player's x coordinate
+				temp |= frame[6] << 24; 	// byte 3 of x value
+				temp |= frame[7] << 16; 	// byte 2 of x value
+				temp |= frame[8] << 8; 	// byte 1 of x value
+				temp |= frame[9]; 		// byte 0 of x value
+				uint32_t binaryX = ntohl(temp);
+				memcpy(&player->pendingX, &binaryX, sizeof(float));
+				
+				temp = 0;
+				
+				// Read the player's y coordinate
+				temp |= frame[10] << 24; 	// byte 3 of y value
+				temp |= frame[11] << 16; 	// byte 2 of y value
+				temp |= frame[12] << 8; 	// byte 1 of y value
+				temp |= frame[13]; 		// byte 0 of y value
+				uint32_t binaryY = ntohl(temp);
+				memcpy(&player->pendingY, &binaryY, sizeof(float));
+				
+				temp = 0;
+				
+				// Read the player's y coordinate
+				temp |= frame[14] << 24; // byte 3 of y value
+				temp |= frame[15] << 16; // byte 2 of y value
+				temp |= frame[16] << 8; 	// byte 1 of y value
+				temp |= frame[17]; 		// byte 0 of y value
+				uint32_t binaryZ = ntohl(temp);
+				memcpy(&player->pendingZ, &binaryZ, sizeof(float));
+				
+				player->hasPendingMove = true;
+			}	
+			break;
+		}		
+		case PLAYER_SELF_ANNIHILATE:
+		{
+			// 6 bytes are expected for player self annihilate message
+			// or 10 bytes if the player tells the last tick it saw (lag compensation)
+			if (numBytes != 6 && numBytes != 10)
+			{
+				fprintf(stderr, "Wrong number of bytes received in player self annihilate message: %u\n", numBytes);
+				for (int i = 0; i < (int)numBytes && isVerboseLogging(); i++)
+				{
+					fprintf(stdout, "Byte %d: %d\n", i, frame[i]);
+				}
+				res = -1;
+			}
+			else if (!alivePlayers.contains(playerID))
+			{
+				// A robot that is not on the map cannot explode
+				fprintf(stderr, "Player %d self-annihilated without a live robot\n", playerID);
+			}
+			else
+			{
+				if (isVerboseLogging()) fprintf(stdout, "Player %d self-annihilated\n", playerID);
+				
+				// The annihilation is resolved at the next tick, together with the others received in the meantime
+				players[playerID].hasPendingAnnihilation = true;
+				players[playerID].pendingAnnihilationTick = 0;
+				players[playerID].hasAnnihilationTick = false;
+				
+				// Judge the explosion against the world the player saw, if the player told which tick that was
+				if (numBytes == 10)
+				{
+					uint32_t temp = 0;
+					temp |= frame[6] << 24;
+					temp |= frame[7] << 16;
+					temp |= frame[8] << 8;
+					temp |= frame[9];
+					
+					players[playerID].pendingAnnihilationTick = ntohl(temp);
+					players[playerID].hasAnnihilationTick = true;
+				}
+			}	
+			break;
+		}		
+		case PLAYER_SPAWN:
+		{
+			// 18 bytes are expected for player spawn message
+			if (numBytes != 18)
+			{
+				fprintf(stderr, "Wrong number of bytes received in player spawn message: %u\n", numBytes);
+				for (int i = 0; i < (int)numBytes && isVerboseLogging(); i++)
+				{
+					fprintf(stdout, "Byte %d: %d\n", i, frame[i]);
+				}
+				res = -1;
+			}
+			else if (players[playerID].isRelay)
+			{
+				// A relay only watches
+				fprintf(stderr, "Relay %d cannot spawn a robot\n", playerID);
+				res = -1;
+			}
+			else
+			{
+				uint32_t temp = 0;
+				
+				// Read the player's x coordinate
+				temp |= frame[6] << 24; 	// byte 3 of x value
+				temp |= frame[7] << 16; 	// byte 2 of x value
+				temp |= frame[8] << 8; 	// byte 1 of x value
+				temp |= frame[9]; 		// byte 0 of x value
+				uint32_t binaryX = ntohl(temp);
+				memcpy(&players[playerID].x, &binaryX, sizeof(float));
+				
+				temp = 0;
+				
+				// Read the player's y coordinate
+				temp |= frame[10] << 24; 	// byte 3 of y value
+				temp |= frame[11] << 16; 	// byte 2 of y value
+				temp |= frame[12] << 8; 	// byte 1 of y value
+				temp |= frame[13]; 		// byte 0 of y value
+				uint32_t binaryY = ntohl(temp);
+				memcpy(&players[playerID].y, &binaryY, sizeof(float));
+				
+				temp = 0;
+				
+				// Read the player's y coordinate
+				temp |= frame[14] << 24; // byte 3 of y value
+				temp |= frame[15] << 16; // byte 2 of y value
+				temp |= frame[16] << 8; 	// byte 1 of y value
+				temp |= frame[17]; 		// byte 0 of y value
+				uint32_t binaryZ = ntohl(temp);
+				memcpy(&players[playerID].z, &binaryZ, sizeof(float));
+				
+				// Set the player as alive
+				// Players are counted as alive when they spawn, not when they join
+				// A move buffered before the spawn is older than the spawn position
+				placeRobot(playerID);
+				players[playerID].hasPendingMove = false;
+				players[playerID].movedSinceUpdate = true;
+				
+				if (isVerboseLogging()) fprintf(stdout, "Player %d spawned at {%.2f, %.2f, %.2f}\n", playerID, players[playerID].x, players[playerID].y, players[playerID].z);
+				
+				broadcastNewSpawn(playerID);
+						
+				// broadcastNewSpawn returns the number of messages sent to players
+				// If the number of messages is less than the number of active players
+				// more sophisticated error handling will be needed to handle this error					
+			}			
+			break;		
+		}	
+		case PLAYER_SET_OPTIONS:
+		{
+			// 7 bytes are expected for set options message
+			if (numBytes != 7)
+			{
+				fprintf(stderr, "Wrong number of bytes received in set options message: %u\n", numBytes);
+				res = -1;
+			}
+			else
+			{
+				// Only grant the options this server supports
+				uint8_t options = frame[6];
+				
+				if (config.compressionThreshold <= 0) options &= ~OPTION_COMPRESSION;
+				
+				players[playerID].options = options & OPTIONS_SUPPORTED;
+				
+				res = sendOptions(playerID);
+			}
+			break;
+		}
+		case PLAYER_RELAY_SUBSCRIBE:
+		{
+			// 6 bytes of header followed by the relay secret
+			if (numBytes < 7 || numBytes > 6 + RELAY_SECRET_MAX)
+			{
+				fprintf(stderr, "Wrong number of bytes received in relay subscribe message: %u\n", numBytes);
+				res = -1;
+			}
+			else if (!isRelaySecret(frame + 6, numBytes - 6))
+			{
+				// A client that guesses the secret is not let in
+				fprintf(stderr, "Player %d sent a wrong relay secret, closing connection\n", playerID);
+				players[playerID].isClosing = true;
+				res = -1;
+			}
+			else if (alivePlayers.contains(playerID))
+			{
+				fprintf(stderr, "Player %d cannot become a relay with a robot on the map\n", playerID);
+				res = -1;
+			}
+			else
+			{
+				fprintf(stdout, "Player %d subscribed as a spectator relay\n", playerID);
+				
+				players[playerID].isRelay = true;
+				players[playerID].rateLevel = 0;
+				
+				res = sendRelaySubscribed(playerID);
+			}
+			break;
+		}
+		case PLAYER_SHM_REQUEST:
+		{
+			// 6 bytes are expected for shared memory request message
+			if (numBytes != 6)
+			{
+				fprintf(stderr, "Wrong number of bytes received in shared memory request message: %u\n", numBytes);
+				res = -1;
+			}
+			else
+			{
+				res = grantSharedMemory(playerID);
+			}
+			break;
+		}
+		case PLAYER_UDP_REQUEST:
+		{
+			// 6 bytes are expected for UDP request message
+			if (numBytes != 6)
+			{
+				fprintf(stderr, "Wrong number of bytes received in UDP request message: %u\n", numBytes);
+				res = -1;
+			}
+			else if (udpSockfd == -1)
+			{
+				// Without a UDP channel the client keeps receiving everything over TCP
+				fprintf(stderr, "Player %d requested UDP but the channel is not available\n", playerID);
+			}
+			else
+			{
+				res = sendUDPToken(playerID);
+			}
+			break;
+		}
+		default:
+		{
+			fprintf(stderr, "Wrong message code in player message\n");
+			res = -1;
+			break;
+		}		
+	}
+	
+	return res;
+}
+
+
+void GameServer::applyPendingMoves()
+{
+	TRACE_SCOPE(&tracer, "moves");
+	
+	for (int32_t i = activePlayers.first(); i != -1; i = activePlayers.next(i))
+	{
+		if (players[i].hasPendingMove)
+		{
+			players[i].x = players[i].pendingX;
+			players[i].y = players[i].pendingY;
+			players[i].z = players[i].pendingZ;
+			players[i].hasPendingMove = false;
+			players[i].movedSinceUpdate = true;
+			
+			if (alivePlayers.contains(i))
+			{
+				writeMapRecord(i);
+				proximity.move(i, players[i].x, players[i].y, players[i].z);
+			}
+		}
+		
+		// Start a new input window for the next tick
+		players[i].movesThisTick = 0;
+	}
+}
+
+
+void GameServer::updatePlayerRateLevels()
+{
+	TRACE_SCOPE(&tracer, "rate levels");
+	
+	for (int32_t i = activePlayers.first(); i != -1; i = activePlayers.next(i))
+	{
+		Player* player = &players[i];
+		
+		// Relays always get every update, they absorb the load of the spectators instead
+		if (player->isClosing || player->isRelay) continue;
+		
+		// Map updates go to a UDP endpoint as datagrams, which never queue, and the TCP socket is almost idle,
+		// so its TCP_INFO says nothing about how the player takes the updates
+		if (player->hasUDPEndpoint)
+		{
+			player->rateLevel = 0;
+			player->healthyChecks = 0;
+			continue;
+		}
+		
+		struct tcp_info info;
+		socklen_t infoLength = sizeof(info);
+		
+		if (getsockopt(player->sockfd, IPPROTO_TCP, TCP_INFO, &info, &infoLength) == -1)
+		{
+			continue;
+		}
+		
+		uint32_t newRetrans = info.tcpi_total_retrans - player->lastTotalRetrans;
+		player->lastTotalRetrans = info.tcpi_total_retrans;
+		
+		// Output still queued on our side means the player could not take the last updates either
+		bool struggling = info.tcpi_rtt > RATE_RTT_HIGH_USEC || newRetrans > RATE_RETRANS_HIGH || info.tcpi_unacked > RATE_UNACKED_HIGH || player->sendLength > 0;
+		bool healthy = info.tcpi_rtt < RATE_RTT_LOW_USEC && newRetrans == 0 && info.tcpi_unacked <= RATE_UNACKED_HIGH / 4 && player->sendLength == 0;
+		
+		int oldLevel = player->rateLevel;
+		
+		if (struggling)
+		{
+			player->healthyChecks = 0;
+			if (player->rateLevel < RATE_LEVELS - 1) player->rateLevel++;
+		}
+		else if (healthy)
+		{
+			// Only give more updates back after the connection has been healthy for a while
+			player->healthyChecks++;
+			if (player->healthyChecks >= RATE_RECOVERY_CHECKS && player->rateLevel > 0)
+			{
+				player->rateLevel--;
+				player->healthyChecks = 0;
+			}
+		}
+		else
+		{
+			player->healthyChecks = 0;
+		}
+		
+		if (player->rateLevel != oldLevel && isVerboseLogging())
+		{
+			fprintf(stdout, "Player %d map update rate level %d (rtt %u us, %u retransmits, %u unacked)\n", i, player->rateLevel, info.tcpi_rtt, newRetrans, info.tcpi_unacked);
+		}
+	}
+}
+
+
+int32_t GameServer::findRoot(int32_t* parent, int32_t playerID)
+{
+	while (parent[playerID] != playerID)
+	{
+		// Path halving keeps the trees flat
+		parent[playerID] = parent[parent[playerID]];
+		playerID = parent[playerID];
+	}
+	
+	return playerID;
+}
+
+
+void GameServer::uniteNodes(int32_t* parent, int32_t playerID1, int32_t playerID2)
+{
+	int32_t root1 = findRoot(parent, playerID1);
+	int32_t root2 = findRoot(parent, playerID2);
+	
+	// The lowest ID is the root, so the result does not depend on the order of the unions
+	if (root1 < root2) parent[root2] = root1;
+	else if (root2 < root1) parent[root1] = root2;
+}
+
+
+void GameServer::resolveAnnihilations()
+{
+	TRACE_SCOPE(&tracer, "annihilations");
+	
+	// Players that asked to self-annihilate since the last tick, in ID order, and the world each of them saw
+	int32_t initiators[PLAYER_LIMIT];
+	int numInitiators = 0;
+	
+	bool isInitiator[CLUSTER_NODE_LIMIT];
+	const TickSnapshot* worlds[PLAYER_LIMIT];
+	
+	// Robots reached by chain reactions that started in neighbouring regions
+	bool isDetonated[PLAYER_LIMIT];
+	int numDetonated = 0;
+	
+	for (int32_t i = 0; i < CLUSTER_NODE_LIMIT; i++)
+	{
+		isInitiator[i] = false;
+	}
+	
+	for (int32_t i = 0; i < PLAYER_LIMIT; i++)
+	{
+		worlds[i] = NULL;
+		isDetonated[i] = false;
+	}
+	
+	for (int32_t i = activePlayers.first(); i != -1; i = activePlayers.next(i))
+	{
+		if (players[i].hasRemoteDetonation)
+		{
+			players[i].hasRemoteDetonation = false;
+			
+			if (alivePlayers.contains(i) && !players[i].hasPendingAnnihilation)
+			{
+				isDetonated[i] = true;
+				numDetonated++;
+			}
+		}
+		
+		if (!players[i].hasPendingAnnihilation) continue;
+		
+		players[i].hasPendingAnnihilation = false;
+		
+		if (!alivePlayers.contains(i)) continue;
+		
+		if (players[i].hasAnnihilationTick)
+		{
+			worlds[i] = findRewindSnapshot(i, players[i].pendingAnnihilationTick);
+		}
+		
+		isInitiator[i] = true;
+		initiators[numInitiators] = i;
+		numInitiators++;
+	}
+	
+	if (numInitiators == 0 && numDetonated == 0) return;
+	
+	// In cluster mode, the robots of neighbouring regions near the border take part in the chain reactions too
+	// Their past positions are not known, so they are at their latest reported position in every world
+	numGhostNodes = 0;
+	
+	for (int region = 0; region < CLUSTER_REGION_LIMIT; region++)
+	{
+		for (int k = 0; k < boundaries[region].numRobots; k++)
+		{
+			ghostNodeRegion[numGhostNodes] = region;
+			ghostNodeIndex[numGhostNodes] = k;
+			numGhostNodes++;
+		}
+	}
+	
+	int numNodes = PLAYER_LIMIT + numGhostNodes;
+	
+	// All results are sent as one batch of ANNIHILATION_RESULTS frames
+	// Each frame: 4 bytes num bytes, 1 byte version, 1 byte code, 4 bytes initiator ID, 2 bytes number of kills, 4 bytes per kill
+	uint8_t* message = annihilationMessage;
+	int messageSize = 0;
+	
+	int32_t killedPlayers[CLUSTER_NODE_LIMIT];
+	bool isResolved[PLAYER_LIMIT];
+	
+	for (int k = 0; k < numInitiators; k++)
+	{
+		isResolved[k] = false;
+	}
+	
+	// Initiators that saw the same world are resolved together, starting with the one with the lowest ID
+	// Chain reactions from neighbouring regions are resolved in the present world, after its initiators (k == numInitiators)
+	bool isPresentResolved = false;
+	
+	for (int k = 0; k <= numInitiators; k++)
+	{
+		const TickSnapshot* world = NULL;
+		
+		if (k < numInitiators)
+		{
+			if (isResolved[k]) continue;
+			
+			world = worlds[initiators[k]];
+		}
+		else if (numDetonated == 0 || isPresentResolved)
+		{
+			continue;
+		}
+		
+		if (world == NULL) isPresentResolved = true;
+		
+		// The robots that can take part in this world's chain reactions:
+		// the initiators that saw this world, the robots still alive (that were already on the map in that world)
+		// and the robots of neighbouring regions near the border
+		bool isInWorld[CLUSTER_NODE_LIMIT];
+		int32_t parent[CLUSTER_NODE_LIMIT];
+		
+		for (int32_t i = 0; i < numNodes; i++)
+		{
+			parent[i] = i;
+			
+			if (i >= PLAYER_LIMIT)
+			{
+				int ghost = i - PLAYER_LIMIT;
+				isInWorld[i] = boundaries[ghostNodeRegion[ghost]].robots[ghostNodeIndex[ghost]].id != -1;
+			}
+			else if (isInitiator[i])
+			{
+				isInWorld[i] = worlds[i] == world;
+			}
+			else
+			{
+				isInWorld[i] = alivePlayers.contains(i) && (world == NULL || world->alive[i]);
+			}
+		}
+		
+		// Robots within the explosion radius of each other are in the same component
+		// A chain reaction started anywhere in a component reaches the whole component
+		for (int32_t i = 0; i < numNodes; i++)
+		{
+			if (!isInWorld[i]) continue;
+			
+			int32_t next = i + 1;
+			
+			// In the present world, the robots of this region that can be in range are the neighbours in the proximity graph
+			// Past worlds and the robots of neighbouring regions are not in the graph, so they are measured against every node
+			if (world == NULL && i < PLAYER_LIMIT)
+			{
+				const SlotBitset<PLAYER_LIMIT>* neighbours = proximity.getNeighbours(i);
+				
+				for (int32_t j = neighbours->next(i); j != -1; j = neighbours->next(j))
+				{
+					if (isInWorld[j] && getDistance(i, j, world) <= EXPLOSION_RADIUS) uniteNodes(parent, i, j);
+				}
+				
+				next = PLAYER_LIMIT;
+			}
+			
+			for (int32_t j = next; j < numNodes; j++)
+			{
+				if (isInWorld[j] && getDistance(i, j, world) <= EXPLOSION_RADIUS) uniteNodes(parent, i, j);
+			}
+		}
+		
+		// Components already credited to an initiator
+		bool isClaimed[CLUSTER_NODE_LIMIT];
+		
+		for (int32_t i = 0; i < numNodes; i++)
+		{
+			isClaimed[i] = false;
+		}
+		
+		for (int m = k; m < numInitiators; m++)
+		{
+			int32_t playerID = initiators[m];
+			
+			if (worlds[playerID] != world) continue;
+			
+			isResolved[m] = true;
+			
+			int32_t root = findRoot(parent, playerID);
+			int numKills = 0;
+			int numLocalKills = 0;
+			
+			// The whole component is destroyed, and the kills go to its initiator with the lowest ID
+			// Other initiators in the component destroyed their own robot and are not counted as kills
+			if (!isClaimed[root])
+			{
+				isClaimed[root] = true;
+				numKills = destroyComponent(parent, isInWorld, isInitiator, numNodes, root, players[playerID].globalID, killedPlayers, &numLocalKills);
+			}
+			
+			if (isVerboseLogging())
+			{
+				fprintf(stdout, "Player %d: %d player(s) killed\n", playerID, numKills);
+				
+				for (int j = 0; j < numKills; j++)
+				{
+					fprintf(stdout, "Player %d killed\n", killedPlayers[j]);
+				}
+			}
+			
+			// Update the player's score
+			// Robots of neighbouring regions are credited by their own region once it destroys them
+			players[playerID].score += numLocalKills;
+			
+			messageSize += writeAnnihilationResult(message + messageSize, players[playerID].globalID, numKills, killedPlayers);
+		}
+		
+		if (world != NULL) continue;
+		
+		// The robots reached from a neighbouring region set off the rest of their component on this side
+		// unless an initiator of this region already destroyed it
+		for (int32_t i = 0; i < PLAYER_LIMIT; i++)
+		{
+			if (!isDetonated[i]) continue;
+			
+			int32_t root = findRoot(parent, i);
+			
+			if (isClaimed[root]) continue;
+			
+			isClaimed[root] = true;
+			
+			int32_t initiatorID = players[i].remoteInitiatorID;
+			int numLocalKills = 0;
+			int numKills = destroyComponent(parent, isInWorld, isInitiator, numNodes, root, initiatorID, killedPlayers, &numLocalKills);
+			
+			if (isVerboseLogging()) fprintf(stdout, "Player %d of another region: %d player(s) killed in this region\n", initiatorID, numKills);
+			
+			// The initiator is in another region (or was handed off here in the meantime)
+			int32_t initiatorSlot = findPlayerSlot(initiatorID);
+			
+			if (initiatorSlot != -1)
+			{
+				players[initiatorSlot].score += numLocalKills;
+			}
+			else
+			{
+				int32_t credit[2] = { initiatorID, numLocalKills };
+				
+				for (int region = 0; region < cluster.getRegionCount(); region++)
+				{
+					cluster.sendMessage(region, LINK_CREDIT, credit, sizeof(credit), -1);
+				}
+			}
+			
+			messageSize += writeAnnihilationResult(message + messageSize, initiatorID, numKills, killedPlayers);
+		}
+	}
+	
+	// Every initiator explodes, whatever the others do
+	// They stay in the proximity graph until now, so the chain reactions they start can follow their edges
+	for (int k = 0; k < numInitiators; k++)
+	{
+		removeRobot(initiators[k]);
+	}
+	
+	// Broadcast the self destructions to all players
+	broadcastAnnihilationResults(message, messageSize);
+}
+
+
+int GameServer::destroyComponent(int32_t* parent, bool* isInWorld, bool* isInitiator, int numNodes, int32_t root, int32_t initiatorID, int32_t* killedPlayers, int* numLocalKills)
+{
+	int numKills = 0;
+	*numLocalKills = 0;
+	
+	// Robots of each neighbouring region in the component
+	// LINK_DETONATE: 4 bytes initiator ID, 4 bytes number of robots, 4 bytes per robot ID
+	int32_t detonations[CLUSTER_REGION_LIMIT][2 + PLAYER_LIMIT];
+	
+	for (int region = 0; region < CLUSTER_REGION_LIMIT; region++)
+	{
+		detonations[region][0] = initiatorID;
+		detonations[region][1] = 0;
+	}
+	
+	for (int32_t i = 0; i < numNodes; i++)
+	{
+		if (!isInWorld[i] || isInitiator[i] || findRoot(parent, i) != root) continue;
+		
+		if (i < PLAYER_LIMIT)
+		{
+			killedPlayers[numKills] = players[i].globalID;
+			removeRobot(i);
+			(*numLocalKills)++;
+		}
+		else
+		{
+			// The robot is gone for the players of this region right away, and its region destroys it at its next tick
+			int ghost = i - PLAYER_LIMIT;
+			int region = ghostNodeRegion[ghost];
+			BoundaryRobot* robot = &boundaries[region].robots[ghostNodeIndex[ghost]];
+			
+			killedPlayers[numKills] = robot->id;
+			detonations[region][2 + detonations[region][1]] = robot->id;
+			detonations[region][1]++;
+			robot->id = -1;
+			isMapShrunk = true;
+		}
+		
+		numKills++;
+	}
+	
+	for (int region = 0; region < CLUSTER_REGION_LIMIT; region++)
+	{
+		if (detonations[region][1] == 0) continue;
+		
+		if (cluster.sendMessage(region, LINK_DETONATE, detonations[region], (2 + detonations[region][1]) * sizeof(int32_t), -1) == -1)
+		{
+			fprintf(stderr, "Failed to send a chain reaction to region %d\n", region);
+		}
+	}
+	
+	return numKills;
+}
+
+
+void GameServer::recordPositionHistory()
+{
+	TRACE_SCOPE(&tracer, "position history");
+	
+	TickSnapshot* snapshot = &positionHistory[tickNumber % HISTORY_TICKS];
+	
+	snapshot->tick = tickNumber;
+	
+	for (int32_t i = 0; i < PLAYER_LIMIT; i++)
+	{
+		snapshot->x[i] = players[i].x;
+		snapshot->y[i] = players[i].y;
+		snapshot->z[i] = players[i].z;
+		snapshot->alive[i] = alivePlayers.contains(i);
+	}
+}
+
+
+const TickSnapshot* GameServer::findRewindSnapshot(int32_t playerID, uint32_t tick)
+{
+	// A tick from the future is treated as the present
+	if (tick >= tickNumber) return NULL;
+	
+	// Never rewind further than the configured window
+	if (tickNumber - tick > (uint32_t)config.maxRewindTicks)
+	{
+		tick = tickNumber - config.maxRewindTicks;
+	}
+	
+	const TickSnapshot* snapshot = &positionHistory[tick % HISTORY_TICKS];
+	
+	// The slot may not have been written yet (or was overwritten)
+	if (snapshot->tick != tick) return NULL;
+	
+	// If the exploding robot was spawned after that tick, the player saw the present world
+	if (!snapshot->alive[playerID]) return NULL;
+	
+	return snapshot;
+}
+
+
+int GameServer::writeAnnihilationResult(uint8_t* message, int32_t playerID, int numKills, int32_t* killedPlayers)
+{
+	// Preparing the message
+	// 4 bytes num bytes in message
+	// 1 byte version number
+	// 1 byte message code
+	// 4 bytes ID of player exploded
+	// 2 bytes for number of players killed
+	// 4 bytes ID of each player killed
+	int messageSize = 12 + numKills * 4;
+	
+	uint32_t convertedBytes = htonl(messageSize);
+	int32_t convertedID = htonl(playerID);
+	int16_t convertedNumKills = htons((int16_t)numKills);
+	
+	message[0] = GET_BYTE_3(convertedBytes);
+	message[1] = GET_BYTE_2(convertedBytes);
+	message[2] = GET_BYTE_1(convertedBytes);
+	message[3] = GET_BYTE_0(convertedBytes);
+	message[4] = VERSION_NUM;
+	message[5] = ANNIHILATION_RESULTS;
+	message[6] = GET_BYTE_3(convertedID); 			// third byte: byte 3 of ID
+	message[7] = GET_BYTE_2(convertedID); 			// 4th byte: byte 2 of ID
+	message[8] = GET_BYTE_1(convertedID);			// 5th byte: byte 1 of ID
+	message[9] = GET_BYTE_0(convertedID);			// 6th byte: byte 0  of ID 
+	message[10] = GET_BYTE_1(convertedNumKills);	// 7th byte: byte 1 of numKills
+	message[11] = GET_BYTE_0(convertedNumKills);	// 8th byte: byte 0 of numKills
+	
+	// Note: although the player's ID is 32 bits,
+	// only 16 bits are used to store the number of players killed
+	// Hence the maximum num of players killed is smaller than maximum number of players
+	// However, since the protocol specifies that 16 bits are used, I'll go with it
+	
+	int index = 12;
+	
+	// Load the IDs of players killed
+	for (int i = 0; i < numKills; i++)
+	{
+		convertedID = htonl(killedPlayers[i]);
+		
+		message[index] = GET_BYTE_3(convertedID); 		// Byte 3 of ID
+		message[index + 1] = GET_BYTE_2(convertedID); 	// Byte 2 of ID
+		message[index + 2] = GET_BYTE_1(convertedID); 	// Byte 1 of ID
+		message[index + 3] = GET_BYTE_0(convertedID);	// Byte 0 of ID
+		
+		// Move the index to the next 4 bytes block
+		index += 4;
+	}
+	
+	return messageSize;
+}
+
+
+int GameServer::broadcastAnnihilationResults(const uint8_t* message, int messageSize)
+{
+	int numSent = 0;
+	
+	// Since all sockets get the same message,
+	// A single common message buffer is used instead of individual player's buffer
+	
+	// Iterate through each active player and send the message
+	// Whatever the socket cannot take right away is queued
+	for (int32_t i = activePlayers.first(); i != -1; i = activePlayers.next(i))
+	{
+		if (sendToPlayer(i, message, messageSize) == 0) numSent++;
+	}
+	
+	return numSent;
+}
+
+
+float GameServer::getDistance(int32_t playerID1, int32_t playerID2, const TickSnapshot* world)
+{
+	float x1, y1, z1;
+	float x2, y2, z2;
+	
+	getPosition(playerID1, world, &x1, &y1, &z1);
+	getPosition(playerID2, world, &x2, &y2, &z2);
+	
+	float x = fabs(x1 - x2);
+	float y = fabs(y1 - y2);
+	float z = fabs(z1 - z2);
+	
+	return sqrt(x * x + y * y + z * z);
+}
+
+
+int32_t GameServer::countNeighbours(int32_t playerID)
+{
+	const SlotBitset<PLAYER_LIMIT>* neighbours = proximity.getNeighbours(playerID);
+	int32_t numNeighbours = 0;
+	
+	for (int32_t j = neighbours->first(); j != -1; j = neighbours->next(j))
+	{
+		if (getDistance(playerID, j, NULL) <= EXPLOSION_RADIUS) numNeighbours++;
+	}
+	
+	return numNeighbours;
+}
+
+
+void GameServer::getPosition(int32_t playerID, const TickSnapshot* world, float* x, float* y, float* z)
+{
+	if (playerID >= PLAYER_LIMIT)
+	{
+		int ghost = playerID - PLAYER_LIMIT;
+		const BoundaryRobot* robot = &boundaries[ghostNodeRegion[ghost]].robots[ghostNodeIndex[ghost]];
+		
+		*x = robot->x;
+		*y = robot->y;
+		*z = robot->z;
+	}
+	else if (world != NULL)
+	{
+		*x = world->x[playerID];
+		*y = world->y[playerID];
+		*z = world->z[playerID];
+	}
+	else
+	{
+		*x = players[playerID].x;
+		*y = players[playerID].y;
+		*z = players[playerID].z;
+	}
+}
+
+
+int GameServer::broadcastNewSpawn(int32_t playerID)
+{
+	TRACE_SCOPE(&tracer, "spawn broadcast");
+	
+	int numSent = 0;
+	
+	// Since all sockets get the same message,
+	// A single common message buffer is used instead of individual player's buffer
+	
+	// Preparing the broadcast message
+	// 4 bytes number of bytes in message
+	// 1 byte version number
+	// 1 byte message code
+	// 4 bytes ID of player spawned
+	// 4 bytes x coordinate of player spawned
+	// 4 bytes y coordinate of player spawned
+	// 4 bytes z coordinate of player spawned
+	int messageSize = 22;
+	
+	uint32_t binaryX;
+	uint32_t binaryY;
+	uint32_t binaryZ;
+	
+	// Copy the binary bits in the float coordinates into uint32_t variables
+	// This must be done instead of casting because
+	// casting the float values to uint32_t is equivalent to rounding
+	memcpy(&binaryX, &players[playerID].x, sizeof(float));
+	memcpy(&binaryY, &players[playerID].y, sizeof(float));
+	memcpy(&binaryZ, &players[playerID].z, sizeof(float));
+	
+	uint8_t* message = new uint8_t[messageSize];
+	uint32_t convertedBytes = htonl(messageSize);
+	int32_t convertedID = htonl(players[playerID].globalID);
+	uint32_t convertedX = htonl(binaryX);
+	uint32_t convertedY = htonl(binaryY);
+	uint32_t convertedZ = htonl(binaryZ);
+	
+	message[0] = GET_BYTE_3(convertedBytes);
+	message[1] = GET_BYTE_2(convertedBytes);
+	message[2] = GET_BYTE_1(convertedBytes);
+	message[3] = GET_BYTE_0(convertedBytes);
+	message[4] = VERSION_NUM;
+	message[5] = PLAYER_SPAWN_WITH_ID;
+	message[6] = GET_BYTE_3(convertedID); 	// third byte: byte 3 of ID
+	message[7] = GET_BYTE_2(convertedID); 	// 4th byte: byte 2 of ID
+	message[8] = GET_BYTE_1(convertedID);	// 5th byte: byte 1 of ID
+	message[9] = GET_BYTE_0(convertedID); 	// 6th byte: byte 0  of ID 
+	message[10] = GET_BYTE_3(convertedX); 	// byte 3 of x coordinate
+	message[11] = GET_BYTE_2(convertedX);	// byte 2 of x coordinate
+	message[12] = GET_BYTE_1(convertedX); 	// byte 1 of x coordinate
+	message[13] = GET_BYTE_0(convertedX); 	// byte 0 of x coordinate
+	message[14] = GET_BYTE_3(convertedY); 	// byte 3 of y coordinate
+	message[15] = GET_BYTE_2(convertedY); 	// byte 2 of y coordinate
+	message[16] = GET_BYTE_1(convertedY);	// byte 1 of y coordinate
+	message[17] = GET_BYTE_0(convertedY);	// byte 0 of y coordinate
+	message[18] = GET_BYTE_3(convertedZ); 	// byte 3 of z coordinate
+	message[19] = GET_BYTE_2(convertedZ); 	// byte 2 of z coordinate
+	message[20] = GET_BYTE_1(convertedZ); 	// byte 1 of z coordinate
+	message[21] = GET_BYTE_0(convertedZ);	// byte 0 of z coordinate
+	
+	// Iterate through each active player and send the message
+	for (int32_t i = activePlayers.first(); i != -1; i = activePlayers.next(i))
+	{
+		// If the player is not the player spawned
+		// Whatever the socket cannot take right away is queued
+		if (i != playerID)
+		{
+			if (sendToPlayer(i, message, messageSize) == 0)
+			{
+				if (isVerboseLogging()) fprintf(stdout, "New spawn broadcast sent to player %d\n", i);
+				numSent++;
+			}
+		}
+	}
+	
+	// Clear the buffer
+	delete[] message;
+	
+	return numSent;
+}
+
+
+int GameServer::compressFrame(const uint8_t* frame, int frameSize, uint8_t* compressedFrame)
+{
+	// 4 bytes num bytes, 1 byte version, 1 byte code, 1 byte codec, 4 bytes size of the original frame
+	const int headerSize = 11;
+	
+	if (frameSize <= headerSize) return 0;
+	
+	// Compression is only worth it if the result is smaller than the original frame
+	uint8_t* message = compressedFrame;
+	
+	uint32_t dataSize = compressor.compress(CODEC_LZ_BYTE_PLANES, frame, frameSize, message + headerSize, frameSize - headerSize);
+	
+	if (dataSize == 0) return 0;
+	
+	int messageSize = headerSize + dataSize;
+	
+	uint32_t convertedBytes = htonl(messageSize);
+	uint32_t convertedOriginalBytes = htonl(frameSize);
+	
+	message[0] = GET_BYTE_3(convertedBytes);
+	message[1] = GET_BYTE_2(convertedBytes);
+	message[2] = GET_BYTE_1(convertedBytes);
+	message[3] = GET_BYTE_0(convertedBytes);
+	message[4] = VERSION_NUM;
+	message[5] = SERVER_COMPRESSED_FRAME;
+	message[6] = CODEC_LZ_BYTE_PLANES;
+	message[7] = GET_BYTE_3(convertedOriginalBytes);
+	message[8] = GET_BYTE_2(convertedOriginalBytes);
+	message[9] = GET_BYTE_1(convertedOriginalBytes);
+	message[10] = GET_BYTE_0(convertedOriginalBytes);
+	
+	return messageSize;
+}
+
+
+void GameServer::publishWorldSnapshot()
+{
+	TRACE_SCOPE(&tracer, "world snapshot");
+	
+	WorldView* view = worldSnapshot.begin();
+	
+	view->tick = tickNumber;
+	view->timeMillisec = getMonotonicMillisec();
+	view->numPlayers = 0;
+	
+	for (int32_t i = activePlayers.first(); i != -1; i = activePlayers.next(i))
+	{
+		// Relays are not part of the game
+		if (players[i].isRelay) continue;
+		
+		PlayerView* player = &view->players[view->numPlayers];
+		
+		player->id = players[i].globalID;
+		player->x = players[i].x;
+		player->y = players[i].y;
+		player->z = players[i].z;
+		player->score = players[i].score;
+		player->isAlive = alivePlayers.contains(i);
+		player->numNeighbours = player->isAlive ? countNeighbours(i) : 0;
+		player->movesReceived = players[i].movesReceived;
+		player->movesCoalesced = players[i].movesCoalesced;
+		player->ticksAtMoveLimit = players[i].ticksAtMoveLimit;
+		
+		view->numPlayers++;
+	}
+	
+	worldSnapshot.publish();
+}
+
+
+const WorldSnapshot* GameServer::getWorldSnapshot()
+{
+	return &worldSnapshot;
+}
+
+
+int GameServer::broadcastMapUpdate()
+{
+	// The worker takes one update at a time, and updates go out in order
+	if (isMapUpdatePending)
+	{
+		collectMapUpdate();
+	}
+	
+	if (prepareMapUpdate(&mapUpdate) == -1) return 0;
+	
+	// With pipelined map updates, the loop goes on with the next tick while the worker encodes this one
+	// The loop sends it over TCP when the worker signals that it is done (see collectMapUpdate)
+	if (broadcastWorker.isEnabled())
+	{
+		isMapUpdatePending = true;
+		broadcastWorker.submit(encodeMapUpdateJob, this);
+		return 0;
+	}
+	
+	encodeMapUpdate(&mapUpdate);
+	
+	return deliverMapUpdate(&mapUpdate);
+}
+
+
+int GameServer::prepareMapUpdate(MapUpdate* update)
+{	
+	TRACE_SCOPE(&tracer, "map update");
+	
+	// Since all sockets get the same message,
+	// A single common message buffer is used instead of individual player's buffer
+	
+	// Preparing the broadcast message
+	// 4 bytes of num bytes in message
+	// 1 byte version number
+	// 1 byte message code
+	// 2 bytes number of players alive on map
+	// 4 bytes ID of each alive player
+	// 4 bytes x coordinate of each alive player
+	// 4 bytes y coordinate of each alive player
+	// 4 bytes z coordinate of each alive player
+	
+	// When map update detail is shed, the players that negotiated partial updates only get the robots that moved
+	// since the last update, in a frame of its own, while the other players still get full updates
+	// Everyone gets a full update every KEYFRAME_TICKS ticks so clients can resynchronize,
+	// and in a tick after a robot left the map, since a partial update cannot tell that a robot is gone
+	bool hasPartial = false;
+	
+	if (overload.getShedLevel() >= SHED_MAP_DETAIL && keyframeCountdown > 0 && !isMapShrunk)
+	{
+		hasPartial = true;
+		keyframeCountdown--;
+	}
+	else
+	{
+		keyframeCountdown = KEYFRAME_TICKS;
+	}
+	
+	isMapShrunk = false;
+	
+	int numMoved = 0;
+	
+	for (int k = 0; k < numMapRecords; k++)
+	{
+		if (players[mapRecordOwners[k]].movedSinceUpdate) numMoved++;
+	}
+	
+	// In cluster mode, players also see the robots of neighbouring regions near the border
+	// Their movement is not tracked here, so they are always included
+	int numBoundaryRobots = countBoundaryRobots();
+	int numRobots = numMapRecords + numBoundaryRobots;
+	
+	int messageSize = 8 + MAP_RECORD_SIZE * numRobots;
+	
+	// The update and its variants are built in pool buffers, which zerocopy sends keep referenced after the update is delivered
+	// The plain frame is built here, from the world at this tick, so nothing the loop does afterwards changes the update
+	int messageBuffer = broadcastPool.acquire(messageSize);
+	int sequencedBuffer = broadcastPool.acquire(messageSize + 4);
+	
+	if (messageBuffer == -1 || sequencedBuffer == -1)
+	{
+		fprintf(stderr, "No broadcast buffer available for the map update\n");
+		if (messageBuffer != -1) broadcastPool.release(messageBuffer);
+		if (sequencedBuffer != -1) broadcastPool.release(sequencedBuffer);
+		return -1;
+	}
+	
+	uint8_t* message = broadcastPool.getData(messageBuffer);
+	uint32_t convertedBytes = htonl(messageSize);
+	uint16_t convertedNumPlayers = htons((uint16_t)numRobots);
+	
+	message[0] = GET_BYTE_3(convertedBytes);
+	message[1] = GET_BYTE_2(convertedBytes);
+	message[2] = GET_BYTE_1(convertedBytes);
+	message[3] = GET_BYTE_0(convertedBytes);
+	message[4] = VERSION_NUM;
+	message[5] = SERVER_MAP_UPDATE;
+	message[6] = GET_BYTE_1(convertedNumPlayers); 	// byte 1 of number of robots
+	message[7] = GET_BYTE_0(convertedNumPlayers); 	// byte 0 of number of robots
+	
+	// Note: although the player's ID is 32 bits,
+	// only 16 bits are used to store the number of players on map
+	// Hence the maximum num of players allowed on map is smaller than maximum number of players
+	// However, since the protocol specifies that 16 bits are used, I'll go with it
+	
+	int index = 8;
+	
+	// The records of the robots on the map are kept serialized (see placeRobot), so a full update copies them in one go
+	memcpy(message + index, mapRecords, numMapRecords * MAP_RECORD_SIZE);
+	index += numMapRecords * MAP_RECORD_SIZE;
+	
+	for (int region = 0; region < CLUSTER_REGION_LIMIT && numBoundaryRobots > 0; region++)
+	{
+		for (int k = 0; k < boundaries[region].numRobots; k++)
+		{
+			const BoundaryRobot* robot = &boundaries[region].robots[k];
+			
+			if (robot->id == -1) continue;
+			
+			uint32_t binaryX;
+			uint32_t binaryY;
+			uint32_t binaryZ;
+			
+			memcpy(&binaryX, &robot->x, sizeof(float));
+			memcpy(&binaryY, &robot->y, sizeof(float));
+			memcpy(&binaryZ, &robot->z, sizeof(float));
+			
+			int32_t convertedID = htonl(robot->id);
+			uint32_t convertedX = htonl(binaryX);
+			uint32_t convertedY = htonl(binaryY);
+			uint32_t convertedZ = htonl(binaryZ);
+			
+			message[index] = GET_BYTE_3(convertedID);
+			message[index + 1] = GET_BYTE_2(convertedID);
+			message[index + 2] = GET_BYTE_1(convertedID);
+			message[index + 3] = GET_BYTE_0(convertedID);
+			message[index + 4] = GET_BYTE_3(convertedX);
+			message[index + 5] = GET_BYTE_2(convertedX);
+			message[index + 6] = GET_BYTE_1(convertedX);
+			message[index + 7] = GET_BYTE_0(convertedX);
+			message[index + 8] = GET_BYTE_3(convertedY);
+			message[index + 9] = GET_BYTE_2(convertedY);
+			message[index + 10] = GET_BYTE_1(convertedY);
+			message[index + 11] = GET_BYTE_0(convertedY);
+			message[index + 12] = GET_BYTE_3(convertedZ);
+			message[index + 13] = GET_BYTE_2(convertedZ);
+			message[index + 14] = GET_BYTE_1(convertedZ);
+			message[index + 15] = GET_BYTE_0(convertedZ);
+			
+			index += 16;
+		}
+	}
+	
+	update->tick = tickNumber;
+	update->previousTick = lastMapUpdateTick;
+	lastMapUpdateTick = tickNumber;
+	update->buffers[MAP_FRAME_PLAIN] = messageBuffer;
+	update->buffers[MAP_FRAME_SEQUENCED] = sequencedBuffer;
+	update->frames[MAP_FRAME_PLAIN] = message;
+	update->frames[MAP_FRAME_SEQUENCED] = broadcastPool.getData(sequencedBuffer);
+	update->sizes[MAP_FRAME_PLAIN] = messageSize;
+	update->sizes[MAP_FRAME_SEQUENCED] = messageSize + 4;
+	update->buffers[MAP_FRAME_PARTIAL] = -1;
+	update->frames[MAP_FRAME_PARTIAL] = NULL;
+	update->sizes[MAP_FRAME_PARTIAL] = 0;
+	update->numDatagrams = 0;
+	update->datagramsSent.clear();
+	update->numSent = 0;
+	
+	// Find out which compressed frames the players due for this update need, and take the addresses of the datagrams
+	// Large frames are compressed once per tick and shared by all players
+	bool needsCompressed[MAP_FRAME_VARIANTS] = { false };
+	bool needsPartial = false;
+	
+	for (int32_t i = activePlayers.first(); i != -1; i = activePlayers.next(i))
+	{
+		// Players at a lower rate level skip ticks
+		// The player ID staggers them so their updates are spread over different ticks
+		uint32_t rateDivisor = 1 << players[i].rateLevel;
+		if ((update->tick + i) % rateDivisor != 0) continue;
+		
+		if (hasPartial && canTakePartialUpdate(update, i))
+		{
+			needsPartial = true;
+			continue;
+		}
+		
+		bool useCompression = (players[i].options & OPTION_COMPRESSION) != 0;
+		bool useSequenced = players[i].hasUDPEndpoint || (players[i].options & OPTION_TICK_STAMPS);
+		
+		int frame = useSequenced ? MAP_FRAME_SEQUENCED : MAP_FRAME_PLAIN;
+		
+		if (useCompression && update->sizes[frame] >= config.compressionThreshold)
+		{
+			needsCompressed[useSequenced ? MAP_FRAME_COMPRESSED_SEQUENCED : MAP_FRAME_COMPRESSED] = true;
+		}
+		
+		if (players[i].hasUDPEndpoint)
+		{
+			int k = update->numDatagrams;
+			
+			update->datagramPlayers[k] = i;
+			update->datagramCompression[k] = useCompression;
+			update->datagramAddrs[k] = players[i].udpAddr;
+			update->datagramAddrlens[k] = players[i].udpAddrlen;
+			update->numDatagrams++;
+		}
+	}
+	
+	// A compressed frame without a buffer is simply not used
+	for (int frame = MAP_FRAME_COMPRESSED; frame <= MAP_FRAME_COMPRESSED_SEQUENCED; frame++)
+	{
+		int original = (frame == MAP_FRAME_COMPRESSED) ? MAP_FRAME_PLAIN : MAP_FRAME_SEQUENCED;
+		
+		update->buffers[frame] = needsCompressed[frame] ? broadcastPool.acquire(update->sizes[original]) : -1;
+		update->frames[frame] = (update->buffers[frame] != -1) ? broadcastPool.getData(update->buffers[frame]) : NULL;
+		update->sizes[frame] = 0;
+	}
+	
+	// The partial frame: 4 bytes num bytes, 1 byte version, 1 byte code, 4 bytes tick, 2 bytes number of robots,
+	// then the records of the robots that moved and of the robots of neighbouring regions, as in a full update
+	// Without a buffer for it, the players get the full update
+	int partialSize = 12 + MAP_RECORD_SIZE * (numMoved + numBoundaryRobots);
+	
+	if (needsPartial)
+	{
+		update->buffers[MAP_FRAME_PARTIAL] = broadcastPool.acquire(partialSize);
+	}
+	
+	if (update->buffers[MAP_FRAME_PARTIAL] != -1)
+	{
+		uint8_t* partial = broadcastPool.getData(update->buffers[MAP_FRAME_PARTIAL]);
+		uint32_t convertedPartialBytes = htonl(partialSize);
+		uint32_t convertedTick = htonl(update->tick);
+		uint16_t convertedNumMoved = htons((uint16_t)(numMoved + numBoundaryRobots));
+		
+		partial[0] = GET_BYTE_3(convertedPartialBytes);
+		partial[1] = GET_BYTE_2(convertedPartialBytes);
+		partial[2] = GET_BYTE_1(convertedPartialBytes);
+		partial[3] = GET_BYTE_0(convertedPartialBytes);
+		partial[4] = VERSION_NUM;
+		partial[5] = SERVER_MAP_UPDATE_PARTIAL;
+		partial[6] = GET_BYTE_3(convertedTick);
+		partial[7] = GET_BYTE_2(convertedTick);
+		partial[8] = GET_BYTE_1(convertedTick);
+		partial[9] = GET_BYTE_0(convertedTick);
+		partial[10] = GET_BYTE_1(convertedNumMoved);
+		partial[11] = GET_BYTE_0(convertedNumMoved);
+		
+		int partialIndex = 12;
+		
+		for (int k = 0; k < numMapRecords; k++)
+		{
+			if (!players[mapRecordOwners[k]].movedSinceUpdate) continue;
+			
+			memcpy(partial + partialIndex, mapRecords + k * MAP_RECORD_SIZE, MAP_RECORD_SIZE);
+			partialIndex += MAP_RECORD_SIZE;
+		}
+		
+		// The boundary robots follow the local records in the full update
+		memcpy(partial + partialIndex, message + 8 + numMapRecords * MAP_RECORD_SIZE, numBoundaryRobots * MAP_RECORD_SIZE);
+		
+		update->frames[MAP_FRAME_PARTIAL] = partial;
+		update->sizes[MAP_FRAME_PARTIAL] = partialSize;
+	}
+	
+	// The next update only has to carry the robots that move from now on
+	for (int k = 0; k < numMapRecords; k++)
+	{
+		players[mapRecordOwners[k]].movedSinceUpdate = false;
+	}
+	
+	return 0;
+}
+
+
+bool GameServer::canTakePartialUpdate(const MapUpdate* update, int32_t playerID)
+{
+	Player* player = &players[playerID];
+	
+	// The partial update only holds the moves since the previous update, so a player that missed it
+	// (at a lower rate level, with output still queued, or just joined) needs a full one
+	// Datagrams can be lost, and a lost partial update would lose moves until the next full update
+	return (player->options & OPTION_PARTIAL_UPDATES) && !player->hasUDPEndpoint && update->previousTick != 0 && player->lastMapUpdateTick == update->previousTick;
+}
+
+
+void GameServer::encodeMapUpdate(MapUpdate* update)
+{
+	TRACE_SCOPE(&tracer, "map update encoding");
+	
+	// The sequenced variant carries the tick number as a sequence number
+	// It is sent as a datagram to players with a UDP endpoint, so they can discard datagrams that arrive late or out of order
+	// and over TCP to players that asked for tick stamps, so they can tell the server which tick they saw
+	// 4 bytes num bytes, 1 byte version, 1 byte code, 4 bytes sequence, then the same body
+	int messageSize = update->sizes[MAP_FRAME_PLAIN];
+	int sequencedSize = update->sizes[MAP_FRAME_SEQUENCED];
+	const uint8_t* message = update->frames[MAP_FRAME_PLAIN];
+	uint8_t* sequenced = update->frames[MAP_FRAME_SEQUENCED];
+	
+	uint32_t convertedSequencedBytes = htonl(sequencedSize);
+	uint32_t convertedSequence = htonl(update->tick);
+	
+	sequenced[0] = GET_BYTE_3(convertedSequencedBytes);
+	sequenced[1] = GET_BYTE_2(convertedSequencedBytes);
+	sequenced[2] = GET_BYTE_1(convertedSequencedBytes);
+	sequenced[3] = GET_BYTE_0(convertedSequencedBytes);
+	sequenced[4] = VERSION_NUM;
+	sequenced[5] = SERVER_MAP_UPDATE_SEQUENCED;
+	sequenced[6] = GET_BYTE_3(convertedSequence);
+	sequenced[7] = GET_BYTE_2(convertedSequence);
+	sequenced[8] = GET_BYTE_1(convertedSequence);
+	sequenced[9] = GET_BYTE_0(convertedSequence);
+	memcpy(sequenced + 10, message + 6, messageSize - 6);
+	
+	// Compressed copies of the update and of the sequenced variant
+	if (update->buffers[MAP_FRAME_COMPRESSED] != -1)
+	{
+		update->sizes[MAP_FRAME_COMPRESSED] = compressFrame(message, messageSize, update->frames[MAP_FRAME_COMPRESSED]);
+	}
+	if (update->buffers[MAP_FRAME_COMPRESSED_SEQUENCED] != -1)
+	{
+		update->sizes[MAP_FRAME_COMPRESSED_SEQUENCED] = compressFrame(sequenced, sequencedSize, update->frames[MAP_FRAME_COMPRESSED_SEQUENCED]);
+	}
+	
+	// Players with a UDP endpoint get the update as a datagram
+	// A lost datagram is simply superseded by the next tick's update
+	// An update that does not fit in a datagram goes over TCP instead (still sequenced)
+	for (int k = 0; k < update->numDatagrams; k++)
+	{
+		int frame = selectMapUpdateFrame(update, true, update->datagramCompression[k]);
+		
+		if (update->sizes[frame] > UDP_MAX_DATAGRAM) continue;
+		
+		ssize_t bytes = sendto(udpSockfd, update->frames[frame], update->sizes[frame], 0, (struct sockaddr*)&update->datagramAddrs[k], update->datagramAddrlens[k]);
+		
+		if (bytes == update->sizes[frame]) update->numSent++;
+		update->datagramsSent.add(update->datagramPlayers[k]);
+	}
+}
+
+
+int GameServer::selectMapUpdateFrame(const MapUpdate* update, bool useSequenced, bool useCompression)
+{
+	int frame = useSequenced ? MAP_FRAME_SEQUENCED : MAP_FRAME_PLAIN;
+	int compressed = useSequenced ? MAP_FRAME_COMPRESSED_SEQUENCED : MAP_FRAME_COMPRESSED;
+	
+	// Large updates are compressed for the players that negotiated it, if compression made them smaller
+	if (useCompression && update->sizes[frame] >= config.compressionThreshold && update->sizes[compressed] > 0)
+	{
+		return compressed;
+	}
+	
+	return frame;
+}
+
+
+int GameServer::deliverMapUpdate(MapUpdate* update)
+{
+	TRACE_SCOPE(&tracer, "map update delivery");
+	
+	int numSent = update->numSent;
+	
+	// Iterate through each active player and send the message
+	// Players handed off by another region since the tick get the update as well, it is the latest one there is
+	// (a joining player is only made active once the pending update is delivered, see acceptPlayers)
+	for (int32_t i = activePlayers.first(); i != -1; i = activePlayers.next(i))
 	{
-		// If the player is active
-		if (players[i].sockfd != 0)
+		uint32_t rateDivisor = 1 << players[i].rateLevel;
+		if ((update->tick + i) % rateDivisor != 0) continue;
+		
+		if (update->datagramsSent.contains(i)) continue;
+		
+		// Players with a UDP endpoint or tick stamps get the sequenced variant
+		bool useCompression = (players[i].options & OPTION_COMPRESSION) != 0;
+		bool useSequenced = players[i].hasUDPEndpoint || (players[i].options & OPTION_TICK_STAMPS);
+		
+		int frame = selectMapUpdateFrame(update, useSequenced, useCompression);
+		
+		if (update->buffers[MAP_FRAME_PARTIAL] != -1 && canTakePartialUpdate(update, i))
 		{
-			ssize_t bytes = -1;
-	
-			// If the socket is ready for writing
-			if (FD_ISSET(players[i].sockfd, &writeSet))
-			{
-				bytes = send(players[i].sockfd, message, messageSize, 0);
-			}
-			
-			// If an error occurs (bytes is -1 or the wrong number of bytes sent)
-			// Retry at most 3 times
-			int count = 3;
-			while (bytes != messageSize && count > 0)
+			frame = MAP_FRAME_PARTIAL;
+		}
+		
+		// A player that still has output queued skips this update
+		// The next update supersedes it, so queueing it would only add delay
+		if (players[i].sendLength == 0)
+		{
+			if (sendBroadcastToPlayer(i, update->buffers[frame], update->sizes[frame]) == 0)
 			{
-				bytes = send(players[i].sockfd, message, messageSize, 0);
-				count--;
+				players[i].lastMapUpdateTick = update->tick;
+				numSent++;
 			}
-			
-			// If the message is sent successfully
-			if (bytes == messageSize) numSent++;
-			
-			// More sophisticated error handling is obviously needed
 		}
 	}
 	
-	// Clear the buffer
-	delete[] message;
+	// Give back the update's references
+	// Buffers still used by zerocopy sends return to the pool when the kernel completes them
+	for (int frame = 0; frame < MAP_FRAME_VARIANTS; frame++)
+	{
+		if (update->buffers[frame] != -1) broadcastPool.release(update->buffers[frame]);
+	}
 	
 	return numSent;
 }
 
 
-float GameServer::getDistance(int32_t playerID1, int32_t playerID2)
+void GameServer::collectMapUpdate()
 {
-	float x = abs(players[playerID1].x - players[playerID2].x);
-	float y = abs(players[playerID1].y - players[playerID2].y);
-	float z = abs(players[playerID1].z - players[playerID2].z);
+	// The worker is usually done by the time this is called, the wait shows in the trace when it is not
+	uint64_t waitStart = TickTracer::now();
+	broadcastWorker.wait();
+	tracer.record("map update wait", waitStart, TickTracer::now());
 	
-	return sqrt(x * x + y * y + z * z);
+	isMapUpdatePending = false;
+	
+	deliverMapUpdate(&mapUpdate);
 }
 
 
-int GameServer::broadcastNewSpawn(int32_t playerID)
+void GameServer::encodeMapUpdateJob(void* context)
 {
-	int numSent = 0;
-	
-	// Since all sockets get the same message,
-	// A single common message buffer is used instead of individual player's buffer
-	
-	// Preparing the broadcast message
-	// 4 bytes number of bytes in message
-	// 1 byte version number
-	// 1 byte message code
-	// 4 bytes ID of player spawned
-	// 4 bytes x coordinate of player spawned
-	// 4 bytes y coordinate of player spawned
-	// 4 bytes z coordinate of player spawned
-	int messageSize = 22;
-	
-	uint32_t binaryX;
-	uint32_t binaryY;
-	uint32_t binaryZ;
+	GameServer* server = (GameServer*)context;
 	
-	// Copy the binary bits in the float coordinates into uint32_t variables
-	// This must be done instead of casting because
-	// casting the float values to uint32_t is equivalent to rounding
-	memcpy(&binaryX, &players[playerID].x, sizeof(float));
-	memcpy(&binaryY, &players[playerID].y, sizeof(float));
-	memcpy(&binaryZ, &players[playerID].z, sizeof(float));
-	
-	uint8_t* message = new uint8_t[messageSize];
-	uint32_t convertedBytes = htonl(messageSize);
-	int32_t convertedID = htonl(playerID);
-	uint32_t convertedX = htonl(binaryX);
-	uint32_t convertedY = htonl(binaryY);
-	uint32_t convertedZ = htonl(binaryZ);
+	server->encodeMapUpdate(&server->mapUpdate);
+}
+
+
+/*
+ * Cluster mode
+ */
+
+void GameServer::processRegionMessages(int region)
+{
+	TRACE_SCOPE(&tracer, "region messages");
 	
-	message[0] = GET_BYTE_3(convertedBytes);
-	message[1] = GET_BYTE_2(convertedBytes);
-	message[2] = GET_BYTE_1(convertedBytes);
-	message[3] = GET_BYTE_0(convertedBytes);
-	message[4] = VERSION_NUM;
-	message[5] = PLAYER_SPAWN_WITH_ID;
-	message[6] = GET_BYTE_3(convertedID); 	// third byte: byte 3 of ID
-	message[7] = GET_BYTE_2(convertedID); 	// 4th byte: byte 2 of ID
-	message[8] = GET_BYTE_1(convertedID);	// 5th byte: byte 1 of ID
-	message[9] = GET_BYTE_0(convertedID); 	// 6th byte: byte 0  of ID 
-	message[10] = GET_BYTE_3(convertedX); 	// byte 3 of x coordinate
-	message[11] = GET_BYTE_2(convertedX);	// byte 2 of x coordinate
-	message[12] = GET_BYTE_1(convertedX); 	// byte 1 of x coordinate
-	message[13] = GET_BYTE_0(convertedX); 	// byte 0 of x coordinate
-	message[14] = GET_BYTE_3(convertedY); 	// byte 3 of y coordinate
-	message[15] = GET_BYTE_2(convertedY); 	// byte 2 of y coordinate
-	message[16] = GET_BYTE_1(convertedY);	// byte 1 of y coordinate
-	message[17] = GET_BYTE_0(convertedY);	// byte 0 of y coordinate
-	message[18] = GET_BYTE_3(convertedZ); 	// byte 3 of z coordinate
-	message[19] = GET_BYTE_2(convertedZ); 	// byte 2 of z coordinate
-	message[20] = GET_BYTE_1(convertedZ); 	// byte 1 of z coordinate
-	message[21] = GET_BYTE_0(convertedZ);	// byte 0 of z coordinate
+	uint8_t message[LINK_MESSAGE_MAX];
 	
-	// Iterate through each player and send the message
-	for (int i = 0; i < PLAYER_LIMIT; i++)
+	while (true)
 	{
-		// If the player is active and not the player spawned
-		if (players[i].sockfd != 0 && i != playerID)
+		int sockfd;
+		int numBytes = cluster.receiveMessage(region, message, sizeof(message), &sockfd);
+		
+		// The region stopped: forget its robots until it is linked again
+		if (numBytes == -1)
 		{
-			ssize_t bytes = -1;
-	
-			// If the socket is ready for writing
-			if (FD_ISSET(players[i].sockfd, &writeSet))
+			if (boundaries[region].numRobots > 0) isMapShrunk = true;
+			
+			boundaries[region].numRobots = 0;
+			boundaries[region].freeSlots = 0;
+			return;
+		}
+		
+		if (numBytes == 0) return;
+		
+		const uint8_t* payload = message + LINK_HEADER_SIZE;
+		uint32_t payloadSize = numBytes - LINK_HEADER_SIZE;
+		
+		int32_t header[2];
+		if (payloadSize >= sizeof(header)) memcpy(header, payload, sizeof(header));
+		
+		switch (message[0])
+		{
+			case LINK_BOUNDARY:
+			{
+				// 4 bytes free player slots, 4 bytes number of robots, then the robots
+				if (payloadSize < sizeof(header) || header[1] < 0 || header[1] > PLAYER_LIMIT || payloadSize != sizeof(header) + header[1] * sizeof(BoundaryRobot))
+				{
+					fprintf(stderr, "Invalid boundary report from region %d\n", region);
+					break;
+				}
+				
+				BoundaryRobot reported[PLAYER_LIMIT];
+				memcpy(reported, payload + sizeof(header), header[1] * sizeof(BoundaryRobot));
+				
+				// A robot of the last report that is missing from this one left the border area (or died),
+				// which only a full map update can tell the players
+				for (int k = 0; k < boundaries[region].numRobots && !isMapShrunk; k++)
+				{
+					int32_t robotID = boundaries[region].robots[k].id;
+					
+					if (robotID == -1) continue;
+					
+					bool isReported = false;
+					
+					for (int m = 0; m < header[1] && !isReported; m++)
+					{
+						if (reported[m].id == robotID) isReported = true;
+					}
+					
+					if (!isReported) isMapShrunk = true;
+				}
+				
+				boundaries[region].freeSlots = header[0];
+				boundaries[region].numRobots = header[1];
+				memcpy(boundaries[region].robots, reported, header[1] * sizeof(BoundaryRobot));
+				break;
+			}
+			case LINK_DETONATE:
 			{
-				bytes = send(players[i].sockfd, message, messageSize, 0);
+				// 4 bytes initiator ID, 4 bytes number of robots, 4 bytes per robot ID
+				if (payloadSize < sizeof(header) || header[1] < 0 || header[1] > PLAYER_LIMIT || payloadSize != (2 + header[1]) * sizeof(int32_t))
+				{
+					fprintf(stderr, "Invalid chain reaction from region %d\n", region);
+					break;
+				}
+				
+				// The robots are destroyed at the next tick, those that died or left in the meantime are skipped
+				for (int k = 0; k < header[1]; k++)
+				{
+					int32_t robotID;
+					memcpy(&robotID, payload + (2 + k) * sizeof(int32_t), sizeof(robotID));
+					
+					int32_t playerID = findPlayerSlot(robotID);
+					
+					if (playerID != -1 && alivePlayers.contains(playerID))
+					{
+						players[playerID].hasRemoteDetonation = true;
+						players[playerID].remoteInitiatorID = header[0];
+					}
+				}
+				break;
 			}
-			
-			// If an error occurs (bytes is -1 or the wrong number of bytes sent)
-			// Retry at most 3 times
-			int count = 3;
-			while (bytes != messageSize && count > 0)
+			case LINK_CREDIT:
 			{
-				bytes = send(players[i].sockfd, message, messageSize, 0);
-				count--;
+				// 4 bytes initiator ID, 4 bytes number of kills
+				if (payloadSize != sizeof(header)) break;
+				
+				int32_t playerID = findPlayerSlot(header[0]);
+				
+				if (playerID != -1) players[playerID].score += header[1];
+				break;
 			}
-			
-			// If the message is sent successfully
-			if (bytes == messageSize)
+			case LINK_HANDOFF:
 			{
-				fprintf(stdout, "New spawn broadcast sent to player %d\n", i);
-				numSent++;
+				if (payloadSize != sizeof(PlayerHandoff) || sockfd == -1)
+				{
+					fprintf(stderr, "Invalid player handoff from region %d\n", region);
+					break;
+				}
+				
+				PlayerHandoff state;
+				memcpy(&state, payload, sizeof(state));
+				
+				acceptHandoff(region, &state, sockfd);
+				sockfd = -1;
+				break;
 			}
-			
-			// More sophisticated error handling is obviously needed
+			default:
+				break;
 		}
+		
+		// A socket that came with any other message is not used
+		if (sockfd != -1) close(sockfd);
 	}
-	
-	// Clear the buffer
-	delete[] message;
-	
-	return numSent;
 }
 
 
-int GameServer::broadcastMapUpdate()
-{	
-	int numSent = 0;
+void GameServer::acceptHandoff(int region, const PlayerHandoff* state, int sockfd)
+{
+	int32_t i = activePlayers.firstFree();
 	
-	// Since all sockets get the same message,
-	// A single common message buffer is used instead of individual player's buffer
+	// The region only hands off players while this server reports free slots, but they may have been taken since
+	if (i == -1 || sockfd >= FD_SETSIZE)
+	{
+		fprintf(stderr, "No player slot for player %d handed off by region %d, closing connection\n", state->id, region);
+		close(sockfd);
+		return;
+	}
 	
-	// Preparing the broadcast message
-	// 4 bytes of num bytes in message
-	// 1 byte version number
-	// 1 byte message code
-	// 2 bytes number of players alive on map
-	// 4 bytes ID of each alive player
-	// 4 bytes x coordinate of each alive player
-	// 4 bytes y coordinate of each alive player
-	// 4 bytes z coordinate of each alive player
-	int messageSize = 8 + 16 * numAlivePlayers;
+	// The socket options set when the player joined came along with the socket
+	initializePlayer(i, sockfd);
 	
-	uint8_t* message = new uint8_t[messageSize];
-	uint32_t convertedBytes = htonl(messageSize);
-	uint16_t convertedNumPlayers = htons((uint16_t)numAlivePlayers);
+	Player* player = &players[i];
 	
-	message[0] = GET_BYTE_3(convertedBytes);
-	message[1] = GET_BYTE_2(convertedBytes);
-	message[2] = GET_BYTE_1(convertedBytes);
-	message[3] = GET_BYTE_0(convertedBytes);
-	message[4] = VERSION_NUM;
-	message[5] = SERVER_MAP_UPDATE;
-	message[6] = GET_BYTE_1(convertedNumPlayers); 	// byte 1 of numAlivePlayers
-	message[7] = GET_BYTE_0(convertedNumPlayers); 	// byte 0 of numAlivePlayers
+	player->addrlen = sizeof(player->addr);
+	getpeername(sockfd, &player->addr, &player->addrlen);
 	
-	// Note: although the player's ID is 32 bits,
-	// only 16 bits are used to store the number of players on map
-	// Hence the maximum num of players allowed on map is smaller than maximum number of players
-	// However, since the protocol specifies that 16 bits are used, I'll go with it
+	player->globalID = state->id;
+	player->x = state->x;
+	player->y = state->y;
+	player->z = state->z;
+	player->movedSinceUpdate = true;
+	player->score = state->score;
+	player->options = state->options;
+	player->rateLevel = state->rateLevel;
+	player->healthyChecks = state->healthyChecks;
+	player->lastTotalRetrans = state->lastTotalRetrans;
+	player->zeroCopy = state->zeroCopy;
+	player->zeroCopyNextID = state->zeroCopyNextID;
+	player->isLocal = state->isLocal;
 	
-	int index = 8;
+	placeRobot(i);
 	
-	// Load info of each alive player into message
-	for (int32_t i = 0; i < PLAYER_LIMIT; i++)
-	{	
-		// If player is active and alive
-		if (players[i].sockfd != 0 && players[i].isAlive)
-		{	
-			uint32_t binaryX;
-			uint32_t binaryY;
-			uint32_t binaryZ;
+	// The robot is no longer a robot of the region that handed it off
+	for (int k = 0; k < boundaries[region].numRobots; k++)
+	{
+		if (boundaries[region].robots[k].id == state->id) boundaries[region].robots[k].id = -1;
+	}
+	
+	if (isVerboseLogging()) fprintf(stdout, "Player %d (ID %d) handed off by region %d at {%.2f, %.2f, %.2f}\n", i, state->id, region, player->x, player->y, player->z);
+	
+	// The join response was sent by the region the player joined
+	playerSession(i, false);
+}
+
+
+void GameServer::handOffPlayers()
+{
+	TRACE_SCOPE(&tracer, "handoff");
+	
+	for (int32_t i = alivePlayers.first(); i != -1; i = alivePlayers.next(i))
+	{
+		Player* player = &players[i];
+		
+		if (player->isClosing) continue;
+		
+		int region = cluster.getRegionAt(player->x);
+		
+		if (region == cluster.getRegionIndex()) continue;
+		
+		// Only a connection between frames with nothing in flight can move, so no byte of the stream is lost
+		// Otherwise the player is tried again at the next tick
+		if (player->recvLength > 0 || player->sendLength > 0 || player->zeroCopyPending > 0) continue;
+		
+		if (boundaries[region].freeSlots <= 0) continue;
+		
+		PlayerHandoff state;
+		memset(&state, 0, sizeof(state));
+		
+		state.id = player->globalID;
+		state.x = player->x;
+		state.y = player->y;
+		state.z = player->z;
+		state.score = player->score;
+		state.options = player->options;
+		state.rateLevel = player->rateLevel;
+		state.healthyChecks = player->healthyChecks;
+		state.lastTotalRetrans = player->lastTotalRetrans;
+		state.zeroCopy = player->zeroCopy;
+		state.zeroCopyNextID = player->zeroCopyNextID;
+		state.isLocal = player->isLocal;
+		
+		if (cluster.sendMessage(region, LINK_HANDOFF, &state, sizeof(state), player->sockfd) == -1) continue;
+		
+		boundaries[region].freeSlots--;
+		
+		if (isVerboseLogging()) fprintf(stdout, "Player %d (ID %d) handed off to region %d\n", i, player->globalID, region);
+		
+		// The region has its own descriptor of the socket now, closing this one leaves the connection open
+		// The UDP endpoint is not handed off: the player gets map updates over TCP until it registers with the new region
+		removePlayer(i);
+	}
+}
+
+
+void GameServer::sendBoundaryRobots()
+{
+	TRACE_SCOPE(&tracer, "boundary robots");
+	
+	// LINK_BOUNDARY: 4 bytes free player slots, 4 bytes number of robots, then the robots
+	uint8_t payload[2 * sizeof(int32_t) + PLAYER_LIMIT * sizeof(BoundaryRobot)];
+	
+	int32_t freeSlots = PLAYER_LIMIT - activePlayers.count();
+	
+	for (int region = 0; region < cluster.getRegionCount(); region++)
+	{
+		if (cluster.getLinkSocket(region) == -1) continue;
+		
+		int32_t numRobots = 0;
+		
+		for (int32_t i = alivePlayers.first(); i != -1; i = alivePlayers.next(i))
+		{
+			// Only robots an explosion on the other side of the border could reach
+			if (cluster.getDistanceToRegion(players[i].x, region) > EXPLOSION_RADIUS) continue;
 			
-			// Copy the binary bits in the float coordinates into uint32_t variables
-			// This must be done instead of casting because
-			// casting the float values to uint32_t is equivalent to rounding
-			memcpy(&binaryX, &players[i].x, sizeof(float));
-			memcpy(&binaryY, &players[i].y, sizeof(float));
-			memcpy(&binaryZ, &players[i].z, sizeof(float));
+			BoundaryRobot robot;
+			robot.id = players[i].globalID;
+			robot.x = players[i].x;
+			robot.y = players[i].y;
+			robot.z = players[i].z;
 			
-			int32_t convertedID = htonl(i);
-			uint32_t convertedX = htonl(binaryX);
-			uint32_t convertedY = htonl(binaryY);
-			uint32_t convertedZ = htonl(binaryZ);	
-			
-			message[index] = GET_BYTE_3(convertedID); 		// third byte: byte 3 of ID
-			message[index + 1] = GET_BYTE_2(convertedID); 	// 4th byte: byte 2 of ID
-			message[index + 2] = GET_BYTE_1(convertedID); 	// 5th byte: byte 1 of ID
-			message[index + 3] = GET_BYTE_0(convertedID);	// 6th byte: byte 0  of ID 
-			message[index + 4] = GET_BYTE_3(convertedX); 	// byte 3 of x coordinate
-			message[index + 5] = GET_BYTE_2(convertedX); 	// byte 2 of x coordinate
-			message[index + 6] = GET_BYTE_1(convertedX);	// byte 1 of x coordinate
-			message[index + 7] = GET_BYTE_0(convertedX); 	// byte 0 of x coordinate
-			message[index + 8] = GET_BYTE_3(convertedY); 	// byte 3 of y coordinate
-			message[index + 9] = GET_BYTE_2(convertedY); 	// byte 2 of y coordinate
-			message[index + 10] = GET_BYTE_1(convertedY); 	// byte 1 of y coordinate
-			message[index + 11] = GET_BYTE_0(convertedY); 	// byte 0 of y coordinate
-			message[index + 12] = GET_BYTE_3(convertedZ); 	// byte 3 of z coordinate
-			message[index + 13] = GET_BYTE_2(convertedZ); 	// byte 2 of z coordinate
-			message[index + 14] = GET_BYTE_1(convertedZ); 	// byte 1 of z coordinate
-			message[index + 15] = GET_BYTE_0(convertedZ); 	// byte 0 of z coordinate 
-			
-			// Move the index to the next 16 bytes block
-			index += 16;
+			memcpy(payload + 2 * sizeof(int32_t) + numRobots * sizeof(BoundaryRobot), &robot, sizeof(robot));
+			numRobots++;
 		}
+		
+		memcpy(payload, &freeSlots, sizeof(freeSlots));
+		memcpy(payload + sizeof(int32_t), &numRobots, sizeof(numRobots));
+		
+		// A report the link cannot take is superseded by the next tick's
+		cluster.sendMessage(region, LINK_BOUNDARY, payload, 2 * sizeof(int32_t) + numRobots * sizeof(BoundaryRobot), -1);
 	}
+}
+
+
+int GameServer::countBoundaryRobots()
+{
+	int numRobots = 0;
 	
-	// Iterate through active each player and send the message
-	for (int i = 0; i < PLAYER_LIMIT; i++)
+	for (int region = 0; region < CLUSTER_REGION_LIMIT; region++)
 	{
-		// If the player is active
-		if (players[i].sockfd)
+		for (int k = 0; k < boundaries[region].numRobots; k++)
 		{
-			ssize_t bytes = -1;
-	
-			// If the socket is ready for writing
-			if (FD_ISSET(players[i].sockfd, &writeSet))
-			{
-				bytes = send(players[i].sockfd, message, messageSize, 0);
-			}
-			
-			// If an error occurs (bytes is -1 or the wrong number of bytes sent)
-			// Retry at most 3 times
-			int count = 3;
-			while (bytes != messageSize && count > 0)
-			{
-				bytes = send(players[i].sockfd, message, messageSize, 0);
-				count--;
-			}
-			
-			// If the message is sent successfully
-			if (bytes == messageSize) numSent++;
-			
-			// More sophisticated error handling is obviously needed
+			if (boundaries[region].robots[k].id != -1) numRobots++;
 		}
 	}
 	
-	// Clear the buffer
-	delete[] message;
+	return numRobots;
+}
+
+
+/*
+ * Awaitable operations on player connections
+ */
+
+GameServer::FrameReadOperation::FrameReadOperation(GameServer* gameServer, int32_t playerID, const uint8_t** frame) : AsyncOperation(&gameServer->scheduler, gameServer->getPlayerWaitSocket(playerID), false)
+{
+	this->gameServer = gameServer;
+	this->playerID = playerID;
+	this->frame = frame;
+	result = 0;
+}
+
+
+bool GameServer::FrameReadOperation::await_ready()
+{
+	result = gameServer->nextPlayerFrame(playerID, frame);
 	
-	return numSent;
+	return result != 0;
+}
+
+
+bool GameServer::FrameReadOperation::isRunnable()
+{
+	return gameServer->players[playerID].hasReadBacklog;
+}
+
+
+bool GameServer::FrameReadOperation::isParked()
+{
+	return gameServer->players[playerID].movesThisTick >= MOVE_INPUT_LIMIT;
+}
+
+
+bool GameServer::FrameReadOperation::attempt()
+{
+	// The scheduler attempts each operation at most once per loop iteration, which starts the player's budget for it
+	gameServer->refillReadBudget(playerID);
+	
+	result = gameServer->nextPlayerFrame(playerID, frame);
+	
+	return result != 0;
+}
+
+
+GameServer::PlayerWriteOperation::PlayerWriteOperation(GameServer* gameServer, int32_t playerID, const uint8_t* message, uint32_t numBytes) : AsyncOperation(&gameServer->scheduler, gameServer->getPlayerWaitSocket(playerID), !gameServer->players[playerID].hasChannel)
+{
+	this->gameServer = gameServer;
+	this->playerID = playerID;
+	this->message = message;
+	this->numBytes = numBytes;
+	result = 0;
+}
+
+
+bool GameServer::PlayerWriteOperation::await_ready()
+{
+	// The message is queued behind any pending output, so it is never interleaved with a broadcast
+	result = gameServer->sendToPlayer(playerID, message, numBytes);
+	
+	return result == -1 || gameServer->players[playerID].sendLength == 0;
+}
+
+
+bool GameServer::PlayerWriteOperation::attempt()
+{
+	Player* player = &gameServer->players[playerID];
+	
+	gameServer->flushPlayerOutput(playerID);
+	
+	if (player->isClosing)
+	{
+		result = -1;
+		return true;
+	}
+	
+	return player->sendLength == 0;
 }
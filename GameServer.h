@@ -27,6 +27,12 @@
 #include <sys/select.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/random.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <signal.h>
+#include <linux/errqueue.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -36,6 +42,21 @@
 #include <math.h>
 #include <ctime>
 
+#include "OverloadController.h"
+#include "FrameCompressor.h"
+#include "BroadcastBufferPool.h"
+#include "TickJitterMonitor.h"
+#include "IOBufferPool.h"
+#include "AsyncScheduler.h"
+#include "RegionCluster.h"
+#include "TickTracer.h"
+#include "SharedMemoryChannel.h"
+#include "SlotBitset.h"
+#include "ProximityGraph.h"
+#include "WorldSnapshot.h"
+#include "AdminSocket.h"
+#include "BroadcastWorker.h"
+
 
 #define VERSION_NUM					1
 
@@ -47,11 +68,64 @@
 #define SERVER_MAP_UPDATE 			5
 #define PLAYER_SPAWN_WITH_ID 		6
 #define ANNIHILATION_RESULTS		7
+#define PLAYER_UDP_REQUEST			8
+#define SERVER_UDP_TOKEN			9
+#define PLAYER_UDP_REGISTER			10
+#define SERVER_UDP_REGISTERED		11
+#define SERVER_MAP_UPDATE_SEQUENCED	12
+#define PLAYER_SET_OPTIONS			13
+#define SERVER_OPTIONS				14
+#define SERVER_COMPRESSED_FRAME		15
+#define PLAYER_RELAY_SUBSCRIBE		16
+#define SERVER_RELAY_SUBSCRIBED		17
+#define PLAYER_SHM_REQUEST			18
+#define SERVER_SHM_GRANTED			19
+#define SERVER_MAP_UPDATE_PARTIAL	20
+
+// Options a player can ask for in PLAYER_SET_OPTIONS
+#define OPTION_COMPRESSION			0x01	// Compress map updates larger than the server's threshold
+#define OPTION_TICK_STAMPS			0x02	// Send map updates over TCP with their tick number (SERVER_MAP_UPDATE_SEQUENCED)
+#define OPTION_PARTIAL_UPDATES		0x04	// Under overload, send only the robots that moved (SERVER_MAP_UPDATE_PARTIAL) over TCP
+#define OPTIONS_SUPPORTED			(OPTION_COMPRESSION | OPTION_TICK_STAMPS | OPTION_PARTIAL_UPDATES)
 
 #define EXPLOSION_RADIUS 			0.25
-#define BUFFER_SIZE 				1024
-#define MAP_UPDATE_MILLISEC			50
+#define PROXIMITY_SKIN				0.05	// Margin of the neighbour lists of the robots, a robot's list is rebuilt when it moves half of it
+#define MAX_FRAME_SIZE				IO_POOL_MAX_SIZE	// Largest frame accepted from a player
+#define SEND_QUEUE_LIMIT			IO_POOL_MAX_SIZE	// Most output queued for a player before it is disconnected
+#define READ_BUFFER_SIZE			4096	// Shared buffer that idle connections are read into
+#define READ_BUDGET_BYTES			16384	// Most bytes received from one player per loop iteration
+#define READ_BUDGET_FRAMES			32		// Most frames processed for one player per loop iteration
+#define MAP_UPDATE_MILLISEC			50		// Default (and fastest) tick interval
+#define MAX_TICK_MILLISEC			200		// Default slowest tick interval under overload
+#define COMPRESSION_THRESHOLD		256		// Default size from which map updates are compressed
+#define HISTORY_TICKS				32		// Ticks of robot positions kept for lag compensation
+#define MAX_REWIND_TICKS			10		// Default furthest an annihilation can be rewound (must be below HISTORY_TICKS)
+#define HEALTH_CHECK_TICKS			20		// Ticks between checks of each player's network health
+#define RATE_LEVELS					3		// Map update rate levels: every tick, every 2nd tick, every 4th tick
+#define RATE_RTT_HIGH_USEC			150000	// Smoothed RTT above which a player gets fewer map updates
+#define RATE_RTT_LOW_USEC			60000	// Smoothed RTT below which a player may get more map updates
+#define RATE_RETRANS_HIGH			2		// Retransmits per health check above which a player gets fewer map updates
+#define RATE_UNACKED_HIGH			16		// Unacknowledged segments above which a player gets fewer map updates
+#define RATE_RECOVERY_CHECKS		3		// Healthy checks in a row before a player gets more map updates
+#define KEYFRAME_TICKS				10		// Ticks between full map updates when map update detail is shed
+#define MAP_RECORD_SIZE				16		// Bytes per robot in a map update: ID, x, y, z
 #define PLAYER_LIMIT				20
+#define CLUSTER_NODE_LIMIT			(PLAYER_LIMIT * CLUSTER_REGION_LIMIT)	// Robots an annihilation can involve: the players, and in cluster mode the robots of neighbouring regions
+#define ANNIHILATION_RESULT_MAX_SIZE	(12 + 4 * CLUSTER_NODE_LIMIT)	// Largest ANNIHILATION_RESULTS frame: every robot killed by one explosion
+#define LISTEN_BACKLOG				SOMAXCONN	// Default listen backlog, large enough for a burst of connections
+#define UDP_MAX_DATAGRAM			1472	// Largest datagram that fits an Ethernet MTU without fragmentation
+#define UDP_READ_LIMIT				64		// Max datagrams read per select wakeup
+#define RELAY_SECRET_MAX			64		// Longest secret a relay can subscribe with
+#define MOVE_INPUT_LIMIT			8	// PLAYER_MOVE frames per tick from a player, after which the player is not read until the next tick
+#define BUSY_POLL_USEC				50		// SO_BUSY_POLL of player sockets in low-latency mode
+#define SPIN_WAIT_MILLISEC			0.2		// In low-latency mode, the loop polls instead of sleeping this long before a tick
+#define TRACE_DUMP_INTERVAL_MILLISEC	10000	// Least time between two traces dumped because ticks ran over budget
+#define ZEROCOPY_PENDING_LIMIT		4		// Max zerocopy sends per player that the kernel has not completed yet
+#define ZEROCOPY_PARK_LIMIT			PLAYER_LIMIT	// Max closed connections kept open until the kernel completes their zerocopy sends
+#define ZEROCOPY_PARK_TIMEOUT_MILLISEC	5000	// TCP_USER_TIMEOUT of a parked connection: the kernel then aborts it, which completes its sends
+
+// A world snapshot (see WorldSnapshot.h) must hold every player
+static_assert(SNAPSHOT_PLAYER_LIMIT >= PLAYER_LIMIT, "SNAPSHOT_PLAYER_LIMIT must be at least PLAYER_LIMIT");
 
 // Macros for extracting bytes
 #define GET_BYTE_3(x)	((x & 0xFF000000) >> 24)
@@ -70,10 +144,6 @@ typedef struct
 	const char* hostName;
 	const char* portNum;
 	
-	// 4kB buffers
-	uint8_t recvBuffer[BUFFER_SIZE];
-	uint8_t sendBuffer[BUFFER_SIZE];
-	
 	struct addrinfo info;
 	struct sockaddr addr;
 	socklen_t addrlen;
@@ -81,33 +151,319 @@ typedef struct
 } TCPHost;
 
 
+// Settings given on the command line
+typedef struct
+{
+	const char* portNum;
+	int backlog;				// Listen backlog of the server socket
+	bool noDelay;				// Set TCP_NODELAY on player sockets
+	int sendBufferSize;			// SO_SNDBUF of player sockets, 0 keeps the system default
+	int recvBufferSize;			// SO_RCVBUF of player sockets, 0 keeps the system default
+	double minTickMillisec;		// Tick interval at normal load
+	double maxTickMillisec;		// Longest tick interval the overload controller may use
+	int compressionThreshold;	// Size from which map updates are compressed, 0 disables compression
+	int maxRewindTicks;			// Furthest back in time an annihilation is evaluated, 0 disables lag compensation
+	int zeroCopyThreshold;		// Size from which map updates are sent with MSG_ZEROCOPY, 0 disables zerocopy
+	bool lowLatency;			// Trade CPU time for steadier ticks (pinning, busy polling, locked memory)
+	int cpuCore;				// Core the loop thread is pinned to in low-latency mode
+	int fifoPriority;			// SCHED_FIFO priority of the loop thread in low-latency mode, 0 keeps the normal scheduler
+	const char* relaySecret;	// Secret spectator relays subscribe with, NULL if relays are not accepted
+	int regionIndex;			// Region of the map this server owns in cluster mode (see RegionCluster.h)
+	int regionCount;			// Number of regions in the cluster, 1 runs the whole map in this server
+	const char* clusterDirectory;	// Directory of the sockets that link the regions of the cluster
+	double traceBudgetMillisec;	// Work per tick above which the tick trace is dumped, 0 only dumps it on SIGUSR1
+	const char* localPath;		// Path of the local (AF_UNIX) socket for clients on the same host, NULL if there is none
+	const char* adminPath;		// Path of the admin socket that serves world snapshots, NULL if there is none
+	bool pipelineMapUpdates;	// Encode map updates and send their datagrams on the broadcast worker thread
+	
+} ServerConfig;
+
+
 typedef struct
 {
 	int sockfd;
 	
-	uint8_t recvBuffer[BUFFER_SIZE];
-	uint8_t sendBuffer[BUFFER_SIZE];
+	// ID the player is known by in messages
+	// The player slot outside cluster mode, otherwise unique in the whole cluster and kept when the player moves to another region
+	int32_t globalID;
+	
+	// Set when the connection failed or fell too far behind
+	// The socket is closed at the end of the current loop iteration
+	bool isClosing;
+	
+	// Partially received frame, taken from the I/O buffer pool only while a frame is incomplete
+	uint8_t* recvBuffer;
+	uint32_t recvCapacity;
+	
+	// Output that the socket could not take yet, sent when the socket becomes writable
+	// Taken from the I/O buffer pool only while output is pending
+	uint8_t* sendBuffer;
+	uint32_t sendCapacity;
+	uint32_t sendLength;
 	
 	struct addrinfo info;
 	struct sockaddr addr;
 	socklen_t addrlen;
 	
+	// Bytes received (recvLength) and bytes already returned as frames (recvOffset)
+	// Without a pooled buffer, they refer to the server's shared read buffer
+	uint32_t recvLength;
+	uint32_t recvOffset;
+	
+	// What is left of the player's read budget in this loop iteration
+	// Set hasReadBacklog when the budget ran out before the socket was drained, so the player is read again at the next iteration
+	uint32_t readBudgetBytes;
+	int32_t readBudgetFrames;
+	bool hasReadBacklog;
+	
 	float x, y, z;
-	bool isAlive;
 	int score;
 	
+	// Index of the robot's record in the server's map records, -1 while the robot is not on the map
+	int mapRecord;
+	
+	// Latest position received this tick
+	// Moves are buffered and applied once per tick (last writer wins)
+	bool hasPendingMove;
+	float pendingX, pendingY, pendingZ;
+	
+	// Set when the position changed since the last map update was built
+	bool movedSinceUpdate;
+	
+	// Tick of the last map update sent (or queued) to the player over TCP, 0 if none
+	// Only a player that got the previous update can take a partial one, which builds on it
+	uint32_t lastMapUpdateTick;
+	
+	// Self-annihilation requested since the last tick, resolved at the next tick
+	// The tick is the one the player saw, if the player told it
+	bool hasPendingAnnihilation;
+	bool hasAnnihilationTick;
+	uint32_t pendingAnnihilationTick;
+	
+	// Set when a chain reaction started in a neighbouring region reached the robot, resolved at the next tick
+	// The kills are credited to the player that started it (remoteInitiatorID)
+	bool hasRemoteDetonation;
+	int32_t remoteInitiatorID;
+	
+	// Input statistics, reported in the world snapshot and when the player disconnects
+	// Coalesced moves were superseded by a later move of the same tick, ticksAtMoveLimit counts the ticks the player sent MOVE_INPUT_LIMIT moves in
+	int32_t movesThisTick;
+	uint32_t movesReceived;
+	uint32_t movesCoalesced;
+	uint32_t ticksAtMoveLimit;
+	
+	// Options granted to the player (OPTION_*)
+	uint8_t options;
+	
+	// Set for a spectator relay, which never plays and gets every broadcast at the full rate
+	bool isRelay;
+	
+	// Set for a connection to the local socket, which is the only one that can switch to a shared memory channel
+	// With the channel, frames go through the server's channel of the player slot and the socket is only watched for closing
+	bool isLocal;
+	bool hasChannel;
+	
+	// Map update rate level, the player gets a map update every (1 << rateLevel) ticks
+	// Adjusted from the health of the player's connection
+	int rateLevel;
+	int healthyChecks;
+	uint32_t lastTotalRetrans;
+	
+	// Optional UDP endpoint for unreliable map updates
+	// The token is issued over TCP and proves that a datagram comes from the player
+	uint32_t udpToken;
+	bool hasUDPEndpoint;
+	struct sockaddr_storage udpAddr;
+	socklen_t udpAddrlen;
+	
+	// MSG_ZEROCOPY sends the kernel may still be reading from
+	// The kernel numbers the zerocopy sends of each socket, the pool buffer of each send is held until its number completes
+	bool zeroCopy;
+	uint32_t zeroCopyNextID;
+	int zeroCopyPending;
+	uint32_t zeroCopyIDs[ZEROCOPY_PENDING_LIMIT];
+	int zeroCopyBuffers[ZEROCOPY_PENDING_LIMIT];
+	
 } Player;
 
+
+// Connection of a removed player, kept open until the kernel completes its zerocopy sends
+// The kernel only reports the completions on the socket, and may read the buffers until then
+typedef struct
+{
+	int sockfd;
+	uint32_t parkedTick;
+	int zeroCopyPending;
+	uint32_t zeroCopyIDs[ZEROCOPY_PENDING_LIMIT];
+	int zeroCopyBuffers[ZEROCOPY_PENDING_LIMIT];
+	
+} ParkedSocket;
+
+
+// What a neighbouring region of the cluster last reported
+typedef struct
+{
+	// Robots of the region near the border, in the order received
+	// The ID of a robot destroyed from this side is set to -1 until the next report
+	BoundaryRobot robots[PLAYER_LIMIT];
+	int numRobots;
+	
+	// Player slots the region had free, a player is only handed off to a region with a free slot
+	int freeSlots;
+	
+} RegionBoundary;
+
+
+// Robot positions of every player slot as sent in one tick
+typedef struct
+{
+	uint32_t tick;
+	float x[PLAYER_LIMIT];
+	float y[PLAYER_LIMIT];
+	float z[PLAYER_LIMIT];
+	bool alive[PLAYER_LIMIT];
+	
+} TickSnapshot;
+
+
+// Frames of a map update, as the players get it
+#define MAP_FRAME_PLAIN				0
+#define MAP_FRAME_SEQUENCED			1
+#define MAP_FRAME_COMPRESSED		2
+#define MAP_FRAME_COMPRESSED_SEQUENCED	3
+#define MAP_FRAME_PARTIAL			4	// Only the robots that moved, for the players that negotiated it, while map detail is shed
+#define MAP_FRAME_VARIANTS			5
+
+// The broadcast pool must hold every buffer zerocopy sends can reference (players and parked connections),
+// and the frames of the map update being built and of the one still pending when map updates are pipelined
+static_assert((PLAYER_LIMIT + ZEROCOPY_PARK_LIMIT) * ZEROCOPY_PENDING_LIMIT + 2 * MAP_FRAME_VARIANTS <= BROADCAST_POOL_SIZE, "BROADCAST_POOL_SIZE is too small for the zerocopy sends in flight");
+
+
+// A map update on its way to the players
+// The loop builds the plain frame from the world at the tick, then the frame is encoded and sent as datagrams
+// (by the broadcast worker when map updates are pipelined), then the loop sends it over TCP
+typedef struct
+{
+	uint32_t tick;
+	
+	// Tick of the map update built before this one, 0 if there was none
+	uint32_t previousTick;
+	
+	// Pool buffer, memory and size of each frame (MAP_FRAME_*)
+	// A compressed frame has no buffer (-1) when no player asked for it, and a size of 0 when compression did not make it smaller
+	// The partial frame has no buffer when map detail is not shed in this tick, or no player can take it
+	int buffers[MAP_FRAME_VARIANTS];
+	uint8_t* frames[MAP_FRAME_VARIANTS];
+	int sizes[MAP_FRAME_VARIANTS];
+	
+	// Players due for the update that have a UDP endpoint, with their address as of the tick
+	int numDatagrams;
+	int32_t datagramPlayers[PLAYER_LIMIT];
+	bool datagramCompression[PLAYER_LIMIT];
+	struct sockaddr_storage datagramAddrs[PLAYER_LIMIT];
+	socklen_t datagramAddrlens[PLAYER_LIMIT];
+	
+	// Players that got the update as a datagram, the others get it over TCP
+	SlotBitset<PLAYER_LIMIT> datagramsSent;
+	int numSent;
+	
+} MapUpdate;
+
+
 class GameServer
 {
 	private:
 		
+		ServerConfig config;
 		TCPHost* server;
+		int udpSockfd;
+		int localSockfd;
 		Player players[PLAYER_LIMIT];
 		struct timeval timeout;
 		int32_t playerLimit;
-		int32_t numActiveSockets;
-		int32_t numAlivePlayers;
+		
+		// Player slots with a connection, with a robot on the map, and with output waiting for the socket to become writable
+		SlotBitset<PLAYER_LIMIT> activePlayers;
+		SlotBitset<PLAYER_LIMIT> alivePlayers;
+		SlotBitset<PLAYER_LIMIT> writingPlayers;
+		
+		// Connections of removed players still waiting for zerocopy completions
+		ParkedSocket parkedSockets[ZEROCOPY_PARK_LIMIT];
+		int numParkedSockets;
+		
+		// Robots on the map that may be within EXPLOSION_RADIUS of each other, kept up to date as robots spawn, move and die
+		ProximityGraph<PLAYER_LIMIT> proximity;
+		
+		uint32_t tickNumber;
+		
+		// Cluster mode: the links to the other regions, and what each of them reported at its last tick
+		RegionCluster cluster;
+		RegionBoundary boundaries[CLUSTER_REGION_LIMIT];
+		int32_t nextJoinSerial;
+		
+		// Robots of neighbouring regions taking part in the annihilations being resolved
+		// Node PLAYER_LIMIT + k of the union-find is robot ghostNodeIndex[k] of region ghostNodeRegion[k]
+		int numGhostNodes;
+		int ghostNodeRegion[PLAYER_LIMIT * (CLUSTER_REGION_LIMIT - 1)];
+		int ghostNodeIndex[PLAYER_LIMIT * (CLUSTER_REGION_LIMIT - 1)];
+		
+		// Batch of ANNIHILATION_RESULTS frames of a tick, one per initiator or chain reaction from a neighbouring region
+		// A robot either initiates or is detonated from a neighbouring region, so there are at most PLAYER_LIMIT frames
+		uint8_t annihilationMessage[PLAYER_LIMIT * ANNIHILATION_RESULT_MAX_SIZE];
+		int keyframeCountdown;
+		
+		// Set when a robot left the map since the last map update, which a partial update cannot tell
+		bool isMapShrunk;
+		
+		// Tick of the last map update built
+		uint32_t lastMapUpdateTick;
+		OverloadController overload;
+		TickJitterMonitor jitter;
+		
+		// Phases of the recent ticks, dumped on SIGUSR1 or when a tick runs over config.traceBudgetMillisec
+		TickTracer tracer;
+		int numTraceDumps;
+		double lastTraceDump;
+		
+		// The players as of the last tick, for readers on other threads (see WorldSnapshot.h), and the socket that serves it to tools
+		WorldSnapshot worldSnapshot;
+		AdminSocket adminSocket;
+		
+		// Map update record (MAP_RECORD_SIZE bytes, as sent) of every robot on the map, packed at the front of the array
+		// A record is only rewritten when its robot spawns, moves or dies, so a map update copies the records as they are
+		// mapRecordOwners holds the player of each record
+		uint8_t mapRecords[PLAYER_LIMIT * MAP_RECORD_SIZE];
+		int32_t mapRecordOwners[PLAYER_LIMIT];
+		int numMapRecords;
+		
+		// Ring buffer of the last HISTORY_TICKS ticks, indexed by tick number
+		TickSnapshot positionHistory[HISTORY_TICKS];
+		
+		FrameCompressor compressor;
+		
+		// Map update of the last tick, finished by the broadcast worker while the loop goes on when map updates are pipelined
+		// The compressor is only used for map updates, so it belongs to the worker while an update is pending
+		MapUpdate mapUpdate;
+		bool isMapUpdatePending;
+		BroadcastBufferPool broadcastPool;
+		IOBufferPool ioPool;
+		
+		// Thread that finishes the map update, declared after everything its job uses so it is stopped before they are destroyed
+		BroadcastWorker broadcastWorker;
+		
+		// Shared memory channel of each player slot, open while the player uses it
+		SharedMemoryChannel channels[PLAYER_LIMIT];
+		
+		// Connections without a partial frame are read into this buffer
+		// Only a frame that is still incomplete after the read is copied to a pooled buffer
+		uint8_t readBuffer[READ_BUFFER_SIZE];
+		
+		// Coroutines of the connections (see AsyncScheduler.h) and the sockets they wait for
+		AsyncScheduler scheduler;
+		
+		// Awaitable operations on player connections, defined after the class
+		class FrameReadOperation;
+		class PlayerWriteOperation;
 		int maxfd;
 		
 		fd_set masterSet;
@@ -121,7 +477,8 @@ class GameServer
 		 */
 		
 		// Get the addrinfo of the server at the specified port number
-		addrinfo* getTCPServerAddrInfo(const char* portNum);
+		// socktype: SOCK_STREAM or SOCK_DGRAM
+		addrinfo* getServerAddrInfo(const char* portNum, int socktype);
 
 		// Create a socket file descriptor for the host address
 		// Return the socket file descriptor or -1 if unsuccessful
@@ -138,58 +495,339 @@ class GameServer
 		// Create a TCP server at the specified port number
 		TCPHost* createTCPServer(const char* portNum, int backlog);
 		
+		// Create a non-blocking UDP socket bound to the specified port number
+		// Return the socket file descriptor or -1 if unsuccessful
+		int createUDPServer(const char* portNum);
+		
+		// Create a non-blocking AF_UNIX stream socket listening at the path
+		// Return the socket file descriptor or -1 if unsuccessful
+		int createLocalServer(const char* path, int backlog);
+		
 		
 		/*
 		 * Game Server utility functions 
 		 */
+		
+		// Get the current time of the monotonic clock in milliseconds
+		double getMonotonicMillisec();
+		
+		// Return false while non-critical logging is shed because the server is overloaded
+		bool isVerboseLogging();
+		
+		// Write the tick trace to tick-trace-<pid>-<n>.json in the working directory
+		// reason: why the trace is dumped, for the log
+		void dumpTrace(const char* reason);
+		
+		// Pin the calling (loop) thread, switch it to SCHED_FIFO if configured, and lock the process (current and future pages) in memory
+		// Each step that fails is reported and skipped
+		void setupLowLatencyMode();
 		  
-		// Send a join response to player when they first join the server
+		// Apply the configured socket options to a newly accepted player socket
+		// A local socket only gets the buffer sizes
+		// Return true if zerocopy sends are enabled on the socket
+		bool setPlayerSocketOptions(int sockfd, bool isLocal);
+		
+		// Socket (or event) the player's coroutine waits on: the player socket, or the server's event of the player's channel
+		int getPlayerWaitSocket(int32_t playerID);
+		
+		// recv() and send() on the player's connection, through the channel if the player has one
+		ssize_t receiveFromPlayer(int32_t playerID, uint8_t* buffer, uint32_t capacity);
+		ssize_t sendRawToPlayer(int32_t playerID, const uint8_t* message, uint32_t numBytes);
+		
+		// Queue a message for the player and send as much as the socket accepts without blocking
+		// The rest is sent when the socket becomes writable
+		// Return 0 on success, -1 if the message does not fit (the player is then disconnected)
+		int sendToPlayer(int32_t playerID, const uint8_t* message, uint32_t numBytes);
+		
+		// Send a frame held in a broadcast pool buffer to the player
+		// Large enough frames are sent with MSG_ZEROCOPY, the buffer is then referenced until the kernel completes the send
+		// Return 0 on success, -1 if there's error
+		int sendBroadcastToPlayer(int32_t playerID, int buffer, uint32_t numBytes);
+		
+		// Read zerocopy completions from the player socket's error queue and release the buffers the kernel is done with
+		void processZeroCopyCompletions(int32_t playerID);
+		
+		// Read zerocopy completions from the socket's error queue and release the buffers of the pending sends they cover
+		// The completed sends are removed from ids and buffers
+		// Return true if the kernel reported that it copied the data instead
+		bool releaseZeroCopyCompletions(int sockfd, int* numPending, uint32_t* ids, int* buffers);
+		
+		// Keep the connection of a player being removed open until its zerocopy sends complete
+		void parkSocket(int32_t playerID);
+		
+		// Close the parked connections whose zerocopy sends completed
+		void processParkedSockets();
+		
+		// Close a parked connection at once, with a reset, so the kernel drops what it has not sent, and release its buffers
+		void abortParkedSocket(int index);
+		
+		// Send as much of the player's pending output as the socket accepts
+		// Return 0 on success, -1 if the connection failed
+		int flushPlayerOutput(int32_t playerID);
+		
+		// Close the player's connection and free the player slot
+		void removePlayer(int32_t playerID);
+		
+		// Put the player's robot on the map (alivePlayers) and give it a map record, or just rewrite the record if it is already there
+		void placeRobot(int32_t playerID);
+		
+		// Take the player's robot off the map and drop its map record
+		// The last record moves into the freed place, so the live records stay contiguous
+		void removeRobot(int32_t playerID);
+		
+		// Serialize the ID and position of the player's robot into its map record
+		void writeMapRecord(int32_t playerID);
+		
+		// Set up a free player slot for a new connection, with the state of a player that just joined
+		void initializePlayer(int32_t playerID, int sockfd);
+		
+		// Find the slot of the player with the specified global ID
+		// Return -1 if the player is not connected to this server
+		int32_t findPlayerSlot(int32_t globalID);
+		
+		// Write the join response for a player that just joined into message
 		// playerID: ID assigned to the new player
+		// Return the size of the message
+		int writeJoinResponse(uint8_t* message, int32_t playerID);
+		
+		// Tell the player which options were granted and the compression threshold
+		// Return 0 on success, -1 if there's error
+		int sendOptions(int32_t playerID);
+		
+		// Wrap a compressed copy of the frame in a SERVER_COMPRESSED_FRAME message
+		// The new message is written to compressedFrame, which must hold frameSize bytes
+		// Return the size of the new message, or 0 if compression does not make the frame smaller
+		int compressFrame(const uint8_t* frame, int frameSize, uint8_t* compressedFrame);
+		
+		
+		// Issue a UDP token to the player and send it over the player's TCP socket
 		// Return 0 on success, -1 if there's error
-		int sendJoinResponse(int32_t playerID);
+		int sendUDPToken(int32_t playerID);
+		
+		// Confirm over TCP that the player's UDP endpoint has been registered
+		// Return 0 on success, -1 if there's error
+		int sendUDPRegistered(int32_t playerID);
+		
+		// Confirm that the connection has been accepted as a spectator relay
+		// Return 0 on success, -1 if there's error
+		int sendRelaySubscribed(int32_t playerID);
+		
+		// Check the secret of a relay subscription without leaking how much of it matched through timing
+		bool isRelaySecret(const uint8_t* secret, uint32_t length);
+		
+		// Move a local player's frames to a shared memory channel (see SharedMemoryChannel.h)
+		// The grant carries the channel's descriptors, or none (and status 0) if the player keeps using the socket
+		// Return 0 on success, -1 if there's error
+		int grantSharedMemory(int32_t playerID);
+		
+		// Handle activity on the socket of a player that uses a channel: only closing is expected
+		void checkChannelSocket(int32_t playerID);
+		
+		// Read pending datagrams from the UDP socket and register the endpoints they come from
+		void processUDPMessages();
 		
 		// Send map update to a all players
 		// The update contains ID, position, and score of each player
-		// Return number of messages sent successfully
+		// Players with a registered UDP endpoint get it as a sequenced datagram
+		// Players at a lower rate level only get it every few ticks
+		// With pipelined map updates, the update is finished by the broadcast worker and sent over TCP when it is collected
+		// Return number of messages sent successfully (so far)
 		int broadcastMapUpdate();
 		
-		// Announce self-destruct event to all players
-		// The message contains: ID of self-destructed player, and IDs of players taken out
+		// Build the plain frame of the map update from the world at this tick, and plan what the rest of the update needs
+		// Return -1 if there is no broadcast buffer for it
+		int prepareMapUpdate(MapUpdate* update);
+		
+		// Build the sequenced and compressed frames, and send the datagrams
+		// Only reads the update and the compressor, so it can run on the broadcast worker
+		void encodeMapUpdate(MapUpdate* update);
+		
+		// Whether the player gets the partial frame of the update instead of a full one
+		bool canTakePartialUpdate(const MapUpdate* update, int32_t playerID);
+		
+		// Frame of the update a player gets, with or without tick stamps and compression
+		int selectMapUpdateFrame(const MapUpdate* update, bool useSequenced, bool useCompression);
+		
+		// Send the update over TCP to the players that did not get it as a datagram, and give back its buffers
+		// Return number of messages sent successfully, datagrams included
+		int deliverMapUpdate(MapUpdate* update);
+		
+		// Wait for the broadcast worker to finish the pending map update, then deliver it
+		void collectMapUpdate();
+		
+		// Entry point of the broadcast worker
+		static void encodeMapUpdateJob(void* context);
+		
+		// Publish the players as they are at the end of the tick in the world snapshot
+		void publishWorldSnapshot();
+		
+		// Write the ANNIHILATION_RESULTS frame of one self-destruct event into message
+		// The frame contains: ID of self-destructed player, and IDs of players taken out (global IDs, as sent to players)
+		// Return the size of the frame
+		int writeAnnihilationResult(uint8_t* message, int32_t playerID, int numKills, int32_t* killedPlayers);
+		
+		// Send a batch of ANNIHILATION_RESULTS frames to all players
 		// Return number of messages sent successfully
-		int broadcastSelfDestruct(int32_t playerID, int numKills, int32_t* killedPlayers);
+		int broadcastAnnihilationResults(const uint8_t* message, int messageSize);
 		
 		// Announce a new spawn event to all players
 		// The message contains: ID and location of newly spawned player
 		// Return 0 on success, -1 if there's error
 		int broadcastNewSpawn(int32_t playerID);
 		
-		// Accept a new player 
-		// return player's ID on success, -1 if there's error, -2 if no available player slot
-		int32_t acceptNewPlayer();
+		// Coroutine that accepts connections on the listening socket for as long as the server runs
+		// Every pending connection is accepted in one go, and connections beyond the player limit are closed right away
+		// isLocal: the socket is the local (AF_UNIX) one
+		AsyncTask acceptPlayers(int listenfd, bool isLocal);
+		
+		// Coroutine that runs the protocol of one player connection:
+		// send the join response (unless the player was handed off by another region), then read and process frames until the connection closes
+		AsyncTask playerSession(int32_t playerID, bool isJoining);
+		
+		// Return the next complete frame received from the player in frame, without blocking
+		// If no complete frame is buffered, the socket is read until it is drained or the player's read budget runs out
+		// Return the size of the frame, 0 if the rest has not arrived yet or the budget ran out, -1 if the connection is closing
+		int nextPlayerFrame(int32_t playerID, const uint8_t** frame);
+		
+		// Give the player a full read budget for this loop iteration
+		void refillReadBudget(int32_t playerID);
 		
-		// Process a message from the player with the specified ID
+		// Keep the unprocessed bytes of the player (a partial frame) in a pooled buffer large enough for frameBytes
+		// so the shared read buffer can be used by other players
+		// Return 0 on success, -1 if no buffer is available (the player is then disconnected)
+		int stashPartialFrame(int32_t playerID, uint32_t frameBytes);
+		
+		// Process a single complete frame received from the player with the specified ID
 		// Return 0 on success, -1 on error
-		int processPlayerMessage(int32_t playerID);
+		int processPlayerFrame(int32_t playerID, const uint8_t* frame, uint32_t numBytes);
+		
+		// Apply the moves buffered during the last tick and reset the per-tick input limits
+		void applyPendingMoves();
+		
+		// Read TCP_INFO (RTT, retransmits, unacknowledged segments) of each player's socket
+		// and move the player's map update rate level up or down
+		void updatePlayerRateLevels();
+		
+		// Resolve every self-annihilation requested since the last tick in one pass
+		// Robots within EXPLOSION_RADIUS of each other form components (union-find), and a component with an initiator is destroyed
+		// In the present world, the robots of this region are only measured against their neighbours in the proximity graph
+		// The kills of a component go to its initiator with the lowest ID, and all results are broadcast as one batch
+		void resolveAnnihilations();
+		
+		// Find the root of the player's component in the union-find parent array
+		int32_t findRoot(int32_t* parent, int32_t playerID);
+		
+		// Put two nodes in the same component, with the lowest ID as its root
+		void uniteNodes(int32_t* parent, int32_t playerID1, int32_t playerID2);
+		
+		// Destroy the robots in the component of root, except the initiators
+		// The IDs of the robots destroyed are written into killedPlayers, and the robots of neighbouring regions are announced to their region
+		// Return the number of robots destroyed, and the number of them owned by this server in numLocalKills
+		int destroyComponent(int32_t* parent, bool* isInWorld, bool* isInitiator, int numNodes, int32_t root, int32_t initiatorID, int32_t* killedPlayers, int* numLocalKills);
+		
+		
+		/*
+		 * Cluster mode (see RegionCluster.h)
+		 */
 		
-		// Simulate the chain reaction caused by explosion of player specified by playerID
-		// The players killed will be set to not alive
-		// The IDs of killed players are saved to killedPlayers
-		// Index: where to save killed player into killedPlayers array
-		// Return the number of players killed
-		int simRecursiveExplosion(int32_t playerID, int32_t* killedPlayers, int index);
+		// Read and handle the messages pending on the link to the region
+		void processRegionMessages(int region);
+		
+		// Take over a player handed off by the region, with the player's socket
+		void acceptHandoff(int region, const PlayerHandoff* state, int sockfd);
+		
+		// Hand off the players whose robot left this region's slab to the region that owns the new position
+		// Players with a partial frame or output in flight are tried again at the next tick
+		void handOffPlayers();
+		
+		// Send each linked region the robots within EXPLOSION_RADIUS of its slab, and the number of free player slots
+		void sendBoundaryRobots();
+		
+		// Number of robots of neighbouring regions in the last reports that are still alive
+		int countBoundaryRobots();
+		
+		// Save the robot positions of the current tick in the position history
+		void recordPositionHistory();
+		
+		// Find the world the player saw at the specified tick, rewinding at most config.maxRewindTicks
+		// Return NULL if the current world should be used
+		const TickSnapshot* findRewindSnapshot(int32_t playerID, uint32_t tick);
 		
 		// Calculate the distance between 2 players
-		float getDistance(int32_t playerID1, int32_t playerID2);
+		// Players from PLAYER_LIMIT on are robots of neighbouring regions (see ghostNodeRegion), always at their latest reported position
+		// World: past robot positions to use, or NULL for the current positions
+		float getDistance(int32_t playerID1, int32_t playerID2, const TickSnapshot* world);
+		
+		// Number of robots within EXPLOSION_RADIUS of the player's robot now, from the proximity graph
+		int32_t countNeighbours(int32_t playerID);
+		
+		// Get the position of a player (or of a robot of a neighbouring region) in the world
+		void getPosition(int32_t playerID, const TickSnapshot* world, float* x, float* y, float* z);
 		
 		
 	public:
 
-		// Create a game server at the specified port num
-		GameServer(const char* portNum);
+		// Create a game server with the specified settings
+		GameServer(const ServerConfig& config);
 		
 		~GameServer();
 		
 		void run();
+		
+		// The players as of the last tick, can be read from any thread while the server runs
+		const WorldSnapshot* getWorldSnapshot();
+};
+
+// Read the next frame from a player, waiting for it if needed
+// Result: size of the frame (the frame is valid until the next read), or -1 if the connection is closing
+class GameServer::FrameReadOperation : public AsyncOperation
+{
+	private:
+		
+		GameServer* gameServer;
+		int32_t playerID;
+		const uint8_t** frame;
+		int result;
+		
+	public:
+		
+		FrameReadOperation(GameServer* gameServer, int32_t playerID, const uint8_t** frame);
+		
+		// Frames are returned without suspending until the player's read budget for this loop iteration runs out,
+		// so a pipelining client gets its frames processed in one go, but cannot hold the loop
+		bool await_ready();
+		int await_resume() { return result; }
+		
+		// A player whose budget ran out is read again at the next iteration without waiting for select()
+		bool isRunnable();
+		
+		// A player that sent MOVE_INPUT_LIMIT moves this tick is not read again until the next tick
+		bool isParked();
+		
+		bool attempt();
+};
+
+
+// Queue a message for a player and wait until the socket has taken all of the player's output
+// Result: 0 on success, -1 if the connection is closing
+class GameServer::PlayerWriteOperation : public AsyncOperation
+{
+	private:
+		
+		GameServer* gameServer;
+		int32_t playerID;
+		const uint8_t* message;
+		uint32_t numBytes;
+		int result;
+		
+	public:
+		
+		PlayerWriteOperation(GameServer* gameServer, int32_t playerID, const uint8_t* message, uint32_t numBytes);
+		
+		bool await_ready();
+		int await_resume() { return result; }
+		
+		bool attempt();
 };
 
 #endif
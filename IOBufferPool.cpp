@@ -0,0 +1,81 @@
+#include "IOBufferPool.h"
+
+
+IOBufferPool::IOBufferPool()
+{
+	for (int i = 0; i < IO_POOL_CLASSES; i++)
+	{
+		numFree[i] = 0;
+	}
+}
+
+
+IOBufferPool::~IOBufferPool()
+{
+	for (int i = 0; i < IO_POOL_CLASSES; i++)
+	{
+		for (int j = 0; j < numFree[i]; j++)
+		{
+			free(freeBuffers[i][j]);
+		}
+	}
+}
+
+
+int IOBufferPool::getClass(uint32_t numBytes)
+{
+	int sizeClass = 0;
+	uint32_t size = IO_POOL_MIN_SIZE;
+	
+	while (size < numBytes)
+	{
+		size <<= 2;
+		sizeClass++;
+	}
+	
+	return sizeClass;
+}
+
+
+uint8_t* IOBufferPool::acquire(uint32_t numBytes, uint32_t* capacity)
+{
+	if (numBytes > IO_POOL_MAX_SIZE) return NULL;
+	
+	int sizeClass = getClass(numBytes);
+	uint32_t size = IO_POOL_MIN_SIZE << (2 * sizeClass);
+	
+	uint8_t* buffer;
+	
+	if (numFree[sizeClass] > 0)
+	{
+		numFree[sizeClass]--;
+		buffer = freeBuffers[sizeClass][numFree[sizeClass]];
+	}
+	else
+	{
+		buffer = (uint8_t*)malloc(size);
+		
+		if (buffer == NULL) return NULL;
+	}
+	
+	*capacity = size;
+	
+	return buffer;
+}
+
+
+void IOBufferPool::release(uint8_t* buffer, uint32_t capacity)
+{
+	if (buffer == NULL) return;
+	
+	int sizeClass = getClass(capacity);
+	
+	if (numFree[sizeClass] == IO_POOL_FREE_LIMIT)
+	{
+		free(buffer);
+		return;
+	}
+	
+	freeBuffers[sizeClass][numFree[sizeClass]] = buffer;
+	numFree[sizeClass]++;
+}
@@ -0,0 +1,51 @@
+#ifndef IO_BUFFER_POOL_H
+#define IO_BUFFER_POOL_H
+
+
+/********************************************************************************************************************************************
+ * 
+ * The I/O buffer pool lends buffers to connections only while they need one:
+ * a partially received frame, or output the socket could not take yet.
+ * An idle connection holds no buffer at all.
+ * 
+ * Buffers come in size classes (256 bytes, 1 KB, 4 KB, 16 KB, 64 KB), each 4 times the previous one.
+ * A request is served from the smallest class that fits, so a large frame costs a large buffer only while it is in flight.
+ * Released buffers are kept on a free list per class (up to IO_POOL_FREE_LIMIT) and handed out again without allocating.
+ * 
+ *********************************************************************************************************************************************/
+
+
+#include <stdint.h>
+#include <stdlib.h>
+
+
+#define IO_POOL_CLASSES				5		// Number of size classes
+#define IO_POOL_MIN_SIZE			256		// Size of the smallest class
+#define IO_POOL_MAX_SIZE			(IO_POOL_MIN_SIZE << (2 * (IO_POOL_CLASSES - 1)))	// Size of the largest class (64 KB)
+#define IO_POOL_FREE_LIMIT			32		// Free buffers kept per class, the rest is returned to the system
+
+
+class IOBufferPool
+{
+	private:
+		
+		uint8_t* freeBuffers[IO_POOL_CLASSES][IO_POOL_FREE_LIMIT];
+		int numFree[IO_POOL_CLASSES];
+		
+		// Index of the smallest class that holds numBytes
+		int getClass(uint32_t numBytes);
+		
+	public:
+		
+		IOBufferPool();
+		~IOBufferPool();
+		
+		// Take a buffer that holds at least numBytes, its actual size is returned in capacity
+		// Return NULL if numBytes is larger than IO_POOL_MAX_SIZE or the memory cannot be allocated
+		uint8_t* acquire(uint32_t numBytes, uint32_t* capacity);
+		
+		// Give back a buffer returned by acquire, with the capacity it was given
+		void release(uint8_t* buffer, uint32_t capacity);
+};
+
+#endif
@@ -0,0 +1,100 @@
+#include "OverloadController.h"
+
+
+OverloadController::OverloadController(double minIntervalMillisec, double maxIntervalMillisec)
+{
+	minInterval = minIntervalMillisec;
+	maxInterval = (maxIntervalMillisec > minIntervalMillisec) ? maxIntervalMillisec : minIntervalMillisec;
+	interval = minInterval;
+	load = 0;
+	shedLevel = SHED_NONE;
+	ticksUnderLowLoad = 0;
+}
+
+
+bool OverloadController::recordTick(double busyMillisec)
+{
+	double tickLoad = busyMillisec / interval;
+	
+	load = (1 - OVERLOAD_SMOOTHING) * load + OVERLOAD_SMOOTHING * tickLoad;
+	
+	if (load > OVERLOAD_HIGH_LOAD)
+	{
+		ticksUnderLowLoad = 0;
+		
+		// Take the cheapest step that is still available
+		if (shedLevel < SHED_LOGGING)
+		{
+			shedLevel = SHED_LOGGING;
+		}
+		else if (interval < maxInterval)
+		{
+			interval *= OVERLOAD_INTERVAL_STEP;
+			if (interval > maxInterval) interval = maxInterval;
+		}
+		else if (shedLevel < SHED_MAP_DETAIL)
+		{
+			shedLevel = SHED_MAP_DETAIL;
+		}
+		else
+		{
+			return false;
+		}
+		
+		// The load was measured against the old settings
+		// Give the new settings time to take effect before the next step
+		load = OVERLOAD_HIGH_LOAD;
+		return true;
+	}
+	
+	if (load >= OVERLOAD_LOW_LOAD)
+	{
+		ticksUnderLowLoad = 0;
+		return false;
+	}
+	
+	ticksUnderLowLoad++;
+	
+	if (ticksUnderLowLoad < OVERLOAD_RECOVERY_TICKS) return false;
+	
+	ticksUnderLowLoad = 0;
+	
+	// Undo the steps in reverse order
+	if (shedLevel == SHED_MAP_DETAIL)
+	{
+		shedLevel = SHED_LOGGING;
+	}
+	else if (interval > minInterval)
+	{
+		interval /= OVERLOAD_INTERVAL_STEP;
+		if (interval < minInterval) interval = minInterval;
+	}
+	else if (shedLevel == SHED_LOGGING)
+	{
+		shedLevel = SHED_NONE;
+	}
+	else
+	{
+		return false;
+	}
+	
+	return true;
+}
+
+
+double OverloadController::getTickInterval()
+{
+	return interval;
+}
+
+
+int OverloadController::getShedLevel()
+{
+	return shedLevel;
+}
+
+
+double OverloadController::getLoad()
+{
+	return load;
+}
@@ -0,0 +1,63 @@
+#ifndef OVERLOAD_CONTROLLER_H
+#define OVERLOAD_CONTROLLER_H
+
+
+/********************************************************************************************************************************************
+ * 
+ * The overload controller keeps the game loop from falling behind when a tick costs more than its budget.
+ * After each tick, the server reports how long it was busy (everything except waiting in select) during the tick.
+ * The load is the busy time divided by the tick interval, smoothed over several ticks.
+ * 
+ * When the load stays above OVERLOAD_HIGH_LOAD, the controller takes one step at a time:
+ * 1. Shed non-critical logging
+ * 2. Lower the broadcast rate by lengthening the tick interval, up to the configured maximum
+ * 3. Shed map update detail (only robots that moved are sent, with a full update every few ticks)
+ * 
+ * When the load stays below OVERLOAD_LOW_LOAD for OVERLOAD_RECOVERY_TICKS ticks, the steps are undone in reverse order.
+ * 
+ *********************************************************************************************************************************************/
+
+
+#define OVERLOAD_HIGH_LOAD			0.8		// Load above which the server is overloaded
+#define OVERLOAD_LOW_LOAD			0.5		// Load below which the server can afford more work
+#define OVERLOAD_RECOVERY_TICKS		20		// Number of ticks under low load before undoing a step
+#define OVERLOAD_SMOOTHING			0.2		// Weight of the latest tick in the smoothed load
+#define OVERLOAD_INTERVAL_STEP		1.25	// Factor applied to the tick interval at each step
+
+// Shed levels
+#define SHED_NONE					0
+#define SHED_LOGGING				1
+#define SHED_MAP_DETAIL				2
+
+
+class OverloadController
+{
+	private:
+		
+		double minInterval;
+		double maxInterval;
+		double interval;
+		double load;
+		int shedLevel;
+		int ticksUnderLowLoad;
+		
+	public:
+		
+		// Create a controller that keeps the tick interval between the bounds (in milliseconds)
+		OverloadController(double minIntervalMillisec, double maxIntervalMillisec);
+		
+		// Report the time the server was busy during the last tick
+		// Return true if the tick interval or shed level changed
+		bool recordTick(double busyMillisec);
+		
+		// Current tick interval in milliseconds
+		double getTickInterval();
+		
+		// Current shed level (SHED_NONE, SHED_LOGGING or SHED_MAP_DETAIL)
+		int getShedLevel();
+		
+		// Smoothed load of the recent ticks (1.0 means the whole interval is spent working)
+		double getLoad();
+};
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef PROXIMITY_GRAPH_H
+#define PROXIMITY_GRAPH_H
+
+
+/********************************************************************************************************************************************
+ *
+ * The proximity graph keeps, for every robot on the map, the robots that may be within the explosion radius of it,
+ * so resolving an annihilation follows the edges instead of measuring the distance between every pair of robots.
+ *
+ * The lists are Verlet neighbour lists: each robot has a reference position, and two robots are neighbours
+ * when their reference positions are within the radius plus a skin margin.
+ * A robot keeps its reference position (and its edges) until it has moved more than half the skin away from it,
+ * so two robots that are not neighbours are always further apart than the radius, and most moves cost one distance.
+ * A robot that moves further, or spawns, gets a new reference position and is measured against every robot on the map.
+ *
+ * Neighbours may be up to the radius plus the skin apart, so the distance is still checked when the edges are followed.
+ * The neighbours of a robot are a set of slots (see SlotBitset.h), iterated like any other set:
+ *
+ *		for (int32_t j = graph.getNeighbours(i)->first(); j != -1; j = graph.getNeighbours(i)->next(j))
+ *
+ *********************************************************************************************************************************************/
+
+
+#include <stdint.h>
+
+#include "SlotBitset.h"
+
+
+template <int SLOTS>
+class ProximityGraph
+{
+	private:
+
+		float listRadius;		// Radius plus skin
+		float halfSkin;
+
+		// Robots in the graph, their reference positions and their neighbours
+		SlotBitset<SLOTS> members;
+		float refX[SLOTS];
+		float refY[SLOTS];
+		float refZ[SLOTS];
+		SlotBitset<SLOTS> neighbours[SLOTS];
+
+		static float getSquaredDistance(float x1, float y1, float z1, float x2, float y2, float z2)
+		{
+			float x = x1 - x2;
+			float y = y1 - y2;
+			float z = z1 - z2;
+
+			return x * x + y * y + z * z;
+		}
+
+		// Take the position as the robot's reference, and find its neighbours again
+		void anchor(int32_t slot, float x, float y, float z)
+		{
+			detach(slot);
+
+			refX[slot] = x;
+			refY[slot] = y;
+			refZ[slot] = z;
+
+			for (int32_t j = members.first(); j != -1; j = members.next(j))
+			{
+				if (j == slot) continue;
+
+				if (getSquaredDistance(x, y, z, refX[j], refY[j], refZ[j]) <= listRadius * listRadius)
+				{
+					neighbours[slot].add(j);
+					neighbours[j].add(slot);
+				}
+			}
+		}
+
+		// Drop every edge of the robot
+		void detach(int32_t slot)
+		{
+			for (int32_t j = neighbours[slot].first(); j != -1; j = neighbours[slot].next(j))
+			{
+				neighbours[j].remove(slot);
+			}
+
+			neighbours[slot].clear();
+		}
+
+	public:
+
+		ProximityGraph(float radius, float skin)
+		{
+			listRadius = radius + skin;
+			halfSkin = skin / 2;
+		}
+
+		// Put a robot on the map, or move it there if it already is
+		void add(int32_t slot, float x, float y, float z)
+		{
+			members.add(slot);
+			anchor(slot, x, y, z);
+		}
+
+		// Take a robot off the map
+		void remove(int32_t slot)
+		{
+			if (!members.contains(slot)) return;
+
+			detach(slot);
+			members.remove(slot);
+		}
+
+		// Tell the graph where a robot on the map is now
+		// Its neighbours are only found again once it has moved more than half the skin from its reference position
+		void move(int32_t slot, float x, float y, float z)
+		{
+			if (!members.contains(slot)) return;
+
+			if (getSquaredDistance(x, y, z, refX[slot], refY[slot], refZ[slot]) > halfSkin * halfSkin)
+			{
+				anchor(slot, x, y, z);
+			}
+		}
+
+		// Robots that may be within the radius of the robot (a superset of those that are)
+		const SlotBitset<SLOTS>* getNeighbours(int32_t slot) const
+		{
+			return &neighbours[slot];
+		}
+};
+
+#endif
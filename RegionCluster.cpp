@@ -0,0 +1,394 @@
+#include "RegionCluster.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+
+
+RegionCluster::RegionCluster()
+{
+	regionIndex = 0;
+	regionCount = 1;
+	directory = NULL;
+	listenfd = -1;
+
+	for (int i = 0; i < CLUSTER_REGION_LIMIT; i++)
+	{
+		links[i] = -1;
+		pendingLinks[i] = -1;
+	}
+}
+
+
+RegionCluster::~RegionCluster()
+{
+	for (int i = 0; i < CLUSTER_REGION_LIMIT; i++)
+	{
+		if (links[i] != -1) close(links[i]);
+		if (pendingLinks[i] != -1) close(pendingLinks[i]);
+	}
+
+	if (listenfd != -1)
+	{
+		struct sockaddr_un addr;
+		if (getSocketAddress(regionIndex, &addr) == 0) unlink(addr.sun_path);
+
+		close(listenfd);
+	}
+}
+
+
+int RegionCluster::getSocketAddress(int region, struct sockaddr_un* addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+
+	int length = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/region-%d.sock", directory, region);
+
+	if (length < 0 || length >= (int)sizeof(addr->sun_path))
+	{
+		fprintf(stderr, "Cluster socket path in %s is too long\n", directory);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int RegionCluster::start(const char* directory, int regionIndex, int regionCount)
+{
+	this->directory = directory;
+	this->regionIndex = regionIndex;
+	this->regionCount = regionCount;
+
+	struct sockaddr_un addr;
+
+	if (getSocketAddress(regionIndex, &addr) == -1) return -1;
+
+	int sockfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (sockfd == -1)
+	{
+		fprintf(stderr, "Failed to create cluster socket: %s\n", strerror(errno));
+		return -1;
+	}
+
+	// A socket file left behind by a previous run of this region would make bind() fail
+	unlink(addr.sun_path);
+
+	if (bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(sockfd, CLUSTER_REGION_LIMIT) == -1)
+	{
+		fprintf(stderr, "Failed to listen on %s: %s\n", addr.sun_path, strerror(errno));
+		close(sockfd);
+		return -1;
+	}
+
+	listenfd = sockfd;
+
+	return 0;
+}
+
+
+bool RegionCluster::isEnabled()
+{
+	return listenfd != -1;
+}
+
+
+int RegionCluster::getRegionIndex()
+{
+	return regionIndex;
+}
+
+
+int RegionCluster::getRegionCount()
+{
+	return regionCount;
+}
+
+
+int RegionCluster::getRegionAt(float x)
+{
+	int region = (int)floorf(x * regionCount);
+
+	if (region < 0) return 0;
+	if (region >= regionCount) return regionCount - 1;
+
+	return region;
+}
+
+
+float RegionCluster::getDistanceToRegion(float x, int region)
+{
+	float low = (float)region / regionCount;
+	float high = (float)(region + 1) / regionCount;
+
+	if (x < low) return low - x;
+	if (x >= high) return x - high;
+
+	return 0;
+}
+
+
+void RegionCluster::connectPeers()
+{
+	for (int region = 0; region < regionIndex; region++)
+	{
+		if (links[region] != -1) continue;
+
+		struct sockaddr_un addr;
+
+		if (getSocketAddress(region, &addr) == -1) continue;
+
+		int sockfd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+		if (sockfd == -1) continue;
+
+		// A local connect completes (or fails) right away, so it is made before the socket turns non-blocking
+		// ENOENT and ECONNREFUSED mean the region is not running (yet)
+		if (connect(sockfd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+		{
+			close(sockfd);
+			continue;
+		}
+
+		fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+
+		links[region] = sockfd;
+
+		// Tell the region which region this is
+		int32_t index = regionIndex;
+
+		if (sendMessage(region, LINK_HELLO, &index, sizeof(index), -1) == -1)
+		{
+			closeLink(region);
+			continue;
+		}
+
+		fprintf(stdout, "Linked to region %d\n", region);
+	}
+}
+
+
+int RegionCluster::addToSet(fd_set* readSet)
+{
+	int maxfd = listenfd;
+
+	FD_SET(listenfd, readSet);
+
+	for (int i = 0; i < CLUSTER_REGION_LIMIT; i++)
+	{
+		if (links[i] != -1)
+		{
+			FD_SET(links[i], readSet);
+			if (links[i] > maxfd) maxfd = links[i];
+		}
+		if (pendingLinks[i] != -1)
+		{
+			FD_SET(pendingLinks[i], readSet);
+			if (pendingLinks[i] > maxfd) maxfd = pendingLinks[i];
+		}
+	}
+
+	return maxfd;
+}
+
+
+void RegionCluster::acceptPeers(fd_set* readSet)
+{
+	// Read the hello of the connections accepted earlier
+	for (int i = 0; i < CLUSTER_REGION_LIMIT; i++)
+	{
+		int sockfd = pendingLinks[i];
+
+		if (sockfd == -1 || !FD_ISSET(sockfd, readSet)) continue;
+
+		uint8_t message[LINK_HEADER_SIZE + sizeof(int32_t)];
+		ssize_t bytes = recv(sockfd, message, sizeof(message), 0);
+
+		if (bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+
+		pendingLinks[i] = -1;
+
+		int32_t region = -1;
+
+		if (bytes == sizeof(message) && message[0] == LINK_HELLO)
+		{
+			memcpy(&region, message + LINK_HEADER_SIZE, sizeof(region));
+		}
+
+		// Only regions with a higher index connect to this one
+		if (region <= regionIndex || region >= regionCount)
+		{
+			fprintf(stderr, "Invalid hello on a cluster link, closing it\n");
+			close(sockfd);
+			continue;
+		}
+
+		// A restarted region replaces its old link
+		if (links[region] != -1) close(links[region]);
+
+		links[region] = sockfd;
+
+		fprintf(stdout, "Linked to region %d\n", region);
+	}
+
+	if (!FD_ISSET(listenfd, readSet)) return;
+
+	while (true)
+	{
+		int sockfd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (sockfd == -1) return;
+
+		int slot;
+		for (slot = 0; slot < CLUSTER_REGION_LIMIT; slot++)
+		{
+			if (pendingLinks[slot] == -1) break;
+		}
+
+		if (slot == CLUSTER_REGION_LIMIT)
+		{
+			close(sockfd);
+			continue;
+		}
+
+		pendingLinks[slot] = sockfd;
+	}
+}
+
+
+int RegionCluster::getLinkSocket(int region)
+{
+	return links[region];
+}
+
+
+void RegionCluster::closeLink(int region)
+{
+	if (links[region] == -1) return;
+
+	close(links[region]);
+	links[region] = -1;
+
+	fprintf(stderr, "Lost the link to region %d\n", region);
+}
+
+
+int RegionCluster::sendMessage(int region, uint8_t type, const void* payload, uint32_t payloadSize, int fd)
+{
+	if (links[region] == -1 || LINK_HEADER_SIZE + payloadSize > LINK_MESSAGE_MAX) return -1;
+
+	uint8_t header[LINK_HEADER_SIZE];
+	memset(header, 0, sizeof(header));
+	header[0] = type;
+
+	struct iovec parts[2];
+	parts[0].iov_base = header;
+	parts[0].iov_len = LINK_HEADER_SIZE;
+	parts[1].iov_base = (void*)payload;
+	parts[1].iov_len = payloadSize;
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = parts;
+	msg.msg_iovlen = 2;
+
+	// The socket to pass along travels as ancillary data
+	union
+	{
+		struct cmsghdr align;
+		uint8_t data[CMSG_SPACE(sizeof(int))];
+
+	} control;
+
+	if (fd != -1)
+	{
+		memset(&control, 0, sizeof(control));
+		msg.msg_control = control.data;
+		msg.msg_controllen = sizeof(control.data);
+
+		struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	ssize_t bytes = sendmsg(links[region], &msg, MSG_NOSIGNAL);
+
+	if (bytes == -1)
+	{
+		// The link is full, the caller decides whether the message can be dropped
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return -1;
+
+		closeLink(region);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int RegionCluster::receiveMessage(int region, uint8_t* message, uint32_t capacity, int* fd)
+{
+	*fd = -1;
+
+	if (links[region] == -1) return -1;
+
+	struct iovec part;
+	part.iov_base = message;
+	part.iov_len = capacity;
+
+	union
+	{
+		struct cmsghdr align;
+		uint8_t data[CMSG_SPACE(sizeof(int))];
+
+	} control;
+
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &part;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.data;
+	msg.msg_controllen = sizeof(control.data);
+
+	ssize_t bytes = recvmsg(links[region], &msg, MSG_CMSG_CLOEXEC);
+
+	if (bytes == -1)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+
+		closeLink(region);
+		return -1;
+	}
+	if (bytes == 0)
+	{
+		// The region stopped
+		closeLink(region);
+		return -1;
+	}
+
+	for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+		{
+			memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+		}
+	}
+
+	// A message too short for its header is dropped (along with any socket passed with it)
+	// The next message is read when select() reports the link again
+	if (bytes < LINK_HEADER_SIZE)
+	{
+		if (*fd != -1) close(*fd);
+		*fd = -1;
+		return 0;
+	}
+
+	return bytes;
+}
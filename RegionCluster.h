@@ -0,0 +1,138 @@
+#ifndef REGION_CLUSTER_H
+#define REGION_CLUSTER_H
+
+
+/********************************************************************************************************************************************
+ *
+ * In cluster mode, the map is split along the x axis into regionCount slabs of equal width, each owned by its own server process.
+ * Region r owns the robots with r / regionCount <= x < (r + 1) / regionCount.
+ *
+ * The processes of a cluster run on the same host and are linked to each other by AF_UNIX SOCK_SEQPACKET sockets:
+ * region r listens on <directory>/region-<r>.sock and connects to every region with a lower index.
+ * SEQPACKET keeps message boundaries, so every link message is a single send, and it can carry a player's socket (SCM_RIGHTS).
+ * Both ends of a link are the same program on the same host, so values are sent in host byte order.
+ *
+ * The region cluster only manages the links and moves messages. The game server decides what to send:
+ * LINK_BOUNDARY	every tick, the robots within EXPLOSION_RADIUS of the receiver's slab, and the number of free player slots
+ * LINK_DETONATE	robots of the receiver hit by a chain reaction that started on the sender's side
+ * LINK_CREDIT		kills made on the receiver's side by a chain reaction that one of the sender's players started
+ * LINK_HANDOFF		the state of a player whose robot crossed into the receiver's slab, with the player's socket
+ *
+ * An explosion can only reach robots within EXPLOSION_RADIUS, so with slabs at least that wide,
+ * only the robots of neighbouring regions can take part in a chain reaction that crosses a border (hence CLUSTER_REGION_LIMIT).
+ *
+ *********************************************************************************************************************************************/
+
+
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/un.h>
+#include <stdint.h>
+
+
+#define CLUSTER_REGION_LIMIT		4		// Most regions in a cluster, so every slab is at least EXPLOSION_RADIUS wide
+#define LINK_MESSAGE_MAX			4096	// Largest message sent over a link
+#define LINK_HEADER_SIZE			4		// 1 byte message type, 3 bytes padding
+
+// Link message types
+#define LINK_HELLO					1
+#define LINK_BOUNDARY				2
+#define LINK_DETONATE				3
+#define LINK_CREDIT					4
+#define LINK_HANDOFF				5
+
+
+// Robot near the border of the sending region, as seen from the receiving region (a ghost)
+typedef struct
+{
+	int32_t id;
+	float x, y, z;
+
+} BoundaryRobot;
+
+
+// State of a player that moves to another region along with the player's socket
+// Only players without partial frames, queued output or zerocopy sends in flight are handed off
+typedef struct
+{
+	int32_t id;
+	float x, y, z;
+	int32_t score;
+	uint8_t options;
+	int32_t rateLevel;
+	int32_t healthyChecks;
+	uint32_t lastTotalRetrans;
+	bool zeroCopy;
+	uint32_t zeroCopyNextID;
+	bool isLocal;
+
+} PlayerHandoff;
+
+
+class RegionCluster
+{
+	private:
+
+		int regionIndex;
+		int regionCount;
+		const char* directory;
+		int listenfd;
+
+		// Link to each region, -1 if not connected (the entry of this region is never used)
+		int links[CLUSTER_REGION_LIMIT];
+
+		// Accepted connections that have not said which region they are yet
+		int pendingLinks[CLUSTER_REGION_LIMIT];
+
+		// Write the path of the socket region listens on into addr
+		// Return -1 if the path is too long
+		int getSocketAddress(int region, struct sockaddr_un* addr);
+
+	public:
+
+		RegionCluster();
+		~RegionCluster();
+
+		// Join a cluster as region regionIndex of regionCount, with the sockets in directory
+		// Return -1 if the listening socket cannot be created
+		int start(const char* directory, int regionIndex, int regionCount);
+
+		// True once start succeeded
+		bool isEnabled();
+
+		int getRegionIndex();
+		int getRegionCount();
+
+		// Region that owns the x coordinate (positions outside the map belong to the first or last region)
+		int getRegionAt(float x);
+
+		// Distance along x from the coordinate to the slab of the region, 0 if it is inside
+		float getDistanceToRegion(float x, int region);
+
+		// Connect to the regions with a lower index that are not linked yet
+		// Regions that are not running yet are tried again at the next call
+		void connectPeers();
+
+		// Add the listening socket and every link to the set
+		// Return the highest socket added
+		int addToSet(fd_set* readSet);
+
+		// Accept new links and read the hello of accepted ones, if their sockets are in the set
+		void acceptPeers(fd_set* readSet);
+
+		// Socket of the link to the region, -1 if not connected
+		int getLinkSocket(int region);
+
+		// Close the link to the region, it is connected again by connectPeers (if the region has a lower index) or by the region
+		void closeLink(int region);
+
+		// Send a message over the link to the region, with a socket to pass along if fd is not -1
+		// Return 0 on success, -1 if the link is down or cannot take the message now
+		int sendMessage(int region, uint8_t type, const void* payload, uint32_t payloadSize, int fd);
+
+		// Receive the next message from the region without blocking, and the socket passed along with it in fd (-1 if none)
+		// Return the size of the message, 0 if none is pending, -1 if the link was lost (it is then closed)
+		int receiveMessage(int region, uint8_t* message, uint32_t capacity, int* fd);
+};
+
+#endif
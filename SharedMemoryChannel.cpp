@@ -0,0 +1,213 @@
+#include "SharedMemoryChannel.h"
+
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+
+SharedMemoryChannel::SharedMemoryChannel()
+{
+	layout = NULL;
+	memoryfd = -1;
+	serverEventfd = -1;
+	clientEventfd = -1;
+}
+
+
+SharedMemoryChannel::~SharedMemoryChannel()
+{
+	close();
+}
+
+
+int SharedMemoryChannel::open()
+{
+	memoryfd = memfd_create("game-channel", MFD_CLOEXEC);
+
+	if (memoryfd == -1 || ftruncate(memoryfd, sizeof(SharedChannelLayout)) == -1)
+	{
+		fprintf(stderr, "Failed to create shared memory: %s\n", strerror(errno));
+		close();
+		return -1;
+	}
+
+	void* memory = mmap(NULL, sizeof(SharedChannelLayout), PROT_READ | PROT_WRITE, MAP_SHARED, memoryfd, 0);
+
+	if (memory == MAP_FAILED)
+	{
+		fprintf(stderr, "Failed to map shared memory: %s\n", strerror(errno));
+		close();
+		return -1;
+	}
+
+	layout = (SharedChannelLayout*)memory;
+
+	serverEventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	clientEventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (serverEventfd == -1 || clientEventfd == -1)
+	{
+		fprintf(stderr, "Failed to create channel events: %s\n", strerror(errno));
+		close();
+		return -1;
+	}
+
+	// A new memfd is zero-filled, so both rings start empty with no side waiting
+	layout->magic = SHM_CHANNEL_MAGIC;
+	layout->ringSize = SHM_RING_SIZE;
+
+	return 0;
+}
+
+
+void SharedMemoryChannel::close()
+{
+	if (layout != NULL) munmap(layout, sizeof(SharedChannelLayout));
+	if (memoryfd != -1) ::close(memoryfd);
+	if (serverEventfd != -1) ::close(serverEventfd);
+	if (clientEventfd != -1) ::close(clientEventfd);
+
+	layout = NULL;
+	memoryfd = -1;
+	serverEventfd = -1;
+	clientEventfd = -1;
+}
+
+
+bool SharedMemoryChannel::isOpen()
+{
+	return layout != NULL;
+}
+
+
+int SharedMemoryChannel::getMemoryFd()
+{
+	return memoryfd;
+}
+
+
+int SharedMemoryChannel::getClientEvent()
+{
+	return clientEventfd;
+}
+
+
+int SharedMemoryChannel::getServerEvent()
+{
+	return serverEventfd;
+}
+
+
+void SharedMemoryChannel::releaseMemoryFd()
+{
+	if (memoryfd != -1) ::close(memoryfd);
+	memoryfd = -1;
+}
+
+
+void SharedMemoryChannel::signal(int eventfd)
+{
+	uint64_t value = 1;
+
+	// The event only fails to take it if its counter is about to overflow, the other side is awake then anyway
+	if (write(eventfd, &value, sizeof(value)) == -1) return;
+}
+
+
+void SharedMemoryChannel::clearEvent()
+{
+	uint64_t value;
+
+	if (read(serverEventfd, &value, sizeof(value)) == -1) return;
+}
+
+
+ssize_t SharedMemoryChannel::receive(uint8_t* buffer, uint32_t capacity)
+{
+	SharedRing* ring = &layout->toServer;
+
+	uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+	uint32_t head = ring->head.load(std::memory_order_acquire);
+
+	if (head == tail)
+	{
+		// Ask to be woken, then look again in case the client wrote before it could see the flag
+		ring->consumerWaiting.store(1);
+		head = ring->head.load();
+
+		if (head == tail)
+		{
+			errno = EAGAIN;
+			return -1;
+		}
+	}
+
+	// A misbehaving client can move the head anywhere, never read more than a ring's worth
+	uint32_t available = head - tail;
+	if (available > SHM_RING_SIZE) available = SHM_RING_SIZE;
+
+	uint32_t length = (available < capacity) ? available : capacity;
+
+	// Copy in up to two parts when the bytes wrap around the end of the ring
+	uint32_t start = tail & (SHM_RING_SIZE - 1);
+	uint32_t first = SHM_RING_SIZE - start;
+	if (first > length) first = length;
+
+	memcpy(buffer, ring->data + start, first);
+	memcpy(buffer + first, ring->data, length - first);
+
+	ring->tail.store(tail + length);
+
+	// The client waits for room to write
+	if (ring->producerWaiting.load() != 0 && ring->producerWaiting.exchange(0) != 0)
+	{
+		signal(clientEventfd);
+	}
+
+	return length;
+}
+
+
+ssize_t SharedMemoryChannel::send(const uint8_t* message, uint32_t numBytes)
+{
+	SharedRing* ring = &layout->toClient;
+
+	uint32_t head = ring->head.load(std::memory_order_relaxed);
+	uint32_t tail = ring->tail.load(std::memory_order_acquire);
+
+	if (head - tail >= SHM_RING_SIZE)
+	{
+		// Ask to be woken when the client reads, then look again in case it read before it could see the flag
+		ring->producerWaiting.store(1);
+		tail = ring->tail.load();
+
+		if (head - tail >= SHM_RING_SIZE)
+		{
+			errno = EAGAIN;
+			return -1;
+		}
+	}
+
+	uint32_t room = SHM_RING_SIZE - (head - tail);
+	uint32_t length = (numBytes < room) ? numBytes : room;
+
+	uint32_t start = head & (SHM_RING_SIZE - 1);
+	uint32_t first = SHM_RING_SIZE - start;
+	if (first > length) first = length;
+
+	memcpy(ring->data + start, message, first);
+	memcpy(ring->data, message + first, length - first);
+
+	ring->head.store(head + length);
+
+	// The client waits for frames
+	if (ring->consumerWaiting.load() != 0 && ring->consumerWaiting.exchange(0) != 0)
+	{
+		signal(clientEventfd);
+	}
+
+	return length;
+}
@@ -0,0 +1,123 @@
+#ifndef SHARED_MEMORY_CHANNEL_H
+#define SHARED_MEMORY_CHANNEL_H
+
+
+/********************************************************************************************************************************************
+ *
+ * A shared memory channel carries the frames of a client on the same host without going through the socket layer.
+ * A client connected to the server's local (AF_UNIX) socket asks for it with a shared memory request,
+ * and gets three descriptors along with the grant (SCM_RIGHTS): the shared memory, the server's event and the client's event.
+ * The frames are the same as over TCP (length, version, code, payload), they only travel through the memory instead.
+ *
+ * The memory holds a header and two rings of SHM_RING_SIZE bytes, one per direction, each written by a single producer
+ * and read by a single consumer. Both sides map the memory, so its layout is part of the protocol (offsets in bytes):
+ *
+ * 0		magic (SHM_CHANNEL_MAGIC), 32-bit
+ * 4		ring size (SHM_RING_SIZE), 32-bit
+ * 64		ring of the client's frames to the server
+ * 64 + SHM_RING_BYTES	ring of the server's frames to the client
+ *
+ * and each ring:
+ *
+ * 0		head: bytes written so far by the producer, 32-bit, wraps around
+ * 64		tail: bytes read so far by the consumer, 32-bit, wraps around
+ * 128		consumer waiting flag, 32-bit
+ * 132		producer waiting flag, 32-bit
+ * 192		data, byte n of the stream is at data[n % SHM_RING_SIZE]
+ *
+ * Waking the other side costs a system call, so it is only done when the other side waits:
+ * before waiting for data (or space), a side sets its waiting flag and checks the ring again.
+ * After writing (or reading), a side that finds the other's flag set clears it and adds 1 to the other's event (an eventfd).
+ * A client may also signal the server's event after every write, the server does not mind spurious wakeups.
+ *
+ * The local socket stays open: the client closing it ends the connection.
+ *
+ *********************************************************************************************************************************************/
+
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <atomic>
+
+
+#define SHM_RING_SIZE				65536	// Bytes of each ring (a power of 2)
+#define SHM_CHANNEL_MAGIC			0x52494E47	// "RING"
+
+
+typedef struct
+{
+	std::atomic<uint32_t> head;
+	uint8_t headPadding[60];
+	std::atomic<uint32_t> tail;
+	uint8_t tailPadding[60];
+	std::atomic<uint32_t> consumerWaiting;
+	std::atomic<uint32_t> producerWaiting;
+	uint8_t flagPadding[56];
+	uint8_t data[SHM_RING_SIZE];
+
+} SharedRing;
+
+
+#define SHM_RING_BYTES				((int)sizeof(SharedRing))
+
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t ringSize;
+	uint8_t padding[56];
+	SharedRing toServer;
+	SharedRing toClient;
+
+} SharedChannelLayout;
+
+
+class SharedMemoryChannel
+{
+	private:
+
+		SharedChannelLayout* layout;
+		int memoryfd;
+		int serverEventfd;
+		int clientEventfd;
+
+		// Add 1 to the event to wake the side that waits on it
+		void signal(int eventfd);
+
+	public:
+
+		SharedMemoryChannel();
+		~SharedMemoryChannel();
+
+		// Create the shared memory and the events of a new channel
+		// Return -1 if one of them cannot be created
+		int open();
+
+		// Unmap the memory and close the descriptors
+		void close();
+
+		bool isOpen();
+
+		// Descriptors to hand to the client
+		int getMemoryFd();
+		int getClientEvent();
+
+		// Event the server waits on, it becomes readable when the client wrote frames or read the server's
+		int getServerEvent();
+
+		// Close the server's copy of the memory descriptor once the client has it (the mapping stays)
+		void releaseMemoryFd();
+
+		// Reset the server's event after it was reported readable
+		void clearEvent();
+
+		// Read up to capacity bytes that the client wrote, like a non-blocking recv()
+		// Return the number of bytes read, or -1 with errno set to EAGAIN if the ring is empty
+		ssize_t receive(uint8_t* buffer, uint32_t capacity);
+
+		// Write as much of the message as the ring has room for, like a non-blocking send()
+		// Return the number of bytes written, or -1 with errno set to EAGAIN if the ring is full
+		ssize_t send(const uint8_t* message, uint32_t numBytes);
+};
+
+#endif
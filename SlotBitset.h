@@ -0,0 +1,127 @@
+#ifndef SLOT_BITSET_H
+#define SLOT_BITSET_H
+
+
+/********************************************************************************************************************************************
+ *
+ * A set of slot indices (0 to SLOTS - 1), one bit per slot packed into 64-bit words.
+ * The game server keeps which player slots are active, alive and waiting to write in such sets, instead of checking every slot in turn,
+ * and the spectator relay keeps which of its spectator slots are connected.
+ *
+ * Iterating finds the next set bit with a count of trailing zeros, so a loop over the set costs one step per member
+ * (plus one per word), not one per slot. count() is a popcount, so it is always exact.
+ * Members can be removed while the set is iterated, the loop simply does not see them again.
+ *
+ *		for (int32_t i = set.first(); i != -1; i = set.next(i))
+ *
+ *********************************************************************************************************************************************/
+
+
+#include <stdint.h>
+
+
+#define SLOT_BITSET_WORDS(slots)	(((slots) + 63) / 64)
+
+
+template <int SLOTS>
+class SlotBitset
+{
+	private:
+
+		uint64_t words[SLOT_BITSET_WORDS(SLOTS)];
+
+		// Lowest member at or after the slot, -1 if there is none
+		int32_t findFrom(int32_t slot) const
+		{
+			if (slot >= SLOTS) return -1;
+
+			int word = slot / 64;
+			uint64_t bits = words[word] & (~(uint64_t)0 << (slot % 64));
+
+			while (true)
+			{
+				if (bits != 0) return word * 64 + __builtin_ctzll(bits);
+
+				word++;
+
+				if (word == SLOT_BITSET_WORDS(SLOTS)) return -1;
+
+				bits = words[word];
+			}
+		}
+
+	public:
+
+		SlotBitset()
+		{
+			clear();
+		}
+
+		void clear()
+		{
+			for (int w = 0; w < SLOT_BITSET_WORDS(SLOTS); w++) words[w] = 0;
+		}
+
+		void add(int32_t slot)
+		{
+			words[slot / 64] |= (uint64_t)1 << (slot % 64);
+		}
+
+		void remove(int32_t slot)
+		{
+			words[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+		}
+
+		bool contains(int32_t slot) const
+		{
+			return (words[slot / 64] >> (slot % 64)) & 1;
+		}
+
+		int32_t count() const
+		{
+			int32_t total = 0;
+
+			for (int w = 0; w < SLOT_BITSET_WORDS(SLOTS); w++) total += __builtin_popcountll(words[w]);
+
+			return total;
+		}
+
+		bool isEmpty() const
+		{
+			for (int w = 0; w < SLOT_BITSET_WORDS(SLOTS); w++)
+			{
+				if (words[w] != 0) return false;
+			}
+
+			return true;
+		}
+
+		// Lowest member, -1 if the set is empty
+		int32_t first() const
+		{
+			return findFrom(0);
+		}
+
+		// Next member after the slot, -1 if there is none
+		int32_t next(int32_t slot) const
+		{
+			return findFrom(slot + 1);
+		}
+
+		// Lowest slot that is not a member, -1 if every slot is
+		int32_t firstFree() const
+		{
+			for (int w = 0; w < SLOT_BITSET_WORDS(SLOTS); w++)
+			{
+				if (~words[w] == 0) continue;
+
+				int32_t slot = w * 64 + __builtin_ctzll(~words[w]);
+
+				return (slot < SLOTS) ? slot : -1;
+			}
+
+			return -1;
+		}
+};
+
+#endif
@@ -0,0 +1,612 @@
+#include "SpectatorRelay.h"
+
+
+SpectatorRelay::SpectatorRelay(const RelayConfig& config)
+{
+	this->config = config;
+
+	numSpectators = 0;
+	numClosingSlots = 0;
+	serverLength = 0;
+
+	// Every slot is free, the lowest slots are handed out first
+	numFreeSlots = RELAY_SPECTATOR_LIMIT;
+	for (int i = 0; i < RELAY_SPECTATOR_LIMIT; i++)
+	{
+		spectators[i].sockfd = -1;
+		spectators[i].sendBuffer = NULL;
+		freeSlots[i] = RELAY_SPECTATOR_LIMIT - 1 - i;
+	}
+
+	epollfd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (epollfd == -1)
+	{
+		fprintf(stderr, "Failed to create epoll instance: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	listenfd = createListener();
+
+	if (listenfd == -1)
+	{
+		fprintf(stderr, "ERROR: spectator relay not created\n");
+		exit(EXIT_FAILURE);
+	}
+
+	serverfd = connectToServer();
+
+	if (serverfd == -1)
+	{
+		fprintf(stderr, "ERROR: could not subscribe to the game server at %s%s%s\n", config.serverHost, (config.serverPort != NULL) ? ":" : "", (config.serverPort != NULL) ? config.serverPort : "");
+		exit(EXIT_FAILURE);
+	}
+
+	// The event data tells the sockets apart: 0 is the listener, 1 the game server, 2 and above a spectator slot
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+
+	event.events = EPOLLIN;
+	event.data.u64 = 0;
+	epoll_ctl(epollfd, EPOLL_CTL_ADD, listenfd, &event);
+
+	event.events = EPOLLIN;
+	event.data.u64 = 1;
+	epoll_ctl(epollfd, EPOLL_CTL_ADD, serverfd, &event);
+
+	fprintf(stdout, "Spectator relay created at port %s\n", config.portNum);
+}
+
+
+SpectatorRelay::~SpectatorRelay()
+{
+	for (int32_t i = liveSpectators.first(); i != -1; i = liveSpectators.next(i))
+	{
+		close(spectators[i].sockfd);
+		ioPool.release(spectators[i].sendBuffer, spectators[i].sendCapacity);
+	}
+
+	close(listenfd);
+	close(serverfd);
+	close(epollfd);
+}
+
+
+int SpectatorRelay::createListener()
+{
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	struct addrinfo* addr;
+	int res = getaddrinfo(NULL, config.portNum, &hints, &addr);
+
+	if (res != 0)
+	{
+		fprintf(stderr, "Failed to get address info for port %s: %s\n", config.portNum, gai_strerror(res));
+		return -1;
+	}
+
+	int sockfd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, addr->ai_protocol);
+
+	if (sockfd == -1)
+	{
+		fprintf(stderr, "Failed to create spectator socket: %s\n", strerror(errno));
+		freeaddrinfo(addr);
+		return -1;
+	}
+
+	int flag = 1;
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+
+	if (bind(sockfd, addr->ai_addr, addr->ai_addrlen) == -1 || listen(sockfd, config.backlog) == -1)
+	{
+		fprintf(stderr, "Failed to listen on port %s: %s\n", config.portNum, strerror(errno));
+		freeaddrinfo(addr);
+		close(sockfd);
+		return -1;
+	}
+
+	freeaddrinfo(addr);
+
+	return sockfd;
+}
+
+
+int SpectatorRelay::connectToLocalServer()
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+
+	if (strlen(config.serverHost) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "Local socket path %s is too long\n", config.serverHost);
+		return -1;
+	}
+
+	strcpy(addr.sun_path, config.serverHost);
+
+	int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if (sockfd == -1 || connect(sockfd, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+	{
+		fprintf(stderr, "Failed to connect to the game server: %s\n", strerror(errno));
+		if (sockfd != -1) close(sockfd);
+		return -1;
+	}
+
+	return sockfd;
+}
+
+
+int SpectatorRelay::connectToTCPServer()
+{
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	struct addrinfo* addrs;
+	int res = getaddrinfo(config.serverHost, config.serverPort, &hints, &addrs);
+
+	if (res != 0)
+	{
+		fprintf(stderr, "Failed to get address info for %s:%s: %s\n", config.serverHost, config.serverPort, gai_strerror(res));
+		return -1;
+	}
+
+	int sockfd = -1;
+
+	// Try each address until one connects
+	for (struct addrinfo* addr = addrs; addr != NULL; addr = addr->ai_next)
+	{
+		sockfd = socket(addr->ai_family, addr->ai_socktype | SOCK_CLOEXEC, addr->ai_protocol);
+
+		if (sockfd == -1) continue;
+
+		if (connect(sockfd, addr->ai_addr, addr->ai_addrlen) == 0) break;
+
+		close(sockfd);
+		sockfd = -1;
+	}
+
+	freeaddrinfo(addrs);
+
+	if (sockfd == -1)
+	{
+		fprintf(stderr, "Failed to connect to the game server: %s\n", strerror(errno));
+		return -1;
+	}
+
+	int flag = 1;
+	setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+	return sockfd;
+}
+
+
+int SpectatorRelay::connectToServer()
+{
+	// A relay on the same host as the game server skips the TCP stack
+	int sockfd = (config.serverPort == NULL) ? connectToLocalServer() : connectToTCPServer();
+
+	if (sockfd == -1) return -1;
+
+	// Subscribe as a relay
+	// 4 bytes num bytes, 1 byte version, 1 byte code, then the secret
+	uint32_t secretLength = strlen(config.secret);
+	uint32_t numBytes = 6 + secretLength;
+	uint32_t convertedBytes = htonl(numBytes);
+
+	uint8_t message[6 + RELAY_SECRET_MAX];
+
+	message[0] = GET_BYTE_3(convertedBytes);
+	message[1] = GET_BYTE_2(convertedBytes);
+	message[2] = GET_BYTE_1(convertedBytes);
+	message[3] = GET_BYTE_0(convertedBytes);
+	message[4] = VERSION_NUM;
+	message[5] = PLAYER_RELAY_SUBSCRIBE;
+	memcpy(message + 6, config.secret, secretLength);
+
+	// The socket is still blocking, so the whole message is sent
+	if (send(sockfd, message, numBytes, MSG_NOSIGNAL) != (ssize_t)numBytes)
+	{
+		fprintf(stderr, "Failed to subscribe to the game server: %s\n", strerror(errno));
+		close(sockfd);
+		return -1;
+	}
+
+	if (fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK) == -1)
+	{
+		fprintf(stderr, "Failed to set the game server socket non-blocking: %s\n", strerror(errno));
+		close(sockfd);
+		return -1;
+	}
+
+	return sockfd;
+}
+
+
+void SpectatorRelay::run()
+{
+	fprintf(stdout, "Spectator relay started\n");
+
+	struct epoll_event events[RELAY_EVENT_BATCH];
+
+	while (true)
+	{
+		int numEvents = epoll_wait(epollfd, events, RELAY_EVENT_BATCH, -1);
+
+		if (numEvents == -1)
+		{
+			if (errno == EINTR) continue;
+
+			fprintf(stderr, "Error waiting for socket activity: %s\n", strerror(errno));
+			return;
+		}
+
+		for (int i = 0; i < numEvents; i++)
+		{
+			uint64_t id = events[i].data.u64;
+
+			if (id == 0)
+			{
+				acceptSpectators();
+				continue;
+			}
+
+			if (id == 1)
+			{
+				if (readFromServer() == -1) return;
+				continue;
+			}
+
+			int slot = id - 2;
+			Spectator* spectator = &spectators[slot];
+
+			if (spectator->isClosing) continue;
+
+			if (events[i].events & (EPOLLERR | EPOLLHUP))
+			{
+				closeSpectator(slot);
+				continue;
+			}
+
+			// Spectators have nothing to say, anything they send is discarded
+			if (events[i].events & EPOLLIN)
+			{
+				uint8_t discard[256];
+				ssize_t bytes = recv(spectator->sockfd, discard, sizeof(discard), 0);
+
+				if (bytes == 0 || (bytes == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+				{
+					closeSpectator(slot);
+					continue;
+				}
+			}
+
+			if (events[i].events & EPOLLOUT)
+			{
+				flushSpectator(slot);
+			}
+		}
+
+		removeClosedSpectators();
+	}
+}
+
+
+void SpectatorRelay::acceptSpectators()
+{
+	// Drain the whole backlog
+	while (true)
+	{
+		int sockfd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+		if (sockfd == -1)
+		{
+			// The client gave up before it was accepted, try the next one
+			if (errno == ECONNABORTED || errno == EINTR) continue;
+
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				fprintf(stderr, "Failed to accept new spectator: %s\n", strerror(errno));
+			}
+			return;
+		}
+
+		if (numFreeSlots == 0)
+		{
+			close(sockfd);
+			continue;
+		}
+
+		int flag = 1;
+		setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+		numFreeSlots--;
+		int slot = freeSlots[numFreeSlots];
+
+		spectators[slot].sockfd = sockfd;
+		spectators[slot].isClosing = false;
+		spectators[slot].sendBuffer = NULL;
+		spectators[slot].sendLength = 0;
+
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.u64 = slot + 2;
+
+		// The spectator is not counted or relayed to yet, so its slot is simply given back
+		if (epoll_ctl(epollfd, EPOLL_CTL_ADD, sockfd, &event) == -1)
+		{
+			fprintf(stderr, "Failed to watch spectator socket: %s\n", strerror(errno));
+			close(sockfd);
+			spectators[slot].sockfd = -1;
+			freeSlots[numFreeSlots] = slot;
+			numFreeSlots++;
+			continue;
+		}
+
+		liveSpectators.add(slot);
+		numSpectators++;
+	}
+}
+
+
+int SpectatorRelay::readFromServer()
+{
+	ssize_t bytes = recv(serverfd, serverBuffer + serverLength, MAX_FRAME_SIZE - serverLength, 0);
+
+	if (bytes == -1)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+
+		fprintf(stderr, "Error receiving from the game server: %s\n", strerror(errno));
+		return -1;
+	}
+	if (bytes == 0)
+	{
+		fprintf(stderr, "The game server closed the connection\n");
+		return -1;
+	}
+
+	serverLength += bytes;
+
+	uint32_t offset = 0;
+
+	// Relay every complete frame, and keep the trailing partial frame for the next receive
+	while (serverLength - offset >= 6)
+	{
+		const uint8_t* frame = serverBuffer + offset;
+
+		// Read the number of bytes in the packet
+		uint32_t rawBytes = 0;
+		rawBytes |= ((uint32_t)frame[0]) << 24;
+		rawBytes |= ((uint32_t)frame[1]) << 16;
+		rawBytes |= ((uint32_t)frame[2]) << 8;
+		rawBytes |= ((uint32_t)frame[3]);
+
+		uint32_t numBytes = ntohl(rawBytes);
+
+		// The frames would be corrupted for every spectator, so the relay stops
+		if (numBytes < 6 || numBytes > MAX_FRAME_SIZE)
+		{
+			fprintf(stderr, "Invalid frame length %u from the game server\n", numBytes);
+			return -1;
+		}
+
+		// If the rest of the frame has not arrived yet
+		if (serverLength - offset < numBytes) break;
+
+		switch (frame[5])
+		{
+			// A map update is superseded by the next one
+			case SERVER_MAP_UPDATE:
+			case SERVER_MAP_UPDATE_SEQUENCED:
+				relayFrame(frame, numBytes, true);
+				break;
+
+			// Spawns and annihilations must reach every spectator
+			case PLAYER_SPAWN_WITH_ID:
+			case ANNIHILATION_RESULTS:
+				relayFrame(frame, numBytes, false);
+				break;
+
+			case SERVER_RELAY_SUBSCRIBED:
+				fprintf(stdout, "Subscribed to the game server as a relay\n");
+				break;
+
+			// The join response and other messages meant for the relay itself
+			default:
+				break;
+		}
+
+		offset += numBytes;
+	}
+
+	// Move the partial frame (if any) to the front of the buffer
+	serverLength -= offset;
+
+	if (offset > 0 && serverLength > 0)
+	{
+		memmove(serverBuffer, serverBuffer + offset, serverLength);
+	}
+
+	return 0;
+}
+
+
+void SpectatorRelay::relayFrame(const uint8_t* frame, uint32_t numBytes, bool canSkip)
+{
+	for (int32_t i = liveSpectators.first(); i != -1; i = liveSpectators.next(i))
+	{
+		Spectator* spectator = &spectators[i];
+
+		if (spectator->isClosing) continue;
+
+		if (canSkip && spectator->sendLength > 0) continue;
+
+		sendToSpectator(i, frame, numBytes);
+	}
+}
+
+
+void SpectatorRelay::sendToSpectator(int slot, const uint8_t* frame, uint32_t numBytes)
+{
+	Spectator* spectator = &spectators[slot];
+
+	uint32_t offset = 0;
+
+	// If nothing is queued, send straight from the frame and only queue what's left
+	if (spectator->sendLength == 0)
+	{
+		ssize_t bytes = send(spectator->sockfd, frame, numBytes, MSG_NOSIGNAL);
+
+		if (bytes == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		{
+			closeSpectator(slot);
+			return;
+		}
+
+		if (bytes > 0) offset = bytes;
+	}
+
+	if (offset == numBytes) return;
+
+	// A spectator that cannot keep up is disconnected
+	uint32_t queuedBytes = spectator->sendLength + numBytes - offset;
+
+	if (queuedBytes > RELAY_QUEUE_LIMIT)
+	{
+		closeSpectator(slot);
+		return;
+	}
+
+	// Take a buffer from the pool, or a larger one if the queued output outgrows it
+	if (spectator->sendBuffer == NULL || queuedBytes > spectator->sendCapacity)
+	{
+		uint32_t capacity;
+		uint8_t* buffer = ioPool.acquire(queuedBytes, &capacity);
+
+		if (buffer == NULL)
+		{
+			closeSpectator(slot);
+			return;
+		}
+
+		if (spectator->sendLength > 0)
+		{
+			memcpy(buffer, spectator->sendBuffer, spectator->sendLength);
+		}
+
+		ioPool.release(spectator->sendBuffer, spectator->sendCapacity);
+		spectator->sendBuffer = buffer;
+		spectator->sendCapacity = capacity;
+	}
+
+	bool wasEmpty = spectator->sendLength == 0;
+
+	memcpy(spectator->sendBuffer + spectator->sendLength, frame + offset, numBytes - offset);
+	spectator->sendLength += numBytes - offset;
+
+	if (wasEmpty) updateSpectatorEvents(slot);
+}
+
+
+void SpectatorRelay::flushSpectator(int slot)
+{
+	Spectator* spectator = &spectators[slot];
+
+	uint32_t offset = 0;
+
+	while (offset < spectator->sendLength)
+	{
+		ssize_t bytes = send(spectator->sockfd, spectator->sendBuffer + offset, spectator->sendLength - offset, MSG_NOSIGNAL);
+
+		if (bytes == -1)
+		{
+			if (errno == EINTR) continue;
+
+			// The socket is full, the rest is sent when it becomes writable
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+
+			closeSpectator(slot);
+			return;
+		}
+
+		offset += bytes;
+	}
+
+	// Move the unsent bytes to the front of the buffer
+	spectator->sendLength -= offset;
+
+	if (offset > 0 && spectator->sendLength > 0)
+	{
+		memmove(spectator->sendBuffer, spectator->sendBuffer + offset, spectator->sendLength);
+	}
+
+	// Give the buffer back once everything is sent
+	if (spectator->sendLength == 0)
+	{
+		ioPool.release(spectator->sendBuffer, spectator->sendCapacity);
+		spectator->sendBuffer = NULL;
+		updateSpectatorEvents(slot);
+	}
+}
+
+
+void SpectatorRelay::updateSpectatorEvents(int slot)
+{
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.u64 = slot + 2;
+
+	if (spectators[slot].sendLength > 0)
+	{
+		event.events |= EPOLLOUT;
+	}
+
+	epoll_ctl(epollfd, EPOLL_CTL_MOD, spectators[slot].sockfd, &event);
+}
+
+
+void SpectatorRelay::closeSpectator(int slot)
+{
+	if (spectators[slot].isClosing) return;
+
+	spectators[slot].isClosing = true;
+
+	closingSlots[numClosingSlots] = slot;
+	numClosingSlots++;
+}
+
+
+void SpectatorRelay::removeClosedSpectators()
+{
+	for (int i = 0; i < numClosingSlots; i++)
+	{
+		int slot = closingSlots[i];
+		Spectator* spectator = &spectators[slot];
+
+		// Closing the socket also removes it from the epoll instance
+		close(spectator->sockfd);
+		ioPool.release(spectator->sendBuffer, spectator->sendCapacity);
+
+		spectator->sockfd = -1;
+		spectator->sendBuffer = NULL;
+		spectator->sendLength = 0;
+		spectator->isClosing = false;
+
+		liveSpectators.remove(slot);
+		freeSlots[numFreeSlots] = slot;
+		numFreeSlots++;
+		numSpectators--;
+	}
+
+	numClosingSlots = 0;
+}
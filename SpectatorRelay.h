@@ -0,0 +1,140 @@
+#ifndef SPECTATOR_RELAY_H
+#define SPECTATOR_RELAY_H
+
+
+/********************************************************************************************************************************************
+ *
+ * The spectator relay moves the cost of many spectators off the game server.
+ * It connects to the game server like a player and subscribes as a relay with the server's relay secret.
+ * The game server then sends it each map update, spawn and annihilation frame once, like to any player,
+ * and the relay sends the frames on to every spectator connected to it.
+ *
+ * Spectators only receive: whatever they send is discarded.
+ * A spectator that still has output queued skips map updates (the next one supersedes them),
+ * but spawn and annihilation frames are always queued, and a spectator whose queue overflows is disconnected.
+ *
+ * Unlike the game server, the relay uses epoll, since select() cannot track more than FD_SETSIZE sockets.
+ * If the connection to the game server is lost, the relay exits.
+ *
+ *********************************************************************************************************************************************/
+
+
+#include <sys/epoll.h>
+#include <sys/un.h>
+
+#include "GameServer.h"
+#include "SlotBitset.h"
+
+
+#define RELAY_SPECTATOR_LIMIT		4096	// Max spectators per relay
+#define RELAY_EVENT_BATCH			256		// Max epoll events handled per wakeup
+#define RELAY_QUEUE_LIMIT			16384	// Most output queued for a spectator before it is disconnected
+
+
+// Settings of a relay, given on the command line
+typedef struct
+{
+	const char* portNum;		// Port spectators connect to
+	const char* serverHost;		// Game server to subscribe to, or the path of its local socket
+	const char* serverPort;		// NULL when serverHost is a local socket path
+	const char* secret;			// Relay secret of the game server
+	int backlog;
+
+} RelayConfig;
+
+
+typedef struct
+{
+	int sockfd;
+
+	// Set when the connection failed or fell too far behind
+	// The socket is closed once the current batch of events is handled
+	bool isClosing;
+
+	// Output that the socket could not take yet, taken from the I/O buffer pool only while output is pending
+	uint8_t* sendBuffer;
+	uint32_t sendCapacity;
+	uint32_t sendLength;
+
+} Spectator;
+
+
+class SpectatorRelay
+{
+	private:
+
+		RelayConfig config;
+		int listenfd;
+		int serverfd;
+		int epollfd;
+
+		Spectator spectators[RELAY_SPECTATOR_LIMIT];
+		int numSpectators;
+
+		// Slots of the connected spectators, so relaying a frame only visits those
+		SlotBitset<RELAY_SPECTATOR_LIMIT> liveSpectators;
+
+		// Free spectator slots, used as a stack
+		int freeSlots[RELAY_SPECTATOR_LIMIT];
+		int numFreeSlots;
+
+		// Slots to close at the end of the current batch of events
+		int closingSlots[RELAY_SPECTATOR_LIMIT];
+		int numClosingSlots;
+
+		IOBufferPool ioPool;
+
+		// Frames received from the game server, and the bytes of the last one that is still incomplete
+		uint8_t serverBuffer[MAX_FRAME_SIZE];
+		uint32_t serverLength;
+
+
+		// Connect to the game server over TCP, or over its local socket
+		// Return the socket, or -1 if unsuccessful
+		int connectToTCPServer();
+		int connectToLocalServer();
+
+		// Connect to the game server and send the subscription
+		// Return the socket, or -1 if unsuccessful
+		int connectToServer();
+
+		// Create the non-blocking socket spectators connect to
+		// Return the socket, or -1 if unsuccessful
+		int createListener();
+
+		// Accept every pending spectator connection
+		void acceptSpectators();
+
+		// Read from the game server and relay every complete frame
+		// Return -1 if the connection to the game server is lost
+		int readFromServer();
+
+		// Send a frame to every spectator
+		// canSkip: spectators with queued output do not get the frame (map updates)
+		void relayFrame(const uint8_t* frame, uint32_t numBytes, bool canSkip);
+
+		// Send a frame to a spectator, queueing what the socket does not take
+		void sendToSpectator(int slot, const uint8_t* frame, uint32_t numBytes);
+
+		// Send as much of the spectator's queued output as the socket takes
+		void flushSpectator(int slot);
+
+		// Ask epoll to report the spectator's socket writable only while output is queued
+		void updateSpectatorEvents(int slot);
+
+		// Mark the spectator to be closed at the end of the current batch of events
+		void closeSpectator(int slot);
+
+		// Close the spectators marked during the batch and free their slots
+		void removeClosedSpectators();
+
+	public:
+
+		SpectatorRelay(const RelayConfig& config);
+		~SpectatorRelay();
+
+		// Relay frames until the connection to the game server is lost
+		void run();
+};
+
+#endif
@@ -0,0 +1,67 @@
+#include "TickJitterMonitor.h"
+
+#include <stdlib.h>
+
+
+static int compareSamples(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	
+	return (x > y) - (x < y);
+}
+
+
+TickJitterMonitor::TickJitterMonitor()
+{
+	numSamples = 0;
+	p50 = 0;
+	p99 = 0;
+	p999 = 0;
+	max = 0;
+}
+
+
+bool TickJitterMonitor::recordTickStart(double lateMillisec)
+{
+	samples[numSamples] = lateMillisec;
+	numSamples++;
+	
+	if (numSamples < JITTER_WINDOW_TICKS) return false;
+	
+	// Sorting once per window keeps the per-tick cost to a single store
+	qsort(samples, numSamples, sizeof(double), compareSamples);
+	
+	p50 = samples[numSamples * 50 / 100];
+	p99 = samples[numSamples * 99 / 100];
+	p999 = samples[numSamples * 999 / 1000];
+	max = samples[numSamples - 1];
+	
+	numSamples = 0;
+	
+	return true;
+}
+
+
+double TickJitterMonitor::getP50()
+{
+	return p50;
+}
+
+
+double TickJitterMonitor::getP99()
+{
+	return p99;
+}
+
+
+double TickJitterMonitor::getP999()
+{
+	return p999;
+}
+
+
+double TickJitterMonitor::getMax()
+{
+	return max;
+}
@@ -0,0 +1,46 @@
+#ifndef TICK_JITTER_MONITOR_H
+#define TICK_JITTER_MONITOR_H
+
+
+/********************************************************************************************************************************************
+ * 
+ * The tick jitter monitor measures how late each tick starts compared to the time it was scheduled for.
+ * Samples are collected over a window of JITTER_WINDOW_TICKS ticks.
+ * When the window is full, the percentiles of the window are computed and a new window starts.
+ * The 99th and 99.9th percentiles show the outliers that players notice, which the average hides.
+ * 
+ *********************************************************************************************************************************************/
+
+
+#define JITTER_WINDOW_TICKS			2000	// Ticks per report, enough samples for a meaningful 99.9th percentile
+
+
+class TickJitterMonitor
+{
+	private:
+		
+		double samples[JITTER_WINDOW_TICKS];
+		int numSamples;
+		
+		// Percentiles of the last full window, in milliseconds
+		double p50;
+		double p99;
+		double p999;
+		double max;
+		
+	public:
+		
+		TickJitterMonitor();
+		
+		// Record how late a tick started, in milliseconds
+		// Return true if the window is full and new percentiles are available
+		bool recordTickStart(double lateMillisec);
+		
+		// Percentiles of the last full window, in milliseconds
+		double getP50();
+		double getP99();
+		double getP999();
+		double getMax();
+};
+
+#endif
@@ -0,0 +1,139 @@
+#include "TickTracer.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+
+// Ring of each thread, as an index into the rings of the (single) tracer
+static thread_local int threadRing = -1;
+
+
+static double getMonotonicMicrosec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+
+TickTracer::TickTracer()
+{
+	numRings = 0;
+
+	for (int i = 0; i < TRACE_THREAD_LIMIT; i++)
+	{
+		rings[i].numEvents = 0;
+		rings[i].threadID = 0;
+	}
+
+	startTicks = now();
+	startMicrosec = getMonotonicMicrosec();
+}
+
+
+uint64_t TickTracer::now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+
+TraceRing* TickTracer::getRing()
+{
+	if (threadRing == -1)
+	{
+		int ring = numRings.fetch_add(1);
+
+		if (ring >= TRACE_THREAD_LIMIT) return NULL;
+
+		rings[ring].threadID = gettid();
+		threadRing = ring;
+	}
+
+	return &rings[threadRing];
+}
+
+
+void TickTracer::record(const char* name, uint64_t start, uint64_t end)
+{
+	TraceRing* ring = getRing();
+
+	if (ring == NULL) return;
+
+	TraceEvent* event = &ring->events[ring->numEvents % TRACE_RING_SIZE];
+
+	event->name = name;
+	event->start = start;
+	event->end = end;
+
+	ring->numEvents++;
+}
+
+
+int TickTracer::dump(const char* path)
+{
+	FILE* file = fopen(path, "w");
+
+	if (file == NULL)
+	{
+		fprintf(stderr, "Failed to write the tick trace to %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	// Counter ticks per microsecond, measured over the whole life of the tracer
+	double ticksPerMicrosec = (now() - startTicks) / (getMonotonicMicrosec() - startMicrosec);
+
+	if (ticksPerMicrosec <= 0) ticksPerMicrosec = 1;
+
+	int pid = getpid();
+	int numWritten = 0;
+	int usedRings = numRings.load();
+
+	if (usedRings > TRACE_THREAD_LIMIT) usedRings = TRACE_THREAD_LIMIT;
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	for (int i = 0; i < usedRings; i++)
+	{
+		TraceRing* ring = &rings[i];
+
+		uint64_t numEvents = ring->numEvents;
+		uint64_t first = (numEvents > TRACE_RING_SIZE) ? numEvents - TRACE_RING_SIZE : 0;
+
+		// Complete events ("X"): start and duration in microseconds
+		for (uint64_t k = first; k < numEvents; k++)
+		{
+			const TraceEvent* event = &ring->events[k % TRACE_RING_SIZE];
+
+			double start = (event->start - startTicks) / ticksPerMicrosec;
+			double duration = (event->end - event->start) / ticksPerMicrosec;
+
+			fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}\n", (numWritten > 0) ? "," : "", event->name, start, duration, pid, ring->threadID);
+			numWritten++;
+		}
+	}
+
+	fprintf(file, "]}\n");
+
+	if (fclose(file) != 0)
+	{
+		fprintf(stderr, "Failed to write the tick trace to %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	return numWritten;
+}
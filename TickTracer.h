@@ -0,0 +1,107 @@
+#ifndef TICK_TRACER_H
+#define TICK_TRACER_H
+
+
+/********************************************************************************************************************************************
+ *
+ * The tick tracer records how long each phase of the game loop takes, so a long tick can be traced back to its cause
+ * (waiting in select, accepting, processing frames, resolving explosions, broadcasting, ...).
+ *
+ * A trace point is a scope (TRACE_SCOPE) or a pair of timestamps passed to record().
+ * Timestamps are read from the CPU's time stamp counter, which costs a few nanoseconds, so the trace points are always compiled in.
+ * Each thread writes to its own ring of the last TRACE_RING_SIZE events, without locks.
+ *
+ * dump() writes the events of every ring as a Chrome trace (JSON), which chrome://tracing and ui.perfetto.dev open.
+ * The time stamp counter is converted to microseconds by comparing it to the monotonic clock since the tracer was created.
+ * A ring written to while it is dumped may show a few torn events, which is acceptable for a diagnostic.
+ *
+ *********************************************************************************************************************************************/
+
+
+#include <stdint.h>
+#include <atomic>
+
+
+#define TRACE_RING_SIZE				8192	// Events kept per thread (several ticks' worth)
+#define TRACE_THREAD_LIMIT			4		// Most threads that can record events
+
+// Trace the rest of the enclosing scope under the name
+#define TRACE_CONCAT_INNER(a, b)	a##b
+#define TRACE_CONCAT(a, b)			TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(tracer, name)	TraceScope TRACE_CONCAT(traceScope, __LINE__)(tracer, name)
+
+
+typedef struct
+{
+	const char* name;		// Static string, only the pointer is kept
+	uint64_t start;			// Time stamp counter
+	uint64_t end;
+
+} TraceEvent;
+
+
+typedef struct
+{
+	TraceEvent events[TRACE_RING_SIZE];
+	uint64_t numEvents;		// Events recorded so far, the oldest ones are overwritten
+	int threadID;
+
+} TraceRing;
+
+
+class TickTracer
+{
+	private:
+
+		TraceRing rings[TRACE_THREAD_LIMIT];
+		std::atomic<int> numRings;
+
+		// Time stamp counter and monotonic clock when the tracer was created, to convert the counter to microseconds
+		uint64_t startTicks;
+		double startMicrosec;
+
+		// Ring of the calling thread, taken the first time the thread records an event
+		// Return NULL if every ring is taken
+		TraceRing* getRing();
+
+	public:
+
+		TickTracer();
+
+		// Current value of the time stamp counter (the monotonic clock in nanoseconds where there is none)
+		static uint64_t now();
+
+		// Record a phase of the calling thread that started and ended at the specified timestamps
+		void record(const char* name, uint64_t start, uint64_t end);
+
+		// Write every recorded event to the file as a Chrome trace
+		// Return the number of events written, or -1 if the file cannot be written
+		int dump(const char* path);
+};
+
+
+// Record the time from its creation to the end of its scope
+class TraceScope
+{
+	private:
+
+		TickTracer* tracer;
+		const char* name;
+		uint64_t start;
+
+	public:
+
+		TraceScope(TickTracer* tracer, const char* name)
+		{
+			this->tracer = tracer;
+			this->name = name;
+			start = TickTracer::now();
+		}
+
+		~TraceScope()
+		{
+			tracer->record(name, start, TickTracer::now());
+		}
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include "WorldSnapshot.h"
+
+#include <string.h>
+
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "The snapshot slots need lock-free 64-bit atomics");
+
+
+WorldSnapshot::WorldSnapshot()
+{
+	for (int i = 0; i < 2; i++)
+	{
+		slots[i].sequence = 0;
+
+		for (size_t w = 0; w < SNAPSHOT_WORDS; w++) slots[i].words[w] = 0;
+	}
+
+	published = 0;
+	memset(&writing, 0, sizeof(WorldView));
+}
+
+
+WorldView* WorldSnapshot::begin()
+{
+	return &writing;
+}
+
+
+void WorldSnapshot::publish()
+{
+	// Write the slot readers are not pointed at
+	Slot* slot = &slots[(published.load(std::memory_order_relaxed) + 1) % 2];
+
+	uint64_t words[SNAPSHOT_WORDS];
+	words[SNAPSHOT_WORDS - 1] = 0;
+	memcpy(words, &writing, sizeof(WorldView));
+
+	uint32_t sequence = slot->sequence.load(std::memory_order_relaxed);
+	slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+
+	// Release stores keep the odd sequence number ahead of any of the new content
+	for (size_t w = 0; w < SNAPSHOT_WORDS; w++)
+	{
+		slot->words[w].store(words[w], std::memory_order_release);
+	}
+
+	slot->sequence.store(sequence + 2, std::memory_order_release);
+
+	published.store(published.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+
+void WorldSnapshot::read(WorldView* view) const
+{
+	uint64_t words[SNAPSHOT_WORDS];
+
+	while (true)
+	{
+		const Slot* slot = &slots[published.load(std::memory_order_acquire) % 2];
+
+		uint32_t before = slot->sequence.load(std::memory_order_acquire);
+
+		// The loop is writing this slot right now, the other one is complete by then
+		if (before % 2 != 0) continue;
+
+		// Acquire loads keep the sequence number check below after the copy
+		for (size_t w = 0; w < SNAPSHOT_WORDS; w++)
+		{
+			words[w] = slot->words[w].load(std::memory_order_acquire);
+		}
+
+		if (slot->sequence.load(std::memory_order_relaxed) == before) break;
+	}
+
+	memcpy(view, words, sizeof(WorldView));
+}
@@ -0,0 +1,91 @@
+#ifndef WORLD_SNAPSHOT_H
+#define WORLD_SNAPSHOT_H
+
+
+/********************************************************************************************************************************************
+ *
+ * The world snapshot lets other threads (the admin socket, or tools built into the server) read the state of the game
+ * as of the last tick, without locks and without ever making the game loop wait.
+ *
+ * At the end of every tick, the loop fills in a view of the players (ID, position, score, whether the robot is on the map,
+ * and how many robots are within its explosion radius), and publishes it.
+ * Publishing alternates between two slots, each guarded by a sequence number (a seqlock):
+ * the writer makes the number odd, copies the view into the slot, then makes it even again, and finally points readers at the slot.
+ * A reader copies the latest slot and checks that its sequence number was even and did not change meanwhile, or tries again.
+ * The slots are copied in and out as 64-bit atomic words (release stores, acquire loads), so a copy that races with the writer
+ * is well-defined under the C++ memory model, and is simply thrown away. On x86-64 these are plain moves.
+ * The writer never waits for readers. A reader only has to retry if the loop wrote into the very slot it was copying,
+ * which takes two ticks to happen, so a copy of a couple of kilobytes practically never retries.
+ *
+ *********************************************************************************************************************************************/
+
+
+#include <stdint.h>
+#include <atomic>
+
+
+#define SNAPSHOT_PLAYER_LIMIT		64		// Most players a snapshot holds (at least PLAYER_LIMIT, checked in GameServer.h)
+
+
+typedef struct
+{
+	int32_t id;				// ID the player is known by in messages
+	float x, y, z;
+	int32_t score;
+	bool isAlive;			// The robot is on the map
+	int32_t numNeighbours;	// Robots of this server within the explosion radius (the robot's own explosion would take them out)
+	uint32_t movesReceived;	// PLAYER_MOVE frames since the player joined
+	uint32_t movesCoalesced;	// Moves superseded by a later move of the same tick
+	uint32_t ticksAtMoveLimit;	// Ticks in which the player sent MOVE_INPUT_LIMIT moves
+
+} PlayerView;
+
+
+typedef struct
+{
+	uint32_t tick;			// Tick the snapshot was taken at, 0 before the first tick
+	double timeMillisec;	// Monotonic clock when it was taken
+	int32_t numPlayers;
+	PlayerView players[SNAPSHOT_PLAYER_LIMIT];
+
+} WorldView;
+
+
+// Number of 64-bit words a slot stores a view in
+#define SNAPSHOT_WORDS				((sizeof(WorldView) + 7) / 8)
+
+
+class WorldSnapshot
+{
+	private:
+
+		typedef struct
+		{
+			std::atomic<uint32_t> sequence;		// Odd while the slot is being written
+			std::atomic<uint64_t> words[SNAPSHOT_WORDS];
+
+		} Slot;
+
+		Slot slots[2];
+
+		// Number of snapshots published, the latest one is in slots[published % 2]
+		std::atomic<uint32_t> published;
+
+		// View the game loop fills in between begin() and publish(), only used by the loop
+		WorldView writing;
+
+	public:
+
+		WorldSnapshot();
+
+		// Game loop only: start the next snapshot and return the view to fill in
+		WorldView* begin();
+
+		// Game loop only: copy the view returned by begin() into the next slot, and make it the one readers get
+		void publish();
+
+		// Any thread: copy the latest snapshot into view, without blocking the game loop
+		void read(WorldView* view) const;
+};
+
+#endif
@@ -0,0 +1,580 @@
+/********************************************************************************************************************************************
+ *
+ * Load generator: plays a number of clients against a game server, over loopback or any other network.
+ *
+ * The clients join one after the other over TCP, each spawns a robot and moves it to a random position 20 times per second.
+ * With -u, every client also moves its map updates to UDP (see UDP CHANNEL in the README):
+ * it first sends a registration datagram with a wrong token, which the server must ignore,
+ * then the right one, resent until the server confirms the registration over TCP.
+ * The sequenced map updates received over UDP are then checked: each one must be well formed, carry a sequence number
+ * higher than the last one, and the client's own robot must show up in them.
+ * Over TCP, the join response must come before anything else.
+ * Map updates still received over TCP after the registration are counted, they are the updates too large for a datagram.
+ *
+ * At the end, the totals are printed, and the exit status is 1 if any check failed, so it can be run as a test (make check).
+ *
+ *********************************************************************************************************************************************/
+
+
+#include "GameServer.h"
+
+
+#define LOADGEN_CLIENT_LIMIT		PLAYER_LIMIT
+#define LOADGEN_JOIN_MILLISEC		100		// Interval between two clients joining, so they also join while the game runs
+#define LOADGEN_MOVE_MILLISEC		50		// Interval between two moves of a client
+#define LOADGEN_REGISTER_MILLISEC	100		// Interval between two registration datagrams until the server confirms
+#define LOADGEN_FORGED_MILLISEC		200		// Time given to the server to (wrongly) accept the forged registration
+#define LOADGEN_BUFFER_SIZE			65536
+
+
+enum ClientState
+{
+	CLIENT_CONNECTING,		// Not connected yet
+	CLIENT_JOINING,			// Waiting for the join response
+	CLIENT_REQUESTING,		// Waiting for the UDP token
+	CLIENT_FORGED,			// Sent a registration with a wrong token, which must not be confirmed
+	CLIENT_REGISTERING,		// Sending the registration until it is confirmed
+	CLIENT_PLAYING,			// Joined, and registered if UDP is used
+	CLIENT_FAILED
+};
+
+
+typedef struct
+{
+	int sockfd;
+	int udpSockfd;
+	ClientState state;
+
+	int32_t id;
+	uint32_t token;
+
+	// TCP bytes received and not parsed yet
+	uint8_t buffer[LOADGEN_BUFFER_SIZE];
+	uint32_t length;
+
+	double joinTime;
+	double nextMove;
+	double nextRegistration;
+	int registrationsSent;
+
+	uint32_t tcpUpdates;
+	uint32_t tcpUpdatesAfterRegistration;
+	uint32_t udpUpdates;
+	uint32_t lastSequence;
+	uint32_t skippedSequences;
+	uint32_t reorderedUpdates;
+	uint32_t malformedFrames;
+	bool hasSeenOwnRobot;
+
+} Client;
+
+
+static Client clients[LOADGEN_CLIENT_LIMIT];
+
+
+static double getMonotonicMillisec()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+
+// Fields are read and written the way the server does it (see GameServer.cpp)
+static uint32_t readUint32(const uint8_t* bytes)
+{
+	uint32_t temp = 0;
+	temp |= bytes[0] << 24;
+	temp |= bytes[1] << 16;
+	temp |= bytes[2] << 8;
+	temp |= bytes[3];
+
+	return ntohl(temp);
+}
+
+
+static uint16_t readUint16(const uint8_t* bytes)
+{
+	uint16_t temp = 0;
+	temp |= bytes[0] << 8;
+	temp |= bytes[1];
+
+	return ntohs(temp);
+}
+
+
+static void writeUint32(uint8_t* bytes, uint32_t value)
+{
+	uint32_t converted = htonl(value);
+
+	bytes[0] = GET_BYTE_3(converted);
+	bytes[1] = GET_BYTE_2(converted);
+	bytes[2] = GET_BYTE_1(converted);
+	bytes[3] = GET_BYTE_0(converted);
+}
+
+
+static void writeHeader(uint8_t* message, uint32_t numBytes, uint8_t code)
+{
+	writeUint32(message, numBytes);
+	message[4] = VERSION_NUM;
+	message[5] = code;
+}
+
+
+static float getRandomCoordinate()
+{
+	return (float)rand() / RAND_MAX;
+}
+
+
+// Return -1 if the message could not be sent whole
+static int sendMessage(Client* client, const uint8_t* message, uint32_t numBytes)
+{
+	ssize_t bytes = send(client->sockfd, message, numBytes, MSG_NOSIGNAL);
+
+	if (bytes != (ssize_t)numBytes)
+	{
+		fprintf(stderr, "Client %d could not send a message: %s\n", client->id, (bytes == -1) ? strerror(errno) : "socket full");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+// Send a spawn or move message (same layout, different code)
+static int sendPosition(Client* client, uint8_t code)
+{
+	uint8_t message[18];
+	writeHeader(message, sizeof(message), code);
+
+	float position[3] = {getRandomCoordinate(), getRandomCoordinate(), getRandomCoordinate()};
+
+	for (int k = 0; k < 3; k++)
+	{
+		uint32_t binary;
+		memcpy(&binary, &position[k], sizeof(float));
+		writeUint32(message + 6 + k * 4, binary);
+	}
+
+	return sendMessage(client, message, sizeof(message));
+}
+
+
+static void sendRegistration(Client* client, uint32_t token)
+{
+	uint8_t datagram[14];
+	writeHeader(datagram, sizeof(datagram), PLAYER_UDP_REGISTER);
+	writeUint32(datagram + 6, client->id);
+	writeUint32(datagram + 10, token);
+
+	if (send(client->udpSockfd, datagram, sizeof(datagram), 0) == -1)
+	{
+		fprintf(stderr, "Client %d could not send its registration: %s\n", client->id, strerror(errno));
+	}
+
+	client->registrationsSent++;
+}
+
+
+// Check a sequenced map update received over UDP
+static void checkDatagram(Client* client, const uint8_t* datagram, ssize_t bytes)
+{
+	if (bytes < 12 || datagram[4] != VERSION_NUM || datagram[5] != SERVER_MAP_UPDATE_SEQUENCED || readUint32(datagram) != (uint32_t)bytes)
+	{
+		client->malformedFrames++;
+		return;
+	}
+
+	uint32_t sequence = readUint32(datagram + 6);
+	uint16_t numRobots = readUint16(datagram + 10);
+
+	if (bytes != 12 + numRobots * MAP_RECORD_SIZE)
+	{
+		client->malformedFrames++;
+		return;
+	}
+
+	// Sequence numbers are server ticks, a tick without an update for the player is skipped
+	if (client->udpUpdates > 0)
+	{
+		if (sequence <= client->lastSequence)
+		{
+			client->reorderedUpdates++;
+			return;
+		}
+
+		client->skippedSequences += sequence - client->lastSequence - 1;
+	}
+
+	client->udpUpdates++;
+	client->lastSequence = sequence;
+
+	for (int k = 0; k < numRobots; k++)
+	{
+		if ((int32_t)readUint32(datagram + 12 + k * MAP_RECORD_SIZE) == client->id) client->hasSeenOwnRobot = true;
+	}
+}
+
+
+// Handle one frame received over TCP
+// Return -1 if the client failed
+static int processFrame(Client* client, const uint8_t* frame, uint32_t numBytes, double now)
+{
+	switch (frame[5])
+	{
+		case PLAYER_JOIN_RESPONSE:
+		{
+			if (client->state != CLIENT_JOINING || numBytes != 10) return -1;
+
+			client->id = (int32_t)readUint32(frame + 6);
+			client->state = CLIENT_PLAYING;
+
+			if (sendPosition(client, PLAYER_SPAWN) == -1) return -1;
+
+			if (client->udpSockfd != -1)
+			{
+				uint8_t message[6];
+				writeHeader(message, sizeof(message), PLAYER_UDP_REQUEST);
+
+				if (sendMessage(client, message, sizeof(message)) == -1) return -1;
+
+				client->state = CLIENT_REQUESTING;
+			}
+			break;
+		}
+		case SERVER_UDP_TOKEN:
+		{
+			if (client->state != CLIENT_REQUESTING || numBytes != 14) return -1;
+
+			client->token = readUint32(frame + 10);
+
+			// The server must ignore a registration with the wrong token
+			sendRegistration(client, client->token + 1);
+			client->state = CLIENT_FORGED;
+			client->nextRegistration = now + LOADGEN_FORGED_MILLISEC;
+			break;
+		}
+		case SERVER_UDP_REGISTERED:
+		{
+			if (client->state == CLIENT_FORGED)
+			{
+				fprintf(stderr, "Client %d was registered with a wrong token\n", client->id);
+				return -1;
+			}
+
+			if (client->state == CLIENT_REGISTERING) client->state = CLIENT_PLAYING;
+			break;
+		}
+		case SERVER_MAP_UPDATE:
+		case SERVER_MAP_UPDATE_SEQUENCED:
+		case SERVER_COMPRESSED_FRAME:
+		case SERVER_MAP_UPDATE_PARTIAL:
+		{
+			// The join response is the first thing a player gets
+			if (client->state == CLIENT_JOINING)
+			{
+				fprintf(stderr, "Client received a map update before its join response\n");
+				return -1;
+			}
+			
+			client->tcpUpdates++;
+
+			if (client->udpSockfd != -1 && client->state == CLIENT_PLAYING) client->tcpUpdatesAfterRegistration++;
+			break;
+		}
+		default:
+		{
+			// Spawn and annihilation broadcasts of the other clients
+			break;
+		}
+	}
+
+	return 0;
+}
+
+
+// Read what the server sent over TCP and handle the complete frames
+// Return -1 if the connection failed
+static int receiveFrames(Client* client, double now)
+{
+	ssize_t bytes = recv(client->sockfd, client->buffer + client->length, LOADGEN_BUFFER_SIZE - client->length, 0);
+
+	if (bytes == 0 || (bytes == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+	{
+		fprintf(stderr, "Client %d lost its connection\n", client->id);
+		return -1;
+	}
+	if (bytes == -1) return 0;
+
+	client->length += bytes;
+
+	uint32_t offset = 0;
+
+	while (client->length - offset >= 6)
+	{
+		uint32_t numBytes = readUint32(client->buffer + offset);
+
+		if (numBytes < 6 || numBytes > LOADGEN_BUFFER_SIZE)
+		{
+			fprintf(stderr, "Client %d received an invalid frame length %u\n", client->id, numBytes);
+			return -1;
+		}
+		if (client->length - offset < numBytes) break;
+
+		if (processFrame(client, client->buffer + offset, numBytes, now) == -1) return -1;
+
+		offset += numBytes;
+	}
+
+	memmove(client->buffer, client->buffer + offset, client->length - offset);
+	client->length -= offset;
+
+	return 0;
+}
+
+
+// Connect a socket of the type to the server
+static int connectSocket(const char* host, const char* port, int socktype)
+{
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = socktype;
+
+	struct addrinfo* result;
+	int res = getaddrinfo(host, port, &hints, &result);
+
+	if (res != 0)
+	{
+		fprintf(stderr, "Cannot resolve %s:%s: %s\n", host, port, gai_strerror(res));
+		return -1;
+	}
+
+	int sockfd = -1;
+
+	for (struct addrinfo* addr = result; addr != NULL && sockfd == -1; addr = addr->ai_next)
+	{
+		sockfd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+
+		if (sockfd == -1) continue;
+
+		if (connect(sockfd, addr->ai_addr, addr->ai_addrlen) == -1)
+		{
+			close(sockfd);
+			sockfd = -1;
+		}
+	}
+
+	freeaddrinfo(result);
+
+	if (sockfd == -1)
+	{
+		fprintf(stderr, "Cannot connect to %s:%s: %s\n", host, port, strerror(errno));
+		return -1;
+	}
+
+	fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+
+	return sockfd;
+}
+
+
+static void printUsage(const char* program)
+{
+	fprintf(stderr, "Usage: %s [-n clients] [-d seconds] [-u] host port\n", program);
+	fprintf(stderr, "  -n  number of clients (default 8, max %d)\n", LOADGEN_CLIENT_LIMIT);
+	fprintf(stderr, "  -d  how long the clients play, in seconds (default 3)\n");
+	fprintf(stderr, "  -u  register a UDP endpoint and check the map updates received over UDP\n");
+}
+
+
+int main(int argc, char* argv[])
+{
+	int numClients = 8;
+	double durationMillisec = 3000;
+	bool useUDP = false;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:d:u")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n': numClients = atoi(optarg); break;
+			case 'd': durationMillisec = atof(optarg) * 1000; break;
+			case 'u': useUDP = true; break;
+			default: printUsage(argv[0]); return 1;
+		}
+	}
+
+	if (argc - optind != 2 || numClients < 1 || numClients > LOADGEN_CLIENT_LIMIT || !(durationMillisec > 0))
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	const char* host = argv[optind];
+	const char* port = argv[optind + 1];
+
+	srand(time(NULL));
+
+	double start = getMonotonicMillisec();
+	double end = start + durationMillisec + numClients * LOADGEN_JOIN_MILLISEC;
+	double now = start;
+
+	for (int i = 0; i < numClients; i++)
+	{
+		Client* client = &clients[i];
+		memset(client, 0, sizeof(Client));
+		client->id = -1;
+		client->state = CLIENT_CONNECTING;
+		client->sockfd = -1;
+		client->udpSockfd = -1;
+		client->joinTime = start + i * LOADGEN_JOIN_MILLISEC;
+	}
+
+	while (now < end)
+	{
+		fd_set readSet;
+		FD_ZERO(&readSet);
+		int highestfd = -1;
+
+		for (int i = 0; i < numClients; i++)
+		{
+			if (clients[i].state == CLIENT_FAILED || clients[i].state == CLIENT_CONNECTING) continue;
+
+			FD_SET(clients[i].sockfd, &readSet);
+			if (clients[i].sockfd > highestfd) highestfd = clients[i].sockfd;
+
+			if (clients[i].udpSockfd != -1)
+			{
+				FD_SET(clients[i].udpSockfd, &readSet);
+				if (clients[i].udpSockfd > highestfd) highestfd = clients[i].udpSockfd;
+			}
+		}
+
+		struct timeval timeout;
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 10000;
+
+		if (select(highestfd + 1, &readSet, NULL, NULL, &timeout) == -1 && errno != EINTR)
+		{
+			fprintf(stderr, "Error waiting for socket activity: %s\n", strerror(errno));
+			return 1;
+		}
+
+		now = getMonotonicMillisec();
+
+		for (int i = 0; i < numClients; i++)
+		{
+			Client* client = &clients[i];
+
+			if (client->state == CLIENT_CONNECTING && now >= client->joinTime)
+			{
+				client->sockfd = connectSocket(host, port, SOCK_STREAM);
+				if (client->sockfd == -1) return 1;
+
+				if (useUDP)
+				{
+					client->udpSockfd = connectSocket(host, port, SOCK_DGRAM);
+					if (client->udpSockfd == -1) return 1;
+				}
+
+				client->state = CLIENT_JOINING;
+				continue;
+			}
+
+			if (client->state == CLIENT_FAILED || client->state == CLIENT_CONNECTING) continue;
+
+			if (FD_ISSET(client->sockfd, &readSet) && receiveFrames(client, now) == -1)
+			{
+				client->state = CLIENT_FAILED;
+				continue;
+			}
+
+			if (client->udpSockfd != -1 && FD_ISSET(client->udpSockfd, &readSet))
+			{
+				uint8_t datagram[UDP_MAX_DATAGRAM];
+				ssize_t bytes;
+
+				while ((bytes = recv(client->udpSockfd, datagram, sizeof(datagram), 0)) > 0)
+				{
+					checkDatagram(client, datagram, bytes);
+				}
+			}
+
+			// The forged registration had its chance, register for real, and again until the server confirms
+			if ((client->state == CLIENT_FORGED || client->state == CLIENT_REGISTERING) && now >= client->nextRegistration)
+			{
+				sendRegistration(client, client->token);
+				client->state = CLIENT_REGISTERING;
+				client->nextRegistration = now + LOADGEN_REGISTER_MILLISEC;
+			}
+
+			if (client->state != CLIENT_JOINING && now >= client->nextMove)
+			{
+				if (sendPosition(client, PLAYER_MOVE) == -1) client->state = CLIENT_FAILED;
+				client->nextMove = now + LOADGEN_MOVE_MILLISEC;
+			}
+		}
+	}
+
+	// Totals, and the checks that make the run fail
+	int numFailed = 0;
+	int numJoined = 0;
+	int numRegistered = 0;
+	uint32_t tcpUpdates = 0;
+	uint32_t tcpUpdatesAfterRegistration = 0;
+	uint32_t udpUpdates = 0;
+	uint32_t skippedSequences = 0;
+	uint32_t reorderedUpdates = 0;
+	uint32_t malformedFrames = 0;
+	int registrationsSent = 0;
+
+	for (int i = 0; i < numClients; i++)
+	{
+		Client* client = &clients[i];
+
+		if (client->id != -1) numJoined++;
+		if (useUDP && client->state == CLIENT_PLAYING) numRegistered++;
+
+		tcpUpdates += client->tcpUpdates;
+		tcpUpdatesAfterRegistration += client->tcpUpdatesAfterRegistration;
+		udpUpdates += client->udpUpdates;
+		skippedSequences += client->skippedSequences;
+		reorderedUpdates += client->reorderedUpdates;
+		malformedFrames += client->malformedFrames;
+		registrationsSent += client->registrationsSent;
+
+		bool hasFailed = client->state != CLIENT_PLAYING || client->tcpUpdates + client->udpUpdates == 0;
+
+		if (useUDP && (client->udpUpdates == 0 || !client->hasSeenOwnRobot || client->reorderedUpdates > 0 || client->malformedFrames > 0))
+		{
+			hasFailed = true;
+		}
+
+		if (hasFailed)
+		{
+			fprintf(stderr, "Client %d failed: %u updates over TCP, %u over UDP, %u out of order, %u malformed, own robot %s\n", client->id, client->tcpUpdates, client->udpUpdates, client->reorderedUpdates, client->malformedFrames, client->hasSeenOwnRobot ? "seen" : "not seen");
+			numFailed++;
+		}
+
+		if (client->sockfd != -1) close(client->sockfd);
+		if (client->udpSockfd != -1) close(client->udpSockfd);
+	}
+
+	fprintf(stdout, "%d clients joined, %u map updates over TCP\n", numJoined, tcpUpdates);
+
+	if (useUDP)
+	{
+		fprintf(stdout, "%d clients registered over UDP (%d registration datagrams, forged ones included)\n", numRegistered, registrationsSent);
+		fprintf(stdout, "%u map updates over UDP, %u ticks skipped, %u out of order, %u malformed\n", udpUpdates, skippedSequences, reorderedUpdates, malformedFrames);
+		fprintf(stdout, "%u map updates over TCP after registering (too large for a datagram)\n", tcpUpdatesAfterRegistration);
+	}
+
+	fprintf(stdout, "%s: %d of %d clients failed\n", (numFailed == 0) ? "PASS" : "FAIL", numFailed, numClients);
+
+	return (numFailed == 0) ? 0 : 1;
+}
@@ -1,16 +1,165 @@
 #include "GameServer.h"
+#include "SpectatorRelay.h"
 
 
-int main(int argc, const char* argv[])
+static void printUsage(const char* program)
 {
+	fprintf(stderr, "Usage: %s [-b backlog] [-D] [-s send buffer bytes] [-r receive buffer bytes] [-t min tick ms] [-T max tick ms] [-z compression threshold] [-w max rewind ticks] [-Z zerocopy threshold] [-L core] [-F priority] [-R relay secret] [-S host:port] [-C region:regions:directory] [-P trace budget ms] [-U local socket path] [-A admin socket path] [-M] port\n", program);
+	fprintf(stderr, "  -b  listen backlog (default %d)\n", LISTEN_BACKLOG);
+	fprintf(stderr, "  -D  do not set TCP_NODELAY on player sockets\n");
+	fprintf(stderr, "  -s  SO_SNDBUF of player sockets (default: system)\n");
+	fprintf(stderr, "  -r  SO_RCVBUF of player sockets (default: system)\n");
+	fprintf(stderr, "  -t  tick interval at normal load in ms (default %d)\n", MAP_UPDATE_MILLISEC);
+	fprintf(stderr, "  -T  longest tick interval under overload in ms (default %d)\n", MAX_TICK_MILLISEC);
+	fprintf(stderr, "  -z  size in bytes from which map updates are compressed, 0 disables (default %d)\n", COMPRESSION_THRESHOLD);
+	fprintf(stderr, "  -w  furthest an annihilation is rewound for lag compensation, in ticks, 0 disables (default %d, max %d)\n", MAX_REWIND_TICKS, HISTORY_TICKS - 1);
+	fprintf(stderr, "  -Z  size in bytes from which map updates are sent with MSG_ZEROCOPY, 0 disables (default 0)\n");
+	fprintf(stderr, "  -L  low-latency mode: pin the game loop to the core, busy poll player sockets, lock the whole process in memory\n");
+	fprintf(stderr, "  -F  SCHED_FIFO priority of the game loop in low-latency mode (default: normal scheduler)\n");
+	fprintf(stderr, "  -R  secret spectator relays subscribe with (default: relays are not accepted)\n");
+	fprintf(stderr, "  -S  run as a spectator relay of the game server at host:port (or at the path of its local socket), spectators connect to port (needs -R)\n");
+	fprintf(stderr, "  -C  cluster mode: own region (from 0) of the map split along x into regions (2 to %d), linked by sockets in directory\n", CLUSTER_REGION_LIMIT);
+	fprintf(stderr, "  -P  work per tick in ms above which the tick trace is dumped (default: only on SIGUSR1)\n");
+	fprintf(stderr, "  -U  also accept clients on the same host at this AF_UNIX socket path, which can switch to shared memory\n");
+	fprintf(stderr, "  -A  serve the world snapshot of the last tick as JSON to every connection to this AF_UNIX socket path\n");
+	fprintf(stderr, "  -M  pipeline map updates: a second thread encodes each tick's update and sends its datagrams while the loop goes on\n");
+}
+
+
+int main(int argc, char* argv[])
+{
+	ServerConfig config;
+	config.portNum = NULL;
+	config.backlog = LISTEN_BACKLOG;
+	config.noDelay = true;
+	config.sendBufferSize = 0;
+	config.recvBufferSize = 0;
+	config.minTickMillisec = MAP_UPDATE_MILLISEC;
+	config.maxTickMillisec = MAX_TICK_MILLISEC;
+	config.compressionThreshold = COMPRESSION_THRESHOLD;
+	config.maxRewindTicks = MAX_REWIND_TICKS;
+	config.zeroCopyThreshold = 0;
+	config.lowLatency = false;
+	config.cpuCore = 0;
+	config.fifoPriority = 0;
+	config.relaySecret = NULL;
+	config.regionIndex = 0;
+	config.regionCount = 1;
+	config.clusterDirectory = NULL;
+	config.traceBudgetMillisec = 0;
+	config.localPath = NULL;
+	config.adminPath = NULL;
+	config.pipelineMapUpdates = false;
+	
+	// Game server to relay, NULL to run the game server itself
+	char* relayServer = NULL;
+	
+	int opt;
+	while ((opt = getopt(argc, argv, "b:Ds:r:t:T:z:w:Z:L:F:R:S:C:P:U:A:M")) != -1)
+	{
+		switch (opt)
+		{
+			case 'b': config.backlog = atoi(optarg); break;
+			case 'D': config.noDelay = false; break;
+			case 's': config.sendBufferSize = atoi(optarg); break;
+			case 'r': config.recvBufferSize = atoi(optarg); break;
+			case 't': config.minTickMillisec = atof(optarg); break;
+			case 'T': config.maxTickMillisec = atof(optarg); break;
+			case 'z': config.compressionThreshold = atoi(optarg); break;
+			case 'w': config.maxRewindTicks = atoi(optarg); break;
+			case 'Z': config.zeroCopyThreshold = atoi(optarg); break;
+			case 'L': config.lowLatency = true; config.cpuCore = atoi(optarg); break;
+			case 'F': config.fifoPriority = atoi(optarg); break;
+			case 'R': config.relaySecret = optarg; break;
+			case 'P': config.traceBudgetMillisec = atof(optarg); break;
+			case 'U': config.localPath = optarg; break;
+			case 'A': config.adminPath = optarg; break;
+			case 'M': config.pipelineMapUpdates = true; break;
+			case 'S': relayServer = optarg; break;
+			case 'C':
+			{
+				// region:regions:directory
+				int directoryOffset = 0;
+				
+				if (sscanf(optarg, "%d:%d:%n", &config.regionIndex, &config.regionCount, &directoryOffset) != 2 || directoryOffset == 0 || optarg[directoryOffset] == '\0')
+				{
+					fprintf(stderr, "Cluster mode expects region:regions:directory\n");
+					return 0;
+				}
+				
+				config.clusterDirectory = optarg + directoryOffset;
+				break;
+			}
+			default:
+				printUsage(argv[0]);
+				return 0;
+		}
+	}
+	
 	// 1 argument is expected for server port number
-	if (argc != 2)
+	if (optind != argc - 1)
 	{
 		fprintf(stderr, "Server port number is expected as argument\n");
+		printUsage(argv[0]);
+		return 0;
+	}
+	
+	config.portNum = argv[optind];
+	
+	if (config.relaySecret != NULL && (strlen(config.relaySecret) == 0 || strlen(config.relaySecret) > RELAY_SECRET_MAX))
+	{
+		fprintf(stderr, "The relay secret must be 1 to %d characters long\n", RELAY_SECRET_MAX);
 		return 0;
 	}
 	
-	GameServer* gameServer = new GameServer(argv[1]);
+	// The overload controller divides by the tick interval and clamps it between the two
+	if (!(config.minTickMillisec > 0) || !(config.maxTickMillisec >= config.minTickMillisec))
+	{
+		fprintf(stderr, "The tick intervals must be positive, with -T at least -t (%.1f and %.1f ms given)\n", config.minTickMillisec, config.maxTickMillisec);
+		return 0;
+	}
+	
+	if (config.regionCount < 1 || config.regionCount > CLUSTER_REGION_LIMIT || config.regionIndex < 0 || config.regionIndex >= config.regionCount)
+	{
+		fprintf(stderr, "A cluster has 2 to %d regions, numbered from 0\n", CLUSTER_REGION_LIMIT);
+		return 0;
+	}
+	
+	if (relayServer != NULL)
+	{
+		// The port follows the last ':' so that the host can be an IPv6 address
+		// A path (starting with '/') is the local socket of a game server on the same host
+		bool isLocal = (relayServer[0] == '/');
+		char* separator = isLocal ? NULL : strrchr(relayServer, ':');
+		
+		if ((separator == NULL && !isLocal) || config.relaySecret == NULL)
+		{
+			fprintf(stderr, "A relay needs the game server as host:port (or its local socket path) and its relay secret (-R)\n");
+			printUsage(argv[0]);
+			return 0;
+		}
+		
+		if (separator != NULL) *separator = '\0';
+		
+		RelayConfig relayConfig;
+		relayConfig.portNum = config.portNum;
+		relayConfig.serverHost = relayServer;
+		relayConfig.serverPort = isLocal ? NULL : separator + 1;
+		relayConfig.secret = config.relaySecret;
+		relayConfig.backlog = config.backlog;
+		
+		SpectatorRelay* relay = new SpectatorRelay(relayConfig);
+		
+		relay->run();
+		
+		return 0;
+	}
+	
+	// The position history only holds HISTORY_TICKS ticks
+	if (config.maxRewindTicks < 0) config.maxRewindTicks = 0;
+	if (config.maxRewindTicks >= HISTORY_TICKS) config.maxRewindTicks = HISTORY_TICKS - 1;
+	
+	GameServer* gameServer = new GameServer(config);
 	
 	gameServer->run();
 	